@@ -0,0 +1,200 @@
+/*
+ * CC200 Assignment
+ *
+ * Author: Mike Aldred
+ *
+ * Checksum benchmark
+ *
+ * Description:
+ *   Times frame checksums against frame size, up to MAX_MESSAGE_SIZE,
+ *   for each checksum option, and for the CRC-32C tables even when the
+ *   SSE4.2 version is being used. CNET's CRC-32 is a byte at a time,
+ *   so one of those stands in for CNET_crc32 here. The results are
+ *   checked against each other first.
+ *
+ *   Build with "make bench-crc".
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "checksum.h"
+#include "config.h"
+
+// Roughly this many bytes are checksummed for each time.
+#define BYTES_PER_TIMING (256 * 1024 * 1024)
+
+// Where the checksum field is taken to be. Frames have it last (see
+// wire.h), but it costs the same anywhere.
+#define CHECKSUM_OFFSET 4
+
+static unsigned char frame[MAX_MESSAGE_SIZE];
+static uint32_t byte_table[256];
+
+// Forward declarations
+static double now_in_ns();
+static double time_checksum(const enum ChecksumMode mode, const size_t size);
+static double time_portable_crc32c(const size_t size);
+static int check_results();
+
+int main() {
+  for (int i = 0; i < 256; ++i) {
+    uint32_t crc = i;
+
+    for (int bit = 0; bit < 8; ++bit) {
+      crc = (crc & 1) ? (crc >> 1) ^ 0xedb88320u : crc >> 1;
+    }
+    byte_table[i] = crc;
+  }
+
+  for (size_t i = 0; i < sizeof(frame); ++i) {
+    frame[i] = (unsigned char)(i * 7 + 3);
+  }
+
+  parse_config(NULL);
+  init_checksum();
+
+  if (check_results() != 0) {
+    return 1;
+  }
+
+  printf("ns per frame, crc32c is %s\n", crc32c_implementation());
+  printf("%6s %10s %10s %14s %10s\n", "Bytes", "cnet", "crc32",
+         "crc32c tables", "crc32c");
+
+  for (size_t size = 64; size <= MAX_MESSAGE_SIZE; size *= 2) {
+    printf("%6zu %10.1f %10.1f %14.1f %10.1f\n", size,
+           time_checksum(CHECKSUM_CNET, size),
+           time_checksum(CHECKSUM_CRC32, size),
+           time_portable_crc32c(size),
+           time_checksum(CHECKSUM_CRC32C, size));
+  }
+
+  return 0;
+}
+
+/*
+ * CNET crc32
+ *
+ * Stands in for CNET's, a byte at a time.
+ */
+uint32_t CNET_crc32(unsigned char *address, int length) {
+  uint32_t crc = 0xffffffffu;
+
+  for (int i = 0; i < length; ++i) {
+    crc = byte_table[(crc ^ address[i]) & 0xff] ^ (crc >> 8);
+  }
+
+  return crc ^ 0xffffffffu;
+}
+
+static double now_in_ns() {
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1e9 + now.tv_nsec;
+}
+
+static double time_checksum(const enum ChecksumMode mode, const size_t size) {
+  const int frames = BYTES_PER_TIMING / size;
+  uint32_t checksum = 0;
+
+  config.checksum_mode = mode;
+
+  const double start = now_in_ns();
+
+  for (int i = 0; i < frames; ++i) {
+    frame[0] = (unsigned char) i;
+    checksum += checksum_frame(frame, size, CHECKSUM_OFFSET);
+  }
+
+  const double elapsed = now_in_ns() - start;
+
+  // Stops the compiler throwing the checksums away.
+  if (checksum == 1) {
+    printf("!");
+  }
+
+  return elapsed / frames;
+}
+
+static double time_portable_crc32c(const size_t size) {
+  const int frames = BYTES_PER_TIMING / size;
+  uint32_t checksum = 0;
+  const double start = now_in_ns();
+
+  for (int i = 0; i < frames; ++i) {
+    frame[0] = (unsigned char) i;
+    checksum += ~crc32c_portable_update(~0u, frame, size);
+  }
+
+  const double elapsed = now_in_ns() - start;
+
+  if (checksum == 1) {
+    printf("!");
+  }
+
+  return elapsed / frames;
+}
+
+/*
+ * Check results
+ *
+ * The tables have to give the same CRC-32 as CNET's, the SSE4.2
+ * CRC-32C the same as the tables, and the checksum field has to count
+ * as zero without the frame being changed. Also checks the standard
+ * CRC-32C check value.
+ */
+static int check_results() {
+  int failures = 0;
+
+  for (size_t size = 1; size <= MAX_MESSAGE_SIZE; size = size * 3 + 1) {
+    for (size_t offset = 0; offset < 8 && offset < size; ++offset) {
+      const unsigned char *data = frame + offset;
+      const size_t length = size - offset;
+
+      if (~crc32_update(~0u, data, length) !=
+          CNET_crc32((unsigned char *) data, (int) length)) {
+        printf("crc32 is wrong for %zu bytes.\n", length);
+        ++failures;
+      }
+
+      if (crc32c_update(~0u, data, length) !=
+          crc32c_portable_update(~0u, data, length)) {
+        printf("crc32c is wrong for %zu bytes.\n", length);
+        ++failures;
+      }
+    }
+  }
+
+  if (~crc32c_update(~0u, "123456789", 9) != 0xe3069283u) {
+    printf("crc32c check value is wrong.\n");
+    ++failures;
+  }
+
+  const enum ChecksumMode modes[] = {
+    CHECKSUM_CNET, CHECKSUM_CRC32, CHECKSUM_CRC32C};
+
+  for (int i = 0; i < 3; ++i) {
+    config.checksum_mode = modes[i];
+
+    unsigned char before[1000], zeroed[1000];
+
+    memcpy(before, frame, sizeof(before));
+    memcpy(zeroed, frame, sizeof(zeroed));
+    memset(zeroed + CHECKSUM_OFFSET, 0, 4);
+
+    const uint32_t in_place = checksum_frame(frame, 1000, CHECKSUM_OFFSET);
+
+    if (in_place != checksum_frame(zeroed, sizeof(zeroed), CHECKSUM_OFFSET) ||
+        memcmp(before, frame, sizeof(before)) != 0) {
+      printf("Checksum field doesn't count as zero, or the frame changed, "
+             "mode %d.\n", i);
+      ++failures;
+    }
+  }
+
+  return failures;
+}
@@ -0,0 +1,145 @@
+/*
+ * CC200 Assignment
+ *
+ * Author: Mike Aldred
+ *
+ * Forwarding table benchmark
+ *
+ * Description:
+ *   Times route lookups against node count, for the hashed forwarding
+ *   table and for the linear search it replaced. Addresses are random
+ *   32 bit values, so they're nowhere near 0 to N-1. The hashed lookup
+ *   should stay flat as the node count goes up, the linear search
+ *   grows with it.
+ *
+ *   Build with "make bench-forwarding".
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "forwarding_table.h"
+
+#define LOOKUPS 20000000
+#define MAX_NODES 65536
+
+// Largest node count that still gets the linear search run on it.
+#define MAX_LINEAR_NODES 4096
+
+static CnetAddr addresses[MAX_NODES];
+static uint32_t lookup_order[LOOKUPS % MAX_NODES + MAX_NODES];
+
+static uint32_t random_state = 2463534242u;
+
+// Forward declarations
+static uint32_t next_random();
+static double now_in_ns();
+static double time_hashed(const struct ForwardingTable *const table,
+                          const int nodes);
+static double time_linear(const int nodes);
+
+int main() {
+  printf("%8s %16s %16s\n", "Nodes", "Hashed ns/lookup", "Linear ns/lookup");
+
+  for (int nodes = 16; nodes <= MAX_NODES; nodes *= 4) {
+    struct ForwardingTable table = {NULL, 0, 0};
+    setup_forwarding_table(&table);
+
+    // Random, distinct, addresses.
+    for (int i = 0; i < nodes; ++i) {
+      uint32_t unused;
+
+      do {
+        addresses[i] = (CnetAddr) next_random();
+      } while (forwarding_table_lookup(&table, addresses[i], &unused));
+
+      forwarding_table_insert(&table, addresses[i], (uint32_t) i);
+    }
+
+    for (size_t i = 0; i < sizeof(lookup_order) / sizeof(lookup_order[0]); ++i) {
+      lookup_order[i] = next_random() % nodes;
+    }
+
+    printf("%8d %16.2f", nodes, time_hashed(&table, nodes));
+
+    if (nodes <= MAX_LINEAR_NODES) {
+      printf(" %16.2f\n", time_linear(nodes));
+    } else {
+      printf(" %16s\n", "-");
+    }
+
+    free(table.entries);
+  }
+
+  return 0;
+}
+
+/*
+ * Next random
+ *
+ * Xorshift, so every run uses the same addresses.
+ */
+static uint32_t next_random() {
+  random_state ^= random_state << 13;
+  random_state ^= random_state >> 17;
+  random_state ^= random_state << 5;
+  return random_state;
+}
+
+static double now_in_ns() {
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1e9 + now.tv_nsec;
+}
+
+static double time_hashed(const struct ForwardingTable *const table,
+                          const int nodes) {
+  const size_t order_size = sizeof(lookup_order) / sizeof(lookup_order[0]);
+  uint32_t checksum = 0;
+  const double start = now_in_ns();
+
+  for (int i = 0; i < LOOKUPS; ++i) {
+    uint32_t value = 0;
+
+    forwarding_table_lookup(table, addresses[lookup_order[i % order_size]],
+                            &value);
+    checksum += value;
+  }
+
+  const double elapsed = now_in_ns() - start;
+
+  // Stops the compiler throwing the lookups away.
+  if (checksum == 1) {
+    printf("!");
+  }
+
+  return elapsed / LOOKUPS;
+}
+
+static double time_linear(const int nodes) {
+  const size_t order_size = sizeof(lookup_order) / sizeof(lookup_order[0]);
+  const int lookups = LOOKUPS / 16;
+  uint32_t checksum = 0;
+  const double start = now_in_ns();
+
+  for (int i = 0; i < lookups; ++i) {
+    const CnetAddr wanted = addresses[lookup_order[i % order_size]];
+
+    for (int j = 0; j < nodes; ++j) {
+      if (addresses[j] == wanted) {
+        checksum += j;
+        break;
+      }
+    }
+  }
+
+  const double elapsed = now_in_ns() - start;
+
+  if (checksum == 1) {
+    printf("!");
+  }
+
+  return elapsed / lookups;
+}
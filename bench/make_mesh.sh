@@ -0,0 +1,33 @@
+#!/bin/sh
+#
+# Writes a grid shaped mesh topology to stdout, WIDTH nodes across and
+# HEIGHT down, each linked to the nodes to its right and below it.
+#
+#   bench/make_mesh.sh 10 5 > bench/topologies/mesh50.map
+
+WIDTH=${1:-10}
+HEIGHT=${2:-5}
+
+awk -v width="$WIDTH" -v height="$HEIGHT" 'BEGIN {
+  printf "/*\n * %d by %d grid mesh, made by make_mesh.sh.\n */\n", width, height
+
+  for (row = 0; row < height; ++row) {
+    for (column = 0; column < width; ++column) {
+      node = row * width + column
+
+      printf "\nhost Mesh%d {\n", node
+      printf "     address = %d\n", node
+      printf "     x=%d, y=%d\n", 60 + 80 * column, 60 + 80 * row
+
+      if (column + 1 < width) {
+        printf "     link to Mesh%d\n", node + 1
+      }
+
+      if (row + 1 < height) {
+        printf "     link to Mesh%d\n", node + width
+      }
+
+      printf "}\n"
+    }
+  }
+}'
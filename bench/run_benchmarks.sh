@@ -0,0 +1,168 @@
+#!/bin/sh
+#
+# Runs every scenario in bench/scenarios through CNET with no GUI, for
+# a fixed simulated time and fixed seeds, and summarises each run from
+# the nodes' stats dumps.
+#
+#   bench/run_benchmarks.sh [results directory]
+#
+# Settings, from the environment:
+#   CNET      CNET to run (default cnet).
+#   DURATION  Simulated time for each run, as CNET's -e (default 5m).
+#   SEEDS     Seeds to run each scenario with (default "1 2 3").
+#   ARGS      Protocol options added to every scenario.
+#   BASELINE  summary.csv from an earlier run. Any scenario whose
+#             goodput drops, or whose retransmission rate or p99
+#             latency goes up, by more than TOLERANCE percent (default
+#             10) is reported, and the script fails.
+#
+# Results go in bench/results by default, a directory per scenario and
+# seed, with summary.csv holding a row for each run:
+#
+#   scenario,seed,messages,goodput_bps,retransmit_rate,latency_p50,latency_p99
+#
+# latency_p50 is the median end to end latency averaged over every
+# source and destination pair, weighted by messages delivered.
+# latency_p99 is the worst pair's p99.
+
+set -e
+
+BENCH=$(cd "$(dirname "$0")" && pwd)
+SRC=$(cd "$BENCH/../src" && pwd)
+RESULTS=${1:-$BENCH/results}
+
+CNET=${CNET:-cnet}
+DURATION=${DURATION:-5m}
+SEEDS=${SEEDS:-1 2 3}
+TOLERANCE=${TOLERANCE:-10}
+
+# Same source files as the assignment topology.
+COMPILE=$(grep '^compile' "$SRC/ASSIGNMENT.MAP")
+
+mkdir -p "$RESULTS"
+RESULTS=$(cd "$RESULTS" && pwd)
+SUMMARY=$RESULTS/summary.csv
+
+echo "scenario,seed,messages,goodput_bps,retransmit_rate,latency_p50,latency_p99" \
+    > "$SUMMARY"
+
+#
+# Summarise the stats files for one run into a summary row.
+#
+summarise() {
+  awk -F, -v scenario="$1" -v seed="$2" '
+    FNR == 1 { next }
+
+    $2 == 0 && $3 == "time_in_usec" && $4 > time { time = $4 }
+    $2 == 0 && $3 == "messages_received" { messages += $4 }
+    $2 == 0 && $3 == "bytes_received" { bytes += $4 }
+
+    $2 == 0 && $3 ~ /^delivered_from_/ {
+      pair = $1 SUBSEP substr($3, 16)
+      delivered[pair] = $4
+    }
+    $2 == 0 && $3 ~ /^latency_p50_from_/ { p50[$1 SUBSEP substr($3, 18)] = $4 }
+    $2 == 0 && $3 ~ /^latency_p99_from_/ && $4 > p99 { p99 = $4 }
+
+    $2 != 0 && $3 == "frames_sent" { frames += $4 }
+    $2 != 0 && $3 == "ack_frames_sent" { acks += $4 }
+    $2 != 0 && $3 == "retransmissions" { retransmissions += $4 }
+
+    END {
+      for (pair in delivered) {
+        weighted += delivered[pair] * p50[pair]
+        total += delivered[pair]
+      }
+
+      data_frames = frames - acks
+
+      printf "%s,%s,%d,%.0f,%.4f,%.0f,%.0f\n", scenario, seed, messages,
+             (time > 0) ? bytes * 8 * 1000000 / time : 0,
+             (data_frames > 0) ? retransmissions / data_frames : 0,
+             (total > 0) ? weighted / total : 0,
+             p99
+    }' "$3"/*.csv
+}
+
+grep -v '^#' "$BENCH/scenarios" | while read -r name topology loss corrupt options; do
+  [ -n "$name" ] || continue
+
+  for seed in $SEEDS; do
+    run=$RESULTS/$name/seed$seed
+    map=$run/topology.map
+
+    rm -rf "$run"
+    mkdir -p "$run"
+
+    {
+      echo "$COMPILE"
+      echo
+      echo "probframeloss = $loss"
+      echo "probframecorrupt = $corrupt"
+      echo
+      cat "$BENCH/topologies/$topology.map"
+    } > "$map"
+
+    echo "Running $name, seed $seed."
+
+    # The source files are compiled from the src directory.
+    (cd "$SRC" && $CNET -W -T -s -e "$DURATION" -S "$seed" "$map" \
+        stats=csv statsprefix="$run/" $options $ARGS) > "$run/output.txt" 2>&1 ||
+        echo "CNET failed for $name, seed $seed, see $run/output.txt."
+
+    if ls "$run"/*.csv > /dev/null 2>&1; then
+      summarise "$name" "$seed" "$run" >> "$SUMMARY"
+    fi
+  done
+done
+
+# Averages over the seeds for each scenario.
+echo
+awk -F, '
+  NR == 1 { next }
+  !($1 in runs) { order[++count] = $1 }
+  {
+    ++runs[$1]
+    messages[$1] += $3; goodput[$1] += $4; retransmit[$1] += $5
+    p50[$1] += $6; p99[$1] += $7
+  }
+  END {
+    printf "%-18s %10s %12s %10s %10s %10s\n", "Scenario", "Messages",
+           "Goodput bps", "Retx rate", "p50 usecs", "p99 usecs"
+    for (i = 1; i <= count; ++i) {
+      s = order[i]; n = runs[s]
+      printf "%-18s %10.0f %12.0f %10.4f %10.0f %10.0f\n", s, messages[s] / n,
+             goodput[s] / n, retransmit[s] / n, p50[s] / n, p99[s] / n
+    }
+  }' "$SUMMARY"
+
+if [ -n "$BASELINE" ]; then
+  echo
+  awk -F, -v tolerance="$TOLERANCE" '
+    FNR == 1 { next }
+    NR == FNR { goodput[$1, $2] = $4; retransmit[$1, $2] = $5; p99[$1, $2] = $7; next }
+    !(($1, $2) in goodput) { next }
+    {
+      key = $1 ", seed " $2
+      limit = 1 + tolerance / 100
+
+      if ($4 * limit < goodput[$1, $2]) {
+        printf "REGRESSION %s: goodput %s, was %s\n", key, $4, goodput[$1, $2]
+        ++failed
+      }
+      if ($5 > retransmit[$1, $2] * limit && $5 - retransmit[$1, $2] > 0.001) {
+        printf "REGRESSION %s: retransmit rate %s, was %s\n", key, $5, retransmit[$1, $2]
+        ++failed
+      }
+      if ($7 > p99[$1, $2] * limit) {
+        printf "REGRESSION %s: p99 latency %s, was %s\n", key, $7, p99[$1, $2]
+        ++failed
+      }
+    }
+    END {
+      if (failed) {
+        exit 1
+      }
+      print "No regressions against the baseline."
+    }' "$BASELINE" "$SUMMARY"
+fi
@@ -0,0 +1,136 @@
+/*
+ * CC200 Assignment
+ *
+ * Author: Mike Aldred
+ *
+ * Simulator CNET API
+ *
+ * Description:
+ *
+ *   The part of the CNET 3.2 API the protocol uses, for building it
+ *   against the standalone simulator (sim.c) instead of CNET. The
+ *   protocol sources are compiled unchanged, with this directory
+ *   ahead of CNET's on the include path.
+ *
+ *   Only what the protocol needs is here. Anything else CNET has will
+ *   fail to compile rather than quietly do nothing.
+ */
+
+#ifndef CNET_H_
+#define CNET_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+typedef enum {
+  EV_NULL,
+  EV_REBOOT,
+  EV_SHUTDOWN,
+  EV_APPLICATIONREADY,
+  EV_PHYSICALREADY,
+  EV_KEYBOARDREADY,
+  EV_LINKSTATE,
+  EV_DRAWFRAME,
+  EV_PERIODIC,
+  EV_DEBUG0,
+  EV_DEBUG1,
+  EV_DEBUG2,
+  EV_DEBUG3,
+  EV_DEBUG4,
+  EV_TIMER0,
+  EV_TIMER1,
+  EV_TIMER2,
+  EV_TIMER3,
+  EV_TIMER4,
+  EV_TIMER5,
+  EV_TIMER6,
+  EV_TIMER7,
+  EV_TIMER8,
+  EV_TIMER9} CnetEvent;
+
+#define N_CNET_EVENTS (EV_TIMER9 + 1)
+
+typedef int32_t CnetTimerID;
+typedef long CnetData;
+typedef int64_t CnetTime;
+typedef uint32_t CnetAddr;
+
+#define NULLTIMER 0
+#define ALLNODES ((CnetAddr) -1)
+
+#define MAX_MESSAGE_SIZE 8192
+#define MAX_NODENAME_LEN 32
+
+#define EVENT_HANDLER(name) \
+    void name(CnetEvent ev, CnetTimerID timer, CnetData data)
+
+typedef struct {
+  int nodenumber;
+  CnetAddr address;
+  char nodename[MAX_NODENAME_LEN];
+  int nlinks;
+  int minmessagesize;
+  int maxmessagesize;
+  CnetTime time_in_usec;
+} CnetNodeInfo;
+
+typedef struct {
+  int linkup;
+  int64_t bandwidth;          // bits per second.
+  CnetTime propagationdelay;  // usecs.
+  int mtu;                    // Largest frame, in bytes.
+} CnetLinkInfo;
+
+typedef struct {
+  int nfields;
+  const char *colours[6];
+  int pixels[6];
+  char text[64];
+  void *frame;
+  size_t len;
+} CnetDrawFrame;
+
+/*
+ * The node the current event is for, and its links, from 0 (the
+ * loopback) to nlinks. Set by the simulator before each event. Each
+ * thread has its own, as the simulator can run nodes in parallel.
+ */
+extern __thread CnetNodeInfo nodeinfo
+    __attribute__((tls_model("initial-exec")));
+extern __thread CnetLinkInfo *linkinfo
+    __attribute__((tls_model("initial-exec")));
+
+/*
+ * Like CNET, a failed call reports where it was, and ends the run.
+ */
+#define CHECK(call) \
+    do { \
+      if ((call) != 0) { \
+        CNET_check_failed(__FILE__, __LINE__, #call); \
+      } \
+    } while (0)
+
+void CNET_check_failed(const char *file, int line, const char *call);
+
+int CNET_set_handler(CnetEvent ev,
+                     void (*handler)(CnetEvent, CnetTimerID, CnetData),
+                     CnetData data);
+int CNET_set_debug_string(CnetEvent ev, const char *string);
+
+int CNET_enable_application(CnetAddr destination);
+int CNET_disable_application(CnetAddr destination);
+int CNET_read_application(CnetAddr *destination, void *message,
+                          size_t *length);
+int CNET_write_application(void *message, size_t *length);
+
+int CNET_read_physical(int *link, void *frame, size_t *length);
+int CNET_write_physical(int link, void *frame, size_t *length);
+
+CnetTimerID CNET_start_timer(CnetEvent ev, CnetTime usecs, CnetData data);
+int CNET_stop_timer(CnetTimerID timer);
+
+uint32_t CNET_crc32(unsigned char *address, int length);
+
+#endif
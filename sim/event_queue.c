@@ -0,0 +1,208 @@
+/*
+ * CC200 Assignment
+ *
+ * Author: Mike Aldred
+ *
+ * Simulator Event Queue
+ *
+ * Description:
+ *   Look at the header file for details.
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "event_queue.h"
+
+/*
+ * Timer IDs are the event index in the low bits, and the generation
+ * in the rest, kept positive and never 0 (NULLTIMER).
+ */
+#define INDEX_BITS 20
+#define MAX_EVENTS (1u << INDEX_BITS)
+#define GENERATION_MASK 0x3ff
+
+#define INITIAL_EVENTS 1024
+
+// Forward declarations
+static bool earlier(const struct Event *const events, const uint32_t a,
+                    const uint32_t b);
+static void sift_up(struct EventQueue *const queue, size_t position);
+static void sift_down(struct EventQueue *const queue, size_t position);
+static void grow_pool(struct EventQueue *const queue);
+
+void init_event_queue(struct EventQueue *const queue) {
+  memset(queue, 0, sizeof(struct EventQueue));
+}
+
+uint32_t new_event(struct EventQueue *const queue) {
+  uint32_t index;
+
+  if (queue->free_count > 0) {
+    index = queue->free_events[--queue->free_count];
+  } else {
+    if (queue->event_count == queue->event_capacity) {
+      grow_pool(queue);
+    }
+
+    index = queue->event_count++;
+    queue->events[index].generation = 0;
+  }
+
+  struct Event *event = &queue->events[index];
+  const uint32_t generation = event->generation;
+
+  memset(event, 0, sizeof(struct Event));
+  event->generation = generation;
+
+  return index;
+}
+
+struct Event *event_at(const struct EventQueue *const queue,
+                       const uint32_t index) {
+  return &queue->events[index];
+}
+
+void schedule_event(struct EventQueue *const queue, const uint32_t index) {
+  queue->events[index].pending = true;
+
+  queue->heap[queue->heap_size] = index;
+  sift_up(queue, queue->heap_size++);
+}
+
+bool next_event(struct EventQueue *const queue, uint32_t *const index) {
+  if (queue->heap_size == 0) {
+    return false;
+  }
+
+  *index = queue->heap[0];
+  queue->heap[0] = queue->heap[--queue->heap_size];
+
+  if (queue->heap_size > 0) {
+    sift_down(queue, 0);
+  }
+
+  queue->events[*index].pending = false;
+  return true;
+}
+
+CnetTime next_event_time(const struct EventQueue *const queue) {
+  return queue->events[queue->heap[0]].time;
+}
+
+void free_event(struct EventQueue *const queue, const uint32_t index) {
+  struct Event *event = &queue->events[index];
+
+  event->generation = (event->generation + 1) & GENERATION_MASK;
+  queue->free_events[queue->free_count++] = index;
+}
+
+CnetTimerID event_timer_id(const struct EventQueue *const queue,
+                           const uint32_t index) {
+  return (CnetTimerID)(((queue->events[index].generation + 1) << INDEX_BITS) |
+                       index);
+}
+
+bool cancel_timer(struct EventQueue *const queue, const CnetTimerID timer) {
+  const uint32_t index = (uint32_t) timer & (MAX_EVENTS - 1);
+
+  if (timer <= 0 || index >= queue->event_count ||
+      event_timer_id(queue, index) != timer ||
+      !queue->events[index].pending || queue->events[index].cancelled) {
+    return false;
+  }
+
+  queue->events[index].cancelled = true;
+  return true;
+}
+
+size_t events_pending(const struct EventQueue *const queue) {
+  return queue->heap_size;
+}
+
+static bool earlier(const struct Event *const events, const uint32_t a,
+                    const uint32_t b) {
+  if (events[a].time != events[b].time) {
+    return events[a].time < events[b].time;
+  }
+
+  if (events[a].origin != events[b].origin) {
+    return events[a].origin < events[b].origin;
+  }
+
+  return events[a].sequence < events[b].sequence;
+}
+
+static void sift_up(struct EventQueue *const queue, size_t position) {
+  uint32_t *heap = queue->heap;
+  const uint32_t moving = heap[position];
+
+  while (position > 0) {
+    const size_t parent = (position - 1) / 2;
+
+    if (!earlier(queue->events, moving, heap[parent])) {
+      break;
+    }
+
+    heap[position] = heap[parent];
+    position = parent;
+  }
+
+  heap[position] = moving;
+}
+
+static void sift_down(struct EventQueue *const queue, size_t position) {
+  uint32_t *heap = queue->heap;
+  const uint32_t moving = heap[position];
+
+  for (;;) {
+    size_t child = 2 * position + 1;
+
+    if (child >= queue->heap_size) {
+      break;
+    }
+
+    if (child + 1 < queue->heap_size &&
+        earlier(queue->events, heap[child + 1], heap[child])) {
+      ++child;
+    }
+
+    if (!earlier(queue->events, heap[child], moving)) {
+      break;
+    }
+
+    heap[position] = heap[child];
+    position = child;
+  }
+
+  heap[position] = moving;
+}
+
+/*
+ * Grow pool
+ *
+ * Doubles the number of events, and the free stack and heap with it,
+ * since neither can hold more than every event.
+ */
+static void grow_pool(struct EventQueue *const queue) {
+  const uint32_t capacity = (queue->event_capacity == 0) ?
+      INITIAL_EVENTS : queue->event_capacity * 2;
+
+  if (capacity > MAX_EVENTS) {
+    fprintf(stderr, "Too many events pending, more than %u.\n", MAX_EVENTS);
+    exit(1);
+  }
+
+  queue->event_capacity = capacity;
+  queue->events = (struct Event *)realloc(queue->events,
+                                          capacity * sizeof(struct Event));
+  queue->free_events = (uint32_t *)realloc(queue->free_events,
+                                           capacity * sizeof(uint32_t));
+  queue->heap = (uint32_t *)realloc(queue->heap, capacity * sizeof(uint32_t));
+
+  // If we can't allocate memory for this, it's a serious problem
+  // can't recover from.
+  assert(queue->events && queue->free_events && queue->heap);
+}
@@ -0,0 +1,147 @@
+/*
+ * CC200 Assignment
+ *
+ * Author: Mike Aldred
+ *
+ * Simulator Event Queue
+ *
+ * Description:
+ *
+ *   Priority queue of pending events for the simulator, a binary heap
+ *   ordered by time. Events at the same time come out in order of the
+ *   node that caused them, then the order that node caused them in.
+ *   None of that depends on what other nodes are doing, so a run with
+ *   the same seed always happens the same way, even when the nodes
+ *   are split over threads, each with its own queue.
+ *
+ *   Events live in a pool, and the heap only holds their indexes, so
+ *   the pool can grow without breaking anything. An index plus the
+ *   event's generation makes a timer ID, so a stale ID can't stop an
+ *   event that's reused the slot.
+ */
+
+#ifndef EVENT_QUEUE_H_
+#define EVENT_QUEUE_H_
+
+#include <cnet.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+struct Event {
+  CnetTime time;
+
+  // Node that caused the event, and how many events it had caused
+  // before, these break ties.
+  int origin;
+  uint64_t sequence;
+
+  int node;
+  CnetEvent type;
+  CnetData data;
+
+  // Physical frames, the link it arrives on and a copy of the frame.
+  int link;
+  size_t length;
+  unsigned char *frame;
+
+  uint32_t generation;
+  bool cancelled;
+  bool pending;
+};
+
+struct EventQueue {
+  struct Event *events;
+  uint32_t event_capacity;
+  uint32_t event_count;
+
+  // Free events, a stack of indexes.
+  uint32_t *free_events;
+  uint32_t free_count;
+
+  uint32_t *heap;
+  size_t heap_size;
+};
+
+/*
+ * Init event queue
+ *
+ * Sets up an empty queue.
+ */
+void init_event_queue(struct EventQueue *const queue);
+
+/*
+ * New event
+ *
+ * Takes an event from the pool, zeroed apart from its generation. It
+ * isn't scheduled until schedule_event is called.
+ *
+ * Returns the event's index.
+ */
+uint32_t new_event(struct EventQueue *const queue);
+
+/*
+ * Event at
+ *
+ * The event for an index. Only good until the next new_event call,
+ * which can move the pool.
+ */
+struct Event *event_at(const struct EventQueue *const queue,
+                       const uint32_t index);
+
+/*
+ * Schedule event
+ *
+ * Adds the event to the queue at its time, its origin and sequence
+ * have to be filled in first.
+ */
+void schedule_event(struct EventQueue *const queue, const uint32_t index);
+
+/*
+ * Next event
+ *
+ * Takes the earliest event off the queue, false if it's empty. The
+ * event has to be given back with free_event once it's been dealt
+ * with.
+ */
+bool next_event(struct EventQueue *const queue, uint32_t *const index);
+
+/*
+ * Next event time
+ *
+ * Time of the earliest event, without taking it off the queue. Only
+ * good if the queue isn't empty.
+ */
+CnetTime next_event_time(const struct EventQueue *const queue);
+
+/*
+ * Free event
+ *
+ * Puts the event back in the pool.
+ */
+void free_event(struct EventQueue *const queue, const uint32_t index);
+
+/*
+ * Event timer ID
+ *
+ * The timer ID for a scheduled event, never NULLTIMER.
+ */
+CnetTimerID event_timer_id(const struct EventQueue *const queue,
+                           const uint32_t index);
+
+/*
+ * Cancel timer
+ *
+ * Marks the event for the timer ID as cancelled, it's thrown away
+ * when it comes off the queue. Returns false if the ID isn't for a
+ * pending event.
+ */
+bool cancel_timer(struct EventQueue *const queue, const CnetTimerID timer);
+
+/*
+ * Events pending
+ *
+ * Number of events in the queue, including cancelled ones.
+ */
+size_t events_pending(const struct EventQueue *const queue);
+
+#endif
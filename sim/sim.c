@@ -0,0 +1,1339 @@
+/*
+ * CC200 Assignment
+ *
+ * Author: Mike Aldred
+ *
+ * Simulator
+ *
+ * Description:
+ *
+ *   A standalone discrete event simulator that runs the protocol
+ *   without CNET, so it can be profiled, and run far faster than CNET
+ *   with its GUI. It provides the CNET API the protocol uses (see
+ *   cnet.h), an event queue, links with CNET's bandwidth, propagation
+ *   delay, loss and corruption, and an application layer that
+ *   generates messages and checks that they turn up in order.
+ *
+ *   The protocol keeps its state in globals, like any CNET protocol,
+ *   so every node needs its own copy of them. CNET does this by
+ *   loading the protocol once per node, and so does this. The
+ *   protocol is built as a shared library (make sim), and a copy is
+ *   loaded for each node, which gives each its own globals. nodeinfo
+ *   and linkinfo are here, and are set for the node before each of
+ *   its events.
+ *
+ *     sim/sim [-e time] [-S seed] [-j threads] [-k] [-v] topology.map
+ *             [protocol options]
+ *
+ *   -e is how long to simulate, e.g. 30s, 5m or 1h (default 5m). -S
+ *   seeds the random numbers, the same seed always gives the same
+ *   run. A message delivered out of sequence fails the call, as it
+ *   does in CNET, -k counts them and keeps going instead. -v shows
+ *   every node's state at the end, as the debug button would. The
+ *   protocol options are given to reboot_node, like CNET.
+ *
+ *   -j splits the nodes into that many partitions, each run on its
+ *   own thread. Nodes only affect each other with frames, and a frame
+ *   takes at least its link's propagation delay to arrive, so every
+ *   partition can safely run from the earliest event anywhere, up to
+ *   that plus the shortest propagation delay between partitions (the
+ *   lookahead), before waiting for the others. Frames for another
+ *   partition are left in a mailbox on the link, which is only
+ *   written by the sender during a window, and only read by the
+ *   receiver between windows, so no locks are needed. Events are
+ *   ordered the same way whatever partition they're in (see
+ *   event_queue.h), and each node has its own random numbers, so
+ *   every node does exactly what it would on one thread. Only the
+ *   order lines from different nodes are printed in changes.
+ */
+
+#include <assert.h>
+#include <dlfcn.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <cnet.h>
+
+#include "event_queue.h"
+#include "topology.h"
+
+#define DEFAULT_RUN_TIME (5 * 60 * (CnetTime) 1000000)
+
+// Frame copies on the links are allocated this many at a time.
+#define FRAMES_PER_CHUNK 256
+
+#define CACHE_LINE_SIZE 64
+
+#define NEVER INT64_MAX
+
+typedef void (*Handler)(CnetEvent, CnetTimerID, CnetData);
+
+/*
+ * Every generated message starts with this, so the destination can
+ * check it's the right message, from the right node, in order. The
+ * rest of the message is a pattern worked out from the sequence.
+ */
+struct MessageHeader {
+  CnetAddr source;
+  CnetAddr destination;
+  uint32_t sequence;
+  uint32_t length;
+};
+
+/*
+ * A frame on its way to a node in another partition. The frame
+ * itself is at offset in the mailbox's bytes.
+ */
+struct Posted {
+  CnetTime time;
+  int origin;
+  uint64_t sequence;
+  int node;
+  int link;
+  size_t length;
+  size_t offset;
+};
+
+struct Mailbox {
+  struct Posted *posted;
+  size_t count;
+  size_t capacity;
+
+  unsigned char *bytes;
+  size_t used;
+  size_t byte_capacity;
+};
+
+struct SimLink {
+  int peer;        // Node at the other end.
+  int peer_link;   // Link number at the other end.
+  CnetTime busy_until;
+  int probframeloss;
+  int probframecorrupt;
+
+  // Only if the other end is in another partition.
+  struct Mailbox *mailbox;
+};
+
+struct Totals {
+  unsigned long long events;
+  unsigned long long frames_sent;
+  unsigned long long bytes_sent;
+  unsigned long long frames_lost;
+  unsigned long long frames_corrupted;
+  unsigned long long messages_generated;
+  unsigned long long messages_delivered;
+  unsigned long long messages_out_of_sequence;
+  unsigned long long bytes_delivered;
+};
+
+/*
+ * A group of nodes run by one thread, first_node up to (not
+ * including) last_node, with its own events, and its own frame
+ * copies. Cache line aligned so threads don't share lines.
+ */
+struct Partition {
+  struct EventQueue queue;
+  int first_node;
+  int last_node;
+
+  // Mailboxes on links into this partition.
+  struct Mailbox **inbound;
+  int inbound_count;
+
+  unsigned char **free_frames;
+  size_t free_frame_count;
+  size_t frame_capacity;
+
+  struct Totals totals;
+
+  // Earliest event, for the other partitions to work out the window.
+  CnetTime next_time;
+  pthread_t thread;
+} __attribute__((aligned(CACHE_LINE_SIZE)));
+
+struct Node {
+  CnetNodeInfo info;
+  CnetLinkInfo *links;   // 0 to nlinks, like CNET's linkinfo.
+  struct SimLink *sim_links;
+
+  void *library;
+  Handler reboot;
+  Handler handlers[N_CNET_EVENTS];
+  CnetData handler_data[N_CNET_EVENTS];
+
+  CnetTime message_rate;
+  uint64_t random_state;
+
+  int partition;
+  uint64_t events_caused;   // For ordering its events, see event_queue.h.
+
+  /*
+   * Destinations the application is enabled for, by node index. The
+   * list lets one be picked at random straight away, position is
+   * where each node is in it, -1 if it isn't.
+   */
+  int *enabled;
+  int *enabled_position;
+  int enabled_count;
+  bool application_pending;
+
+  // Next sequence to send to, and expected from, each node.
+  uint32_t *next_sequence;
+  uint32_t *expected_sequence;
+
+  // The message generated for the current EV_APPLICATIONREADY.
+  unsigned char message[MAX_MESSAGE_SIZE];
+  size_t message_length;
+  CnetAddr message_destination;
+};
+
+__thread CnetNodeInfo nodeinfo;
+__thread CnetLinkInfo *linkinfo;
+
+static struct Node *nodes = NULL;
+static int node_count = 0;
+
+// Node addresses in order, for looking them up.
+static struct {
+  CnetAddr address;
+  int node;
+} *addresses = NULL;
+
+// -k, count messages out of sequence rather than failing.
+static bool keep_going = false;
+
+static struct Partition *partitions = NULL;
+static int partition_count = 1;
+static CnetTime lookahead = NEVER;
+static CnetTime end_time = 0;
+static pthread_barrier_t window_barrier;
+
+// What each thread is running.
+static __thread struct Partition *partition = NULL;
+static __thread struct Node *current = NULL;
+static __thread const struct Event *current_event = NULL;
+static __thread CnetTime now = 0;
+
+static size_t max_frame_size = 0;
+
+static uint32_t crc_table[256];
+
+// Forward declarations
+static void usage(const char *program);
+static CnetTime parse_time(const char *const text);
+static void setup_nodes(const struct Topology *const topology,
+                        const uint64_t seed);
+static void setup_partitions(int count);
+static void load_protocol(const char *const library);
+static void run(const CnetTime run_time);
+static void *run_partition(void *argument);
+static void run_window(const CnetTime window_end);
+static void collect_mail();
+static unsigned char *post_frame(struct Mailbox *const mailbox,
+                                 const struct Event *const frame);
+static void schedule(struct Node *const origin,
+                     struct EventQueue *const queue, const uint32_t index);
+static void dispatch(struct Node *const node, const CnetEvent ev,
+                     const CnetTimerID timer, const CnetData data);
+static void application_ready(struct Node *const node);
+static void schedule_application(struct Node *const node);
+static void set_enabled(struct Node *const node, const int destination,
+                        const bool enabled);
+static int node_for_address(const CnetAddr address);
+static uint64_t next_random(struct Node *const node);
+static bool one_in_power_of_two(struct Node *const node, const int power);
+static unsigned char *allocate_frame();
+static void release_frame(unsigned char *const frame);
+static void print_summary(const CnetTime run_time, const double seconds);
+
+int main(int argc, char **argv) {
+  CnetTime run_time = DEFAULT_RUN_TIME;
+  uint64_t seed = 1;
+  bool show_state = false;
+  int threads = 1;
+  char library[4096];
+  int option;
+
+  snprintf(library, sizeof(library), "%s", argv[0]);
+  char *slash = strrchr(library, '/');
+  snprintf(slash ? slash + 1 : library,
+           sizeof(library) - (slash ? slash + 1 - library : 0),
+           "libprotocol.so");
+
+  // The + stops getopt moving the protocol options.
+  while ((option = getopt(argc, argv, "+e:S:j:kl:v")) != -1) {
+    switch (option) {
+      case 'e':
+        run_time = parse_time(optarg);
+        break;
+      case 'S':
+        seed = strtoull(optarg, NULL, 10);
+        break;
+      case 'j':
+        threads = atoi(optarg);
+        break;
+      case 'k':
+        keep_going = true;
+        break;
+      case 'l':
+        snprintf(library, sizeof(library), "%s", optarg);
+        break;
+      case 'v':
+        show_state = true;
+        break;
+      default:
+        usage(argv[0]);
+    }
+  }
+
+  if (optind >= argc) {
+    usage(argv[0]);
+  }
+
+  struct Topology topology;
+  read_topology(argv[optind], &topology);
+
+  if (topology.node_count == 0) {
+    fprintf(stderr, "%s has no hosts.\n", argv[optind]);
+    return 1;
+  }
+
+  for (int i = 0; i < 256; ++i) {
+    uint32_t crc = i;
+
+    for (int bit = 0; bit < 8; ++bit) {
+      crc = (crc & 1) ? (crc >> 1) ^ 0xedb88320u : crc >> 1;
+    }
+    crc_table[i] = crc;
+  }
+
+  setup_nodes(&topology, seed);
+  setup_partitions(threads);
+  load_protocol(library);
+
+  // Reboot every node, with what's left of the command line.
+  char **protocol_options = &argv[optind + 1];
+
+  for (int i = 0; i < node_count; ++i) {
+    partition = &partitions[nodes[i].partition];
+    current = &nodes[i];
+    nodeinfo = nodes[i].info;
+    linkinfo = nodes[i].links;
+    nodes[i].reboot(EV_REBOOT, NULLTIMER, (CnetData) protocol_options);
+  }
+
+  struct timespec start, end;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  run(run_time);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  now = run_time;
+
+  if (show_state) {
+    for (int i = 0; i < node_count; ++i) {
+      partition = &partitions[nodes[i].partition];
+      dispatch(&nodes[i], EV_DEBUG0, NULLTIMER, 0);
+    }
+  }
+
+  for (int i = 0; i < node_count; ++i) {
+    partition = &partitions[nodes[i].partition];
+    dispatch(&nodes[i], EV_SHUTDOWN, NULLTIMER, 0);
+  }
+
+  print_summary(run_time, (end.tv_sec - start.tv_sec) +
+                (end.tv_nsec - start.tv_nsec) / 1e9);
+
+  return 0;
+}
+
+static void usage(const char *program) {
+  fprintf(stderr, "Usage: %s [-e time] [-S seed] [-j threads] [-k] "
+          "[-l library] [-v] "
+          "topology.map [protocol options]\n", program);
+  exit(1);
+}
+
+/*
+ * Parse time
+ *
+ * A run time in usecs, from a number with a us, ms, s, m or h suffix.
+ * No suffix is seconds.
+ */
+static CnetTime parse_time(const char *const text) {
+  char *end;
+  const double number = strtod(text, &end);
+  double scale = 1000000;
+
+  if (strcmp(end, "us") == 0) {
+    scale = 1;
+  } else if (strcmp(end, "ms") == 0) {
+    scale = 1000;
+  } else if (strcmp(end, "m") == 0) {
+    scale = 60 * 1e6;
+  } else if (strcmp(end, "h") == 0) {
+    scale = 3600 * 1e6;
+  } else if (strcmp(end, "s") != 0 && *end != '\0') {
+    fprintf(stderr, "Bad run time: %s\n", text);
+    exit(1);
+  }
+
+  return (CnetTime)(number * scale);
+}
+
+/*
+ * Setup nodes
+ *
+ * Builds the nodes and their links from the topology. Each node gets
+ * its own random numbers, seeded from the run's seed.
+ */
+static void setup_nodes(const struct Topology *const topology,
+                        const uint64_t seed) {
+  node_count = topology->node_count;
+  nodes = (struct Node *)calloc(node_count, sizeof(struct Node));
+  addresses = calloc(node_count, sizeof(*addresses));
+
+  // If we can't allocate memory for this, it's a serious problem
+  // can't recover from.
+  assert(nodes && addresses);
+
+  for (int i = 0; i < node_count; ++i) {
+    const struct TopologyNode *from = &topology->nodes[i];
+    struct Node *node = &nodes[i];
+
+    node->info.nodenumber = i;
+    node->info.address = from->attributes.address;
+    snprintf(node->info.nodename, MAX_NODENAME_LEN, "%s", from->name);
+    node->info.minmessagesize = from->attributes.min_message_size;
+    node->info.maxmessagesize = from->attributes.max_message_size;
+
+    if (node->info.maxmessagesize > MAX_MESSAGE_SIZE) {
+      node->info.maxmessagesize = MAX_MESSAGE_SIZE;
+    }
+
+    if (node->info.minmessagesize < (int) sizeof(struct MessageHeader)) {
+      node->info.minmessagesize = sizeof(struct MessageHeader);
+    }
+
+    if (node->info.maxmessagesize < node->info.minmessagesize) {
+      node->info.maxmessagesize = node->info.minmessagesize;
+    }
+
+    node->message_rate = from->attributes.message_rate;
+    node->random_state = seed * 0x9e3779b97f4a7c15ull + i + 1;
+
+    for (int j = 0; j < topology->link_count; ++j) {
+      const struct TopologyLink *link = &topology->links[j];
+
+      if (link->from == i || link->to == i) {
+        ++node->info.nlinks;
+      }
+    }
+
+    node->links = (CnetLinkInfo *)calloc(node->info.nlinks + 1,
+                                         sizeof(CnetLinkInfo));
+    node->sim_links = (struct SimLink *)calloc(node->info.nlinks + 1,
+                                               sizeof(struct SimLink));
+    node->enabled = (int *)calloc(node_count, sizeof(int));
+    node->enabled_position = (int *)malloc(node_count * sizeof(int));
+    node->next_sequence = (uint32_t *)calloc(node_count, sizeof(uint32_t));
+    node->expected_sequence = (uint32_t *)calloc(node_count,
+                                                 sizeof(uint32_t));
+
+    assert(node->links && node->sim_links && node->enabled &&
+           node->enabled_position && node->next_sequence &&
+           node->expected_sequence);
+
+    for (int j = 0; j < node_count; ++j) {
+      node->enabled_position[j] = -1;
+    }
+
+    addresses[i].address = node->info.address;
+    addresses[i].node = i;
+  }
+
+  for (int j = 0; j < topology->link_count; ++j) {
+    const struct TopologyLink *link = &topology->links[j];
+    const int ends[2][3] = {
+      {link->from, link->from_link, link->to},
+      {link->to, link->to_link, link->from}};
+
+    for (int end = 0; end < 2; ++end) {
+      struct Node *node = &nodes[ends[end][0]];
+      const int number = ends[end][1];
+
+      node->links[number].linkup = 1;
+      node->links[number].bandwidth = link->attributes.bandwidth;
+      node->links[number].propagationdelay =
+          link->attributes.propagation_delay;
+      node->links[number].mtu = link->attributes.mtu;
+
+      node->sim_links[number].peer = ends[end][2];
+      node->sim_links[number].peer_link = ends[1 - end][1];
+      node->sim_links[number].probframeloss = link->attributes.probframeloss;
+      node->sim_links[number].probframecorrupt =
+          link->attributes.probframecorrupt;
+
+      if ((size_t) link->attributes.mtu > max_frame_size) {
+        max_frame_size = link->attributes.mtu;
+      }
+    }
+  }
+
+  // Insertion sort, node counts are small and it only happens once.
+  for (int i = 1; i < node_count; ++i) {
+    for (int j = i; j > 0 && addresses[j].address < addresses[j - 1].address;
+         --j) {
+      const CnetAddr address = addresses[j].address;
+      const int node = addresses[j].node;
+
+      addresses[j] = addresses[j - 1];
+      addresses[j - 1].address = address;
+      addresses[j - 1].node = node;
+    }
+  }
+
+  for (int i = 1; i < node_count; ++i) {
+    if (addresses[i].address == addresses[i - 1].address) {
+      fprintf(stderr, "Two hosts have address %u.\n",
+              (unsigned) addresses[i].address);
+      exit(1);
+    }
+  }
+}
+
+/*
+ * Load protocol
+ *
+ * dlopen only loads a library once, however many times it's asked,
+ * so each node gets its own copy of the file, which is removed again
+ * straight after it's loaded.
+ */
+static void load_protocol(const char *const library) {
+  FILE *in = fopen(library, "rb");
+
+  if (in == NULL) {
+    fprintf(stderr, "Can't open %s, has it been built (make sim)?\n",
+            library);
+    exit(1);
+  }
+
+  fseek(in, 0, SEEK_END);
+  const long size = ftell(in);
+  fseek(in, 0, SEEK_SET);
+
+  unsigned char *contents = (unsigned char *)malloc(size);
+  assert(contents);
+
+  if (fread(contents, 1, size, in) != (size_t) size) {
+    fprintf(stderr, "Can't read %s.\n", library);
+    exit(1);
+  }
+  fclose(in);
+
+  char directory[] = "/tmp/cnet-sim-XXXXXX";
+
+  if (mkdtemp(directory) == NULL) {
+    perror("mkdtemp");
+    exit(1);
+  }
+
+  for (int i = 0; i < node_count; ++i) {
+    char path[sizeof(directory) + 32];
+
+    snprintf(path, sizeof(path), "%s/node%d.so", directory, i);
+
+    FILE *out = fopen(path, "wb");
+
+    if (out == NULL || fwrite(contents, 1, size, out) != (size_t) size) {
+      perror(path);
+      exit(1);
+    }
+    fclose(out);
+
+    nodes[i].library = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+    unlink(path);
+
+    if (nodes[i].library == NULL) {
+      fprintf(stderr, "%s\n", dlerror());
+      exit(1);
+    }
+
+    *(void **)(&nodes[i].reboot) = dlsym(nodes[i].library, "reboot_node");
+
+    if (nodes[i].reboot == NULL) {
+      fprintf(stderr, "%s has no reboot_node.\n", library);
+      exit(1);
+    }
+  }
+
+  rmdir(directory);
+  free(contents);
+}
+
+/*
+ * Setup partitions
+ *
+ * Splits the nodes into count partitions, in the order they're in
+ * the topology file, which usually keeps neighbours together. Links
+ * between partitions get a mailbox, and the shortest propagation
+ * delay on them is the lookahead. If that's 0 the partitions could
+ * never get ahead of each other, so it all runs in one.
+ */
+static void setup_partitions(int count) {
+  if (count < 1) {
+    count = 1;
+  } else if (count > node_count) {
+    count = node_count;
+  }
+
+  for (int i = 0; i < node_count; ++i) {
+    nodes[i].partition = (int)((long long) i * count / node_count);
+  }
+
+  lookahead = NEVER;
+
+  for (int i = 0; i < node_count; ++i) {
+    for (int link = 1; link <= nodes[i].info.nlinks; ++link) {
+      const int peer = nodes[i].sim_links[link].peer;
+
+      if (nodes[peer].partition != nodes[i].partition &&
+          nodes[i].links[link].propagationdelay < lookahead) {
+        lookahead = nodes[i].links[link].propagationdelay;
+      }
+    }
+  }
+
+  if (lookahead <= 0) {
+    fprintf(stderr, "Links with no propagation delay, running on one "
+            "thread.\n");
+    count = 1;
+    lookahead = NEVER;
+
+    for (int i = 0; i < node_count; ++i) {
+      nodes[i].partition = 0;
+    }
+  }
+
+  partition_count = count;
+
+  if (posix_memalign((void **) &partitions, CACHE_LINE_SIZE,
+                     count * sizeof(struct Partition)) != 0) {
+    partitions = NULL;
+  }
+
+  // If we can't allocate memory for this, it's a serious problem
+  // can't recover from.
+  assert(partitions);
+  memset(partitions, 0, count * sizeof(struct Partition));
+
+  for (int i = 0; i < node_count; ++i) {
+    struct Partition *owner = &partitions[nodes[i].partition];
+
+    if (owner->last_node == 0) {
+      owner->first_node = i;
+    }
+    owner->last_node = i + 1;
+  }
+
+  for (int p = 0; p < count; ++p) {
+    init_event_queue(&partitions[p].queue);
+  }
+
+  for (int i = 0; i < node_count; ++i) {
+    for (int link = 1; link <= nodes[i].info.nlinks; ++link) {
+      struct SimLink *sim_link = &nodes[i].sim_links[link];
+      struct Partition *receiver = &partitions[nodes[sim_link->peer].partition];
+
+      if (receiver == &partitions[nodes[i].partition]) {
+        continue;
+      }
+
+      sim_link->mailbox = (struct Mailbox *)calloc(1, sizeof(struct Mailbox));
+      receiver->inbound = (struct Mailbox **)realloc(
+          receiver->inbound,
+          (receiver->inbound_count + 1) * sizeof(struct Mailbox *));
+      assert(sim_link->mailbox && receiver->inbound);
+
+      receiver->inbound[receiver->inbound_count++] = sim_link->mailbox;
+    }
+  }
+}
+
+/*
+ * Run
+ *
+ * With one partition, just runs every event up to the end. Otherwise
+ * each partition gets a thread (the first one this), and they run
+ * window by window.
+ */
+static void run(const CnetTime run_time) {
+  end_time = run_time;
+
+  if (partition_count == 1) {
+    partition = &partitions[0];
+    run_window(run_time + 1);
+    return;
+  }
+
+  pthread_barrier_init(&window_barrier, NULL, partition_count);
+
+  for (int p = 1; p < partition_count; ++p) {
+    if (pthread_create(&partitions[p].thread, NULL, run_partition,
+                       &partitions[p]) != 0) {
+      perror("pthread_create");
+      exit(1);
+    }
+  }
+
+  run_partition(&partitions[0]);
+
+  for (int p = 1; p < partition_count; ++p) {
+    pthread_join(partitions[p].thread, NULL);
+  }
+
+  pthread_barrier_destroy(&window_barrier);
+}
+
+/*
+ * Run partition
+ *
+ * Every partition works out the same window, from the earliest event
+ * in any of them, so they all agree when to stop. The second barrier
+ * makes sure every frame for the next window has been posted before
+ * anyone collects their mail.
+ */
+static void *run_partition(void *argument) {
+  partition = (struct Partition *) argument;
+
+  for (;;) {
+    collect_mail();
+
+    partition->next_time = (events_pending(&partition->queue) > 0) ?
+        next_event_time(&partition->queue) : NEVER;
+
+    pthread_barrier_wait(&window_barrier);
+
+    CnetTime earliest = NEVER;
+
+    for (int p = 0; p < partition_count; ++p) {
+      if (partitions[p].next_time < earliest) {
+        earliest = partitions[p].next_time;
+      }
+    }
+
+    if (earliest > end_time) {
+      break;
+    }
+
+    run_window((earliest + lookahead < end_time + 1) ?
+               earliest + lookahead : end_time + 1);
+
+    pthread_barrier_wait(&window_barrier);
+  }
+
+  return NULL;
+}
+
+/*
+ * Run window
+ *
+ * Takes the partition's events off its queue in order, and hands them
+ * to their nodes, up to (not including) window_end.
+ */
+static void run_window(const CnetTime window_end) {
+  struct EventQueue *queue = &partition->queue;
+  uint32_t index;
+
+  while (events_pending(queue) > 0 && next_event_time(queue) < window_end) {
+    next_event(queue, &index);
+
+    const struct Event *event = event_at(queue, index);
+
+    if (!event->cancelled) {
+      struct Node *node = &nodes[event->node];
+
+      now = event->time;
+      ++partition->totals.events;
+
+      if (event->type == EV_APPLICATIONREADY) {
+        node->application_pending = false;
+        free_event(queue, index);
+        application_ready(node);
+        continue;
+      }
+
+      // The handler might schedule events, which can move the pool.
+      const struct Event copy = *event;
+
+      current_event = &copy;
+      dispatch(node, copy.type, event_timer_id(queue, index), copy.data);
+      current_event = NULL;
+
+      if (copy.frame != NULL) {
+        release_frame(copy.frame);
+      }
+    } else if (event->frame != NULL) {
+      release_frame(event->frame);
+    }
+
+    free_event(queue, index);
+  }
+}
+
+/*
+ * Collect mail
+ *
+ * Moves frames posted to this partition in the last window onto its
+ * queue.
+ */
+static void collect_mail() {
+  for (int i = 0; i < partition->inbound_count; ++i) {
+    struct Mailbox *mailbox = partition->inbound[i];
+
+    for (size_t j = 0; j < mailbox->count; ++j) {
+      const struct Posted *posted = &mailbox->posted[j];
+      const uint32_t index = new_event(&partition->queue);
+      struct Event *event = event_at(&partition->queue, index);
+
+      event->time = posted->time;
+      event->origin = posted->origin;
+      event->sequence = posted->sequence;
+      event->node = posted->node;
+      event->type = EV_PHYSICALREADY;
+      event->link = posted->link;
+      event->length = posted->length;
+      event->frame = allocate_frame();
+      memcpy(event->frame, mailbox->bytes + posted->offset, posted->length);
+
+      schedule_event(&partition->queue, index);
+    }
+
+    mailbox->count = 0;
+    mailbox->used = 0;
+  }
+}
+
+/*
+ * Post frame
+ *
+ * Leaves a frame in the mailbox, returning where to copy it to, which
+ * is only good until the next frame is posted.
+ */
+static unsigned char *post_frame(struct Mailbox *const mailbox,
+                                 const struct Event *const frame) {
+  if (mailbox->count == mailbox->capacity) {
+    mailbox->capacity = (mailbox->capacity == 0) ? 64 : mailbox->capacity * 2;
+    mailbox->posted = (struct Posted *)realloc(
+        mailbox->posted, mailbox->capacity * sizeof(struct Posted));
+  }
+
+  if (mailbox->used + frame->length > mailbox->byte_capacity) {
+    while (mailbox->used + frame->length > mailbox->byte_capacity) {
+      mailbox->byte_capacity = (mailbox->byte_capacity == 0) ?
+          16384 : mailbox->byte_capacity * 2;
+    }
+
+    mailbox->bytes = (unsigned char *)realloc(mailbox->bytes,
+                                              mailbox->byte_capacity);
+  }
+
+  // If we can't allocate memory for this, it's a serious problem
+  // can't recover from.
+  assert(mailbox->posted && mailbox->bytes);
+
+  struct Posted *posted = &mailbox->posted[mailbox->count++];
+
+  posted->time = frame->time;
+  posted->origin = frame->origin;
+  posted->sequence = frame->sequence;
+  posted->node = frame->node;
+  posted->link = frame->link;
+  posted->length = frame->length;
+  posted->offset = mailbox->used;
+  mailbox->used += frame->length;
+
+  return mailbox->bytes + posted->offset;
+}
+
+/*
+ * Schedule
+ *
+ * Queues an event caused by the origin node, stamped so it's ordered
+ * the same whichever partition it ends up in.
+ */
+static void schedule(struct Node *const origin,
+                     struct EventQueue *const queue, const uint32_t index) {
+  struct Event *event = event_at(queue, index);
+
+  event->origin = origin - nodes;
+  event->sequence = origin->events_caused++;
+  schedule_event(queue, index);
+}
+
+/*
+ * Dispatch
+ *
+ * Calls the node's handler for the event, if it has one, with
+ * nodeinfo and linkinfo set for the node.
+ */
+static void dispatch(struct Node *const node, const CnetEvent ev,
+                     const CnetTimerID timer, const CnetData data) {
+  if (node->handlers[ev] == NULL) {
+    return;
+  }
+
+  current = node;
+  node->info.time_in_usec = now;
+  nodeinfo = node->info;
+  linkinfo = node->links;
+
+  node->handlers[ev](ev, timer, node->handler_data[ev] ? node->handler_data[ev]
+                                                         : data);
+}
+
+/*
+ * Application ready
+ *
+ * Generates a message for a random enabled destination, and lets the
+ * node read it. The next message is due after an exponentially
+ * distributed wait, averaging the node's message rate.
+ */
+static void application_ready(struct Node *const node) {
+  if (node->enabled_count == 0) {
+    return;
+  }
+
+  const int destination = node->enabled[next_random(node) %
+                                        node->enabled_count];
+  const int span = node->info.maxmessagesize - node->info.minmessagesize + 1;
+  const size_t length = node->info.minmessagesize + next_random(node) % span;
+  struct MessageHeader header = {
+    node->info.address, nodes[destination].info.address,
+    node->next_sequence[destination]++, (uint32_t) length};
+
+  memcpy(node->message, &header, sizeof(header));
+  for (size_t i = sizeof(header); i < length; ++i) {
+    node->message[i] = (unsigned char)(header.sequence + i);
+  }
+
+  node->message_length = length;
+  node->message_destination = header.destination;
+  ++partition->totals.messages_generated;
+
+  dispatch(node, EV_APPLICATIONREADY, NULLTIMER, 0);
+  node->message_length = 0;
+
+  schedule_application(node);
+}
+
+/*
+ * Schedule application
+ *
+ * Queues the node's next EV_APPLICATIONREADY, if it has somewhere to
+ * send to and one isn't already queued.
+ */
+static void schedule_application(struct Node *const node) {
+  if (node->application_pending || node->enabled_count == 0) {
+    return;
+  }
+
+  const double uniform = (next_random(node) >> 11) * (1.0 / 9007199254740992.0);
+  struct EventQueue *queue = &partitions[node->partition].queue;
+  const uint32_t index = new_event(queue);
+  struct Event *event = event_at(queue, index);
+
+  event->time = now + 1 + (CnetTime)(-log(1.0 - uniform) * node->message_rate);
+  event->node = node - nodes;
+  event->type = EV_APPLICATIONREADY;
+  schedule(node, queue, index);
+
+  node->application_pending = true;
+}
+
+static void set_enabled(struct Node *const node, const int destination,
+                        const bool enabled) {
+  const int position = node->enabled_position[destination];
+
+  if (enabled && position < 0) {
+    node->enabled_position[destination] = node->enabled_count;
+    node->enabled[node->enabled_count++] = destination;
+  } else if (!enabled && position >= 0) {
+    const int last = node->enabled[--node->enabled_count];
+
+    node->enabled[position] = last;
+    node->enabled_position[last] = position;
+    node->enabled_position[destination] = -1;
+  }
+}
+
+static int node_for_address(const CnetAddr address) {
+  int low = 0;
+  int high = node_count - 1;
+
+  while (low <= high) {
+    const int middle = (low + high) / 2;
+
+    if (addresses[middle].address == address) {
+      return addresses[middle].node;
+    } else if (addresses[middle].address < address) {
+      low = middle + 1;
+    } else {
+      high = middle - 1;
+    }
+  }
+
+  return -1;
+}
+
+/*
+ * Next random
+ *
+ * Splitmix64, per node, so a node's random numbers only depend on
+ * its own events.
+ */
+static uint64_t next_random(struct Node *const node) {
+  uint64_t z = (node->random_state += 0x9e3779b97f4a7c15ull);
+
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+  return z ^ (z >> 31);
+}
+
+/*
+ * One in power of two
+ *
+ * True one time in 2^power, like CNET's probframeloss and
+ * probframecorrupt. Never true for 0.
+ */
+static bool one_in_power_of_two(struct Node *const node, const int power) {
+  return power > 0 &&
+      (next_random(node) & ((1ull << power) - 1)) == 0;
+}
+
+/*
+ * Allocate frame
+ *
+ * Frame copies come from the partition's own pool. A frame going to
+ * another partition is copied through its mailbox, so they never
+ * move between pools.
+ */
+static unsigned char *allocate_frame() {
+  struct Partition *pool = partition;
+
+  if (pool->free_frame_count == 0) {
+    unsigned char *chunk = (unsigned char *)malloc(FRAMES_PER_CHUNK *
+                                                   max_frame_size);
+
+    pool->frame_capacity += FRAMES_PER_CHUNK;
+    pool->free_frames = (unsigned char **)realloc(
+        pool->free_frames, pool->frame_capacity * sizeof(unsigned char *));
+
+    // If we can't allocate memory for this, it's a serious problem
+    // can't recover from.
+    assert(chunk && pool->free_frames);
+
+    for (int i = 0; i < FRAMES_PER_CHUNK; ++i) {
+      pool->free_frames[pool->free_frame_count++] = chunk + i * max_frame_size;
+    }
+  }
+
+  return pool->free_frames[--pool->free_frame_count];
+}
+
+static void release_frame(unsigned char *const frame) {
+  partition->free_frames[partition->free_frame_count++] = frame;
+}
+
+static void print_summary(const CnetTime run_time, const double seconds) {
+  struct Totals totals;
+
+  memset(&totals, 0, sizeof(totals));
+
+  for (int p = 0; p < partition_count; ++p) {
+    const struct Totals *from = &partitions[p].totals;
+
+    totals.events += from->events;
+    totals.frames_sent += from->frames_sent;
+    totals.bytes_sent += from->bytes_sent;
+    totals.frames_lost += from->frames_lost;
+    totals.frames_corrupted += from->frames_corrupted;
+    totals.messages_generated += from->messages_generated;
+    totals.messages_delivered += from->messages_delivered;
+    totals.messages_out_of_sequence += from->messages_out_of_sequence;
+    totals.bytes_delivered += from->bytes_delivered;
+  }
+
+  printf("\nSimulated %.1f seconds in %.3f seconds", run_time / 1e6,
+         seconds);
+
+  if (partition_count > 1) {
+    printf(", %d threads, %lld usec lookahead", partition_count,
+           (long long) lookahead);
+  }
+  printf(".\n");
+  printf("Events:             %12llu (%.0f/sec)\n", totals.events,
+         totals.events / seconds);
+  printf("Frames sent:        %12llu (%.0f/sec)\n", totals.frames_sent,
+         totals.frames_sent / seconds);
+  printf("Bytes sent:         %12llu\n", totals.bytes_sent);
+  printf("Frames lost:        %12llu\n", totals.frames_lost);
+  printf("Frames corrupted:   %12llu\n", totals.frames_corrupted);
+  printf("Messages generated: %12llu\n", totals.messages_generated);
+  printf("Messages delivered: %12llu\n", totals.messages_delivered);
+  printf("Out of sequence:    %12llu\n", totals.messages_out_of_sequence);
+  printf("Bytes delivered:    %12llu\n", totals.bytes_delivered);
+  printf("Efficiency:         %11.1f%%\n", (totals.bytes_sent == 0) ? 0.0 :
+         100.0 * totals.bytes_delivered / totals.bytes_sent);
+}
+
+/*
+ * The CNET API, for the node of the current event.
+ */
+
+void CNET_check_failed(const char *file, int line, const char *call) {
+  fprintf(stderr, "%s, %s:%d: %s failed, at %lld usecs.\n",
+          current ? current->info.nodename : "?", file, line, call,
+          (long long) now);
+  exit(1);
+}
+
+int CNET_set_handler(CnetEvent ev,
+                     void (*handler)(CnetEvent, CnetTimerID, CnetData),
+                     CnetData data) {
+  if ((int) ev < 0 || ev >= N_CNET_EVENTS) {
+    return -1;
+  }
+
+  current->handlers[ev] = handler;
+  current->handler_data[ev] = data;
+  return 0;
+}
+
+int CNET_set_debug_string(CnetEvent ev, const char *string) {
+  return 0;
+}
+
+int CNET_enable_application(CnetAddr destination) {
+  if (destination == ALLNODES) {
+    for (int i = 0; i < node_count; ++i) {
+      if (&nodes[i] != current) {
+        set_enabled(current, i, true);
+      }
+    }
+  } else {
+    const int node = node_for_address(destination);
+
+    if (node < 0 || &nodes[node] == current) {
+      return -1;
+    }
+
+    set_enabled(current, node, true);
+  }
+
+  schedule_application(current);
+  return 0;
+}
+
+int CNET_disable_application(CnetAddr destination) {
+  if (destination == ALLNODES) {
+    while (current->enabled_count > 0) {
+      set_enabled(current, current->enabled[0], false);
+    }
+    return 0;
+  }
+
+  const int node = node_for_address(destination);
+
+  if (node < 0) {
+    return -1;
+  }
+
+  set_enabled(current, node, false);
+  return 0;
+}
+
+int CNET_read_application(CnetAddr *destination, void *message,
+                          size_t *length) {
+  if (current->message_length == 0 || *length < current->message_length) {
+    return -1;
+  }
+
+  memcpy(message, current->message, current->message_length);
+  *length = current->message_length;
+  *destination = current->message_destination;
+  current->message_length = 0;
+  return 0;
+}
+
+/*
+ * CNET write application
+ *
+ * Checks the message is for this node, is the next one from its
+ * source, and hasn't been corrupted. Anything wrong is reported, and
+ * fails the call, which CHECK turns into the end of the run (apart
+ * from out of sequence with -k).
+ */
+int CNET_write_application(void *message, size_t *length) {
+  struct MessageHeader header;
+  const unsigned char *bytes = (const unsigned char *) message;
+  const char *problem = NULL;
+
+  if (*length < sizeof(header)) {
+    problem = "too short";
+  } else {
+    memcpy(&header, message, sizeof(header));
+
+    const int source = node_for_address(header.source);
+
+    if (header.destination != current->info.address) {
+      problem = "for another node";
+    } else if (source < 0 || header.length != *length) {
+      problem = "corrupted";
+    } else if (header.sequence != current->expected_sequence[source] &&
+               !keep_going) {
+      problem = "out of sequence";
+    } else {
+      for (size_t i = sizeof(header); i < *length && problem == NULL; ++i) {
+        if (bytes[i] != (unsigned char)(header.sequence + i)) {
+          problem = "corrupted";
+        }
+      }
+
+      if (problem == NULL) {
+        if (header.sequence != current->expected_sequence[source]) {
+          ++partition->totals.messages_out_of_sequence;
+        }
+
+        // Carry on from this one, so a lost message is only counted once.
+        current->expected_sequence[source] = header.sequence + 1;
+      }
+    }
+  }
+
+  if (problem != NULL) {
+    fprintf(stderr, "%s: message %s.\n", current->info.nodename, problem);
+    return -1;
+  }
+
+  ++partition->totals.messages_delivered;
+  partition->totals.bytes_delivered += *length;
+  return 0;
+}
+
+int CNET_read_physical(int *link, void *frame, size_t *length) {
+  if (current_event == NULL || current_event->frame == NULL ||
+      *length < current_event->length) {
+    return -1;
+  }
+
+  memcpy(frame, current_event->frame, current_event->length);
+  *length = current_event->length;
+  *link = current_event->link;
+  return 0;
+}
+
+/*
+ * CNET write physical
+ *
+ * Frames on a link go one after the other, each takes its length
+ * over the bandwidth to send, then the propagation delay to arrive.
+ */
+int CNET_write_physical(int link, void *frame, size_t *length) {
+  if (link < 1 || link > current->info.nlinks ||
+      *length > (size_t) current->links[link].mtu) {
+    return -1;
+  }
+
+  struct SimLink *sim_link = &current->sim_links[link];
+  const CnetLinkInfo *info = &current->links[link];
+  const CnetTime transmission = (CnetTime)(*length * 8 * 1000000.0 /
+                                           info->bandwidth);
+  const CnetTime start = (sim_link->busy_until > now) ?
+      sim_link->busy_until : now;
+
+  sim_link->busy_until = start + transmission;
+  ++partition->totals.frames_sent;
+  partition->totals.bytes_sent += *length;
+
+  if (one_in_power_of_two(current, sim_link->probframeloss)) {
+    ++partition->totals.frames_lost;
+    return 0;
+  }
+
+  struct Event arrival;
+  unsigned char *copy;
+
+  memset(&arrival, 0, sizeof(arrival));
+  arrival.time = sim_link->busy_until + info->propagationdelay;
+  arrival.origin = current - nodes;
+  arrival.sequence = current->events_caused++;
+  arrival.node = sim_link->peer;
+  arrival.type = EV_PHYSICALREADY;
+  arrival.link = sim_link->peer_link;
+  arrival.length = *length;
+
+  if (sim_link->mailbox != NULL) {
+    copy = post_frame(sim_link->mailbox, &arrival);
+  } else {
+    // The other end is in this partition.
+    const uint32_t index = new_event(&partition->queue);
+    struct Event *event = event_at(&partition->queue, index);
+    const uint32_t generation = event->generation;
+
+    *event = arrival;
+    event->generation = generation;
+    copy = event->frame = allocate_frame();
+    schedule_event(&partition->queue, index);
+  }
+
+  memcpy(copy, frame, *length);
+
+  if (*length > 0 && one_in_power_of_two(current, sim_link->probframecorrupt)) {
+    const uint64_t random = next_random(current);
+
+    copy[random % *length] ^= (unsigned char)((random >> 32) | 1);
+    ++partition->totals.frames_corrupted;
+  }
+
+  return 0;
+}
+
+CnetTimerID CNET_start_timer(CnetEvent ev, CnetTime usecs, CnetData data) {
+  if (ev < EV_TIMER0 || ev > EV_TIMER9) {
+    return NULLTIMER;
+  }
+
+  struct EventQueue *queue = &partitions[current->partition].queue;
+  const uint32_t index = new_event(queue);
+  struct Event *event = event_at(queue, index);
+
+  event->time = now + ((usecs > 0) ? usecs : 0);
+  event->node = current - nodes;
+  event->type = ev;
+  event->data = data;
+  schedule(current, queue, index);
+
+  return event_timer_id(queue, index);
+}
+
+int CNET_stop_timer(CnetTimerID timer) {
+  return cancel_timer(&partitions[current->partition].queue, timer) ? 0 : -1;
+}
+
+uint32_t CNET_crc32(unsigned char *address, int length) {
+  uint32_t crc = 0xffffffffu;
+
+  for (int i = 0; i < length; ++i) {
+    crc = crc_table[(crc ^ address[i]) & 0xff] ^ (crc >> 8);
+  }
+
+  return crc ^ 0xffffffffu;
+}
@@ -0,0 +1,445 @@
+/*
+ * CC200 Assignment
+ *
+ * Author: Mike Aldred
+ *
+ * Simulator Topology
+ *
+ * Description:
+ *   Look at the header file for details.
+ */
+
+#include <assert.h>
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "topology.h"
+
+// CNET's defaults.
+#define DEFAULT_BANDWIDTH 56000
+#define DEFAULT_PROPAGATION_DELAY 2500000
+#define DEFAULT_MESSAGE_RATE 1000000
+#define DEFAULT_MIN_MESSAGE_SIZE 64
+#define DEFAULT_MAX_MESSAGE_SIZE 1024
+#define DEFAULT_MTU (MAX_MESSAGE_SIZE + 1024)
+
+#define MAX_TOKEN 256
+
+/*
+ * Links are read with the node names, they're only turned into
+ * indexes once every node has been read.
+ */
+struct PendingLink {
+  int from;
+  char to[MAX_NODENAME_LEN];
+  struct LinkAttributes attributes;
+};
+
+struct Parser {
+  const char *filename;
+  const char *text;
+  const char *position;
+  int line;
+  char token[MAX_TOKEN];
+};
+
+// Forward declarations
+static bool next_token(struct Parser *const parser);
+static bool peek_is(struct Parser *const parser, const char *const wanted);
+static void expect(struct Parser *const parser, const char *const wanted);
+static void parse_error(const struct Parser *const parser,
+                        const char *const message);
+static void parse_host(struct Parser *const parser,
+                       struct Topology *const topology,
+                       const struct NodeAttributes *const node_defaults,
+                       const struct LinkAttributes *const link_defaults,
+                       struct PendingLink **pending, int *pending_count);
+static void parse_link_block(struct Parser *const parser,
+                             struct LinkAttributes *const attributes);
+static void set_attribute(const struct Parser *const parser,
+                          const char *const name, const char *const value,
+                          struct NodeAttributes *const node,
+                          struct LinkAttributes *const link);
+static double parse_value(const struct Parser *const parser,
+                          const char *const value);
+static int find_node(const struct Topology *const topology,
+                     const char *const name);
+static char *read_file(const char *const filename);
+static void *grow(void *array, const int count, const size_t size);
+
+void read_topology(const char *const filename,
+                   struct Topology *const topology) {
+  struct Parser parser = {filename, NULL, NULL, 1, ""};
+  struct NodeAttributes node_defaults = {
+    0, DEFAULT_MESSAGE_RATE, DEFAULT_MIN_MESSAGE_SIZE,
+    DEFAULT_MAX_MESSAGE_SIZE};
+  struct LinkAttributes link_defaults = {
+    DEFAULT_BANDWIDTH, DEFAULT_PROPAGATION_DELAY, 0, 0, DEFAULT_MTU};
+  struct PendingLink *pending = NULL;
+  int pending_count = 0;
+
+  parser.text = parser.position = read_file(filename);
+  memset(topology, 0, sizeof(struct Topology));
+
+  while (next_token(&parser)) {
+    if (strcmp(parser.token, "host") == 0 ||
+        strcmp(parser.token, "router") == 0) {
+      parse_host(&parser, topology, &node_defaults, &link_defaults,
+                 &pending, &pending_count);
+    } else if (peek_is(&parser, "=")) {
+      char name[MAX_TOKEN];
+
+      strcpy(name, parser.token);
+      expect(&parser, "=");
+      if (!next_token(&parser)) {
+        parse_error(&parser, "missing value");
+      }
+      set_attribute(&parser, name, parser.token, &node_defaults,
+                    &link_defaults);
+    }
+  }
+
+  // Now every node is known, join up the links.
+  int *links_used = (int *)calloc(topology->node_count + 1, sizeof(int));
+  assert(links_used);
+
+  for (int i = 0; i < pending_count; ++i) {
+    const int from = pending[i].from;
+    const int to = find_node(topology, pending[i].to);
+    bool duplicate = false;
+
+    if (to < 0) {
+      fprintf(stderr, "%s: link to unknown host %s.\n", filename,
+              pending[i].to);
+      exit(1);
+    }
+
+    for (int j = 0; j < topology->link_count; ++j) {
+      const struct TopologyLink *link = &topology->links[j];
+
+      duplicate = duplicate || (link->from == from && link->to == to) ||
+          (link->from == to && link->to == from);
+    }
+
+    if (duplicate || from == to) {
+      continue;
+    }
+
+    topology->links = grow(topology->links, topology->link_count,
+                           sizeof(struct TopologyLink));
+
+    struct TopologyLink *link = &topology->links[topology->link_count++];
+
+    link->from = from;
+    link->to = to;
+    link->from_link = ++links_used[from];
+    link->to_link = ++links_used[to];
+    link->attributes = pending[i].attributes;
+  }
+
+  free(links_used);
+  free(pending);
+  free((void *) parser.text);
+}
+
+/*
+ * Parse host
+ *
+ * Reads a host block, after the "host" keyword.
+ */
+static void parse_host(struct Parser *const parser,
+                       struct Topology *const topology,
+                       const struct NodeAttributes *const node_defaults,
+                       const struct LinkAttributes *const link_defaults,
+                       struct PendingLink **pending, int *pending_count) {
+  if (!next_token(parser)) {
+    parse_error(parser, "missing host name");
+  }
+
+  topology->nodes = grow(topology->nodes, topology->node_count,
+                         sizeof(struct TopologyNode));
+
+  const int index = topology->node_count++;
+  struct TopologyNode *node = &topology->nodes[index];
+
+  snprintf(node->name, sizeof(node->name), "%s", parser->token);
+  node->attributes = *node_defaults;
+  node->attributes.address = index;
+  node->link_defaults = *link_defaults;
+
+  // Links are added once the host's own attributes have been read.
+  const int first_link = *pending_count;
+
+  expect(parser, "{");
+
+  while (next_token(parser) && strcmp(parser->token, "}") != 0) {
+    if (strcmp(parser->token, "link") == 0) {
+      expect(parser, "to");
+      if (!next_token(parser)) {
+        parse_error(parser, "missing link destination");
+      }
+
+      *pending = grow(*pending, *pending_count, sizeof(struct PendingLink));
+
+      struct PendingLink *link = &(*pending)[(*pending_count)++];
+
+      link->from = index;
+      snprintf(link->to, sizeof(link->to), "%s", parser->token);
+
+      // Filled in below, an attribute block overrides the host's.
+      link->attributes.bandwidth = -1;
+
+      if (peek_is(parser, "{")) {
+        link->attributes = node->link_defaults;
+        expect(parser, "{");
+        parse_link_block(parser, &link->attributes);
+      }
+    } else if (peek_is(parser, "=")) {
+      char name[MAX_TOKEN];
+
+      strcpy(name, parser->token);
+      expect(parser, "=");
+      if (!next_token(parser)) {
+        parse_error(parser, "missing value");
+      }
+      set_attribute(parser, name, parser->token, &node->attributes,
+                    &node->link_defaults);
+    }
+  }
+
+  for (int i = first_link; i < *pending_count; ++i) {
+    if ((*pending)[i].attributes.bandwidth == -1) {
+      (*pending)[i].attributes = node->link_defaults;
+    }
+  }
+}
+
+/*
+ * Parse link block
+ *
+ * Reads the attributes for one link, after the "{".
+ */
+static void parse_link_block(struct Parser *const parser,
+                             struct LinkAttributes *const attributes) {
+  while (next_token(parser) && strcmp(parser->token, "}") != 0) {
+    if (peek_is(parser, "=")) {
+      char name[MAX_TOKEN];
+
+      strcpy(name, parser->token);
+      expect(parser, "=");
+      if (!next_token(parser)) {
+        parse_error(parser, "missing value");
+      }
+      set_attribute(parser, name, parser->token, NULL, attributes);
+    }
+  }
+}
+
+/*
+ * Set attribute
+ *
+ * Node attributes are ignored if node is NULL. Anything not modelled
+ * is skipped.
+ */
+static void set_attribute(const struct Parser *const parser,
+                          const char *const name, const char *const value,
+                          struct NodeAttributes *const node,
+                          struct LinkAttributes *const link) {
+  if (strcmp(name, "bandwidth") == 0) {
+    link->bandwidth = (int64_t) parse_value(parser, value);
+  } else if (strcmp(name, "propagationdelay") == 0) {
+    link->propagation_delay = (CnetTime) parse_value(parser, value);
+  } else if (strcmp(name, "probframeloss") == 0) {
+    link->probframeloss = (int) parse_value(parser, value);
+  } else if (strcmp(name, "probframecorrupt") == 0) {
+    link->probframecorrupt = (int) parse_value(parser, value);
+  } else if (strcmp(name, "mtu") == 0) {
+    link->mtu = (int) parse_value(parser, value);
+  } else if (node == NULL) {
+    return;
+  } else if (strcmp(name, "address") == 0) {
+    node->address = (CnetAddr) parse_value(parser, value);
+  } else if (strcmp(name, "messagerate") == 0) {
+    node->message_rate = (CnetTime) parse_value(parser, value);
+  } else if (strcmp(name, "minmessagesize") == 0) {
+    node->min_message_size = (int) parse_value(parser, value);
+  } else if (strcmp(name, "maxmessagesize") == 0) {
+    node->max_message_size = (int) parse_value(parser, value);
+  }
+}
+
+/*
+ * Parse value
+ *
+ * A number, with an optional unit. Times come out in usecs, and
+ * bandwidths in bits per second.
+ */
+static double parse_value(const struct Parser *const parser,
+                          const char *const value) {
+  static const struct {
+    const char *suffix;
+    double scale;
+  } units[] = {
+    {"", 1}, {"usec", 1}, {"usecs", 1}, {"us", 1},
+    {"ms", 1000}, {"msec", 1000}, {"msecs", 1000},
+    {"s", 1000000}, {"sec", 1000000}, {"secs", 1000000},
+    {"bps", 1}, {"Kbps", 1000}, {"Mbps", 1000000},
+    {"B", 1}, {"bytes", 1}, {"KB", 1024}, {"KBytes", 1024}};
+  char *end;
+  const double number = strtod(value, &end);
+
+  if (end == value) {
+    parse_error(parser, "expected a number");
+  }
+
+  for (size_t i = 0; i < sizeof(units) / sizeof(units[0]); ++i) {
+    if (strcmp(end, units[i].suffix) == 0) {
+      return number * units[i].scale;
+    }
+  }
+
+  parse_error(parser, "unknown unit");
+  return 0;
+}
+
+static int find_node(const struct Topology *const topology,
+                     const char *const name) {
+  for (int i = 0; i < topology->node_count; ++i) {
+    if (strcmp(topology->nodes[i].name, name) == 0) {
+      return i;
+    }
+  }
+
+  return -1;
+}
+
+/*
+ * Next token
+ *
+ * Reads the next word, number, string or bit of punctuation into
+ * parser->token, skipping comments. Strings have their quotes taken
+ * off. Returns false at the end of the file.
+ */
+static bool next_token(struct Parser *const parser) {
+  const char *p = parser->position;
+
+  for (;;) {
+    while (isspace((unsigned char) *p)) {
+      if (*p++ == '\n') {
+        ++parser->line;
+      }
+    }
+
+    if (p[0] == '/' && p[1] == '*') {
+      for (p += 2; *p != '\0' && !(p[0] == '*' && p[1] == '/'); ++p) {
+        if (*p == '\n') {
+          ++parser->line;
+        }
+      }
+      p += (*p != '\0') ? 2 : 0;
+    } else if (p[0] == '/' && p[1] == '/') {
+      while (*p != '\0' && *p != '\n') {
+        ++p;
+      }
+    } else {
+      break;
+    }
+  }
+
+  size_t length = 0;
+
+  if (*p == '\0') {
+    parser->position = p;
+    return false;
+  } else if (*p == '"') {
+    for (++p; *p != '\0' && *p != '"'; ++p) {
+      if (length < MAX_TOKEN - 1) {
+        parser->token[length++] = *p;
+      }
+    }
+    p += (*p == '"') ? 1 : 0;
+  } else if (isalnum((unsigned char) *p) || *p == '_' || *p == '.' ||
+             *p == '-') {
+    while (isalnum((unsigned char) *p) || *p == '_' || *p == '.' ||
+           *p == '-') {
+      if (length < MAX_TOKEN - 1) {
+        parser->token[length++] = *p;
+      }
+      ++p;
+    }
+  } else {
+    parser->token[length++] = *p++;
+  }
+
+  parser->token[length] = '\0';
+  parser->position = p;
+  return true;
+}
+
+/*
+ * Peek is
+ *
+ * True if the next token is the one wanted, without reading it.
+ */
+static bool peek_is(struct Parser *const parser, const char *const wanted) {
+  struct Parser ahead = *parser;
+
+  return next_token(&ahead) && strcmp(ahead.token, wanted) == 0;
+}
+
+static void expect(struct Parser *const parser, const char *const wanted) {
+  if (!next_token(parser) || strcmp(parser->token, wanted) != 0) {
+    char message[MAX_TOKEN + 32];
+
+    snprintf(message, sizeof(message), "expected \"%s\"", wanted);
+    parse_error(parser, message);
+  }
+}
+
+static void parse_error(const struct Parser *const parser,
+                        const char *const message) {
+  fprintf(stderr, "%s:%d: %s, at \"%s\".\n", parser->filename, parser->line,
+          message, parser->token);
+  exit(1);
+}
+
+static char *read_file(const char *const filename) {
+  FILE *in = fopen(filename, "rb");
+
+  if (in == NULL) {
+    fprintf(stderr, "Can't open topology file %s.\n", filename);
+    exit(1);
+  }
+
+  fseek(in, 0, SEEK_END);
+  const long size = ftell(in);
+  fseek(in, 0, SEEK_SET);
+
+  char *text = (char *)malloc(size + 1);
+
+  // If we can't allocate memory for this, it's a serious problem
+  // can't recover from.
+  assert(text);
+
+  text[fread(text, 1, size, in)] = '\0';
+  fclose(in);
+
+  return text;
+}
+
+/*
+ * Grow
+ *
+ * Makes room for one more element on the end of the array.
+ */
+static void *grow(void *array, const int count, const size_t size) {
+  array = realloc(array, (count + 1) * size);
+
+  // If we can't allocate memory for this, it's a serious problem
+  // can't recover from.
+  assert(array);
+
+  return array;
+}
@@ -0,0 +1,79 @@
+/*
+ * CC200 Assignment
+ *
+ * Author: Mike Aldred
+ *
+ * Simulator Topology
+ *
+ * Description:
+ *
+ *   Reads a CNET topology file for the simulator. Hosts (or routers)
+ *   and the links between them are read, along with the attributes
+ *   the simulator models:
+ *
+ *     bandwidth, propagationdelay, probframeloss, probframecorrupt,
+ *     mtu - for links, given globally, in a host (for all its links),
+ *     or in a block after "link to NAME".
+ *
+ *     address, messagerate, minmessagesize, maxmessagesize - for
+ *     hosts, given globally or in the host.
+ *
+ *   Times can have a usec, ms or s suffix, and bandwidths bps, Kbps
+ *   or Mbps, like CNET. Everything else (compile, positions, ostype
+ *   and so on) is skipped over.
+ */
+
+#ifndef TOPOLOGY_H_
+#define TOPOLOGY_H_
+
+#include <cnet.h>
+
+struct LinkAttributes {
+  int64_t bandwidth;
+  CnetTime propagation_delay;
+  int probframeloss;
+  int probframecorrupt;
+  int mtu;
+};
+
+struct NodeAttributes {
+  CnetAddr address;
+  CnetTime message_rate;
+  int min_message_size;
+  int max_message_size;
+};
+
+struct TopologyNode {
+  char name[MAX_NODENAME_LEN];
+  struct NodeAttributes attributes;
+  struct LinkAttributes link_defaults;
+};
+
+/*
+ * A link between two nodes, by index in the node list. Each end's
+ * link number is the order it was given for that node, from 1.
+ */
+struct TopologyLink {
+  int from;
+  int to;
+  int from_link;
+  int to_link;
+  struct LinkAttributes attributes;
+};
+
+struct Topology {
+  struct TopologyNode *nodes;
+  int node_count;
+  struct TopologyLink *links;
+  int link_count;
+};
+
+/*
+ * Read topology
+ *
+ * Reads the topology file. Any error is reported and ends the run.
+ */
+void read_topology(const char *const filename,
+                   struct Topology *const topology);
+
+#endif
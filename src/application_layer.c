@@ -13,29 +13,35 @@
 #include <stdio.h>
 
 #include "application_layer.h"
-#include "network_layer.h"
+#include "frame_buffer.h"
+#include "stats.h"
+#include "transport_layer.h"
 
 EVENT_HANDLER(application_ready) {
   CnetAddr destination_address;
 
   /*
-   * We can just use a stack allocated variable here because the lower
-   * layers would have copied the message before this function exits.
+   * The message is read straight into where it sits in the frame, so
+   * it never has to be copied on the way down. The lower layers take
+   * the buffer.
    */
-  struct Message outgoing_message;
+  struct FrameBuffer *buffer = allocate_frame_buffer();
   size_t length = sizeof(struct Message);
 
   CHECK(CNET_read_application(&destination_address,
-                              &outgoing_message,
+                              &buffer->frame.packet.message,
                               &length));
 
-  application_down_to_network(destination_address,
-                              &outgoing_message, length);
+  ++node_stats.messages_sent;
+  application_down_to_transport(destination_address, buffer, length);
 }
 
-void network_up_to_application(const struct Message *const in_message,
+void transport_up_to_application(const struct Message *const in_message,
                                const size_t length) {
   // Because CNET writes to length variable, breaks const correctness.
   size_t temp_length = length;
+
+  ++node_stats.messages_received;
+  node_stats.bytes_received += length;
   CHECK(CNET_write_application((char *)in_message, &temp_length));
 }
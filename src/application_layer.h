@@ -36,12 +36,12 @@ struct Message {
 EVENT_HANDLER(application_ready);
 
 /*
- * Network up to application
+ * Transport up to application
  *
- * Called when the network layer has determined that the message is
- * for the application running on the node.
+ * Called when the transport layer has a message for the application
+ * running on the node, in order.
  */
-void network_up_to_application(const struct Message *const in_message,
+void transport_up_to_application(const struct Message *const in_message,
                                const size_t length);
 
 #endif
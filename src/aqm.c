@@ -0,0 +1,262 @@
+/*
+ * CC200 Assignment
+ *
+ * Author: Mike Aldred
+ *
+ * Active Queue Management
+ *
+ * Description:
+ *   Look at the header file for details.
+ */
+
+#include "aqm.h"
+
+/*
+ * RED's average is fixed point, 8 bits after the point, and each
+ * arrival counts for 1/16th of it. The usual 1/512th is for queues
+ * turning over far faster than CNET's do.
+ */
+#define RED_SCALE_SHIFT 8
+#define RED_WEIGHT_SHIFT 4
+
+// Forward declarations
+static void codel_times(struct Aqm *const aqm);
+static bool codel_over_target(struct Aqm *const aqm, const CnetTime sojourn,
+                              const size_t queued);
+static CnetTime codel_control_law(const struct Aqm *const aqm,
+                                  const CnetTime time);
+static unsigned long long square_root(const unsigned long long value);
+
+/*
+ * Setup AQM
+ *
+ * Globals:
+ *   config - AQM mode for the link.
+ *   linkinfo - Bandwidth and propagation delay of the link.
+ */
+void setup_aqm(struct Aqm *const aqm, const int link) {
+  const int index = (link <= config.aqm_mode_count) ?
+      link - 1 : config.aqm_mode_count - 1;
+
+  aqm->mode = config.aqm_modes[index];
+  aqm->red_average = 0;
+  aqm->red_count = 0;
+  aqm->first_above_time = 0;
+  aqm->dropping = false;
+  aqm->drop_next = 0;
+  aqm->count = 0;
+  aqm->last_count = 0;
+
+  aqm->bandwidth = linkinfo[link].bandwidth;
+  aqm->propagation_delay = linkinfo[link].propagationdelay;
+  aqm->largest_packet = 0;
+  codel_times(aqm);
+}
+
+/*
+ * AQM applies
+ *
+ * Check header file for details.
+ *
+ * Globals:
+ *   nodeinfo - This node's address.
+ */
+bool aqm_applies(const struct Packet *const packet) {
+  return packet_class(packet) != CLASS_CONTROL &&
+         packet->source_address != nodeinfo.address;
+}
+
+/*
+ * AQM drop arrival
+ *
+ * The drop chance goes from none at redmin to redpercent at redmax.
+ * The count of packets let through goes up by the chance each time,
+ * and a packet is dropped once it reaches one, so drops come evenly
+ * spaced.
+ *
+ * Globals:
+ *   config - RED's thresholds and drop chance.
+ */
+bool aqm_drop_arrival(struct Aqm *const aqm, const size_t queued) {
+  if (aqm->mode != AQM_RED) {
+    return false;
+  }
+
+  const long scaled = (long) queued << RED_SCALE_SHIFT;
+
+  aqm->red_average += (scaled - aqm->red_average) >> RED_WEIGHT_SHIFT;
+
+  const long low = (long) config.red_min << RED_SCALE_SHIFT;
+  const long high = (long) config.red_max << RED_SCALE_SHIFT;
+
+  if (aqm->red_average < low) {
+    aqm->red_count = 0;
+    return false;
+  }
+
+  if (aqm->red_average >= high) {
+    aqm->red_count = 0;
+    return true;
+  }
+
+  // Chance out of 100 << RED_SCALE_SHIFT.
+  aqm->red_count += config.red_percent * (aqm->red_average - low) /
+                    (config.red_max - config.red_min);
+
+  if (aqm->red_count >= (100L << RED_SCALE_SHIFT)) {
+    aqm->red_count = 0;
+    return true;
+  }
+
+  return false;
+}
+
+/*
+ * AQM drop departure
+ *
+ * Called a packet at a time, CoDel's dequeue from RFC 8289. Once it's
+ * dropping, a packet is dropped whenever the next drop is due, each
+ * bringing the one after closer. If it starts dropping again soon
+ * after it stopped, it picks up near the rate it left off at.
+ *
+ * Globals:
+ *   nodeinfo - The time now.
+ */
+bool aqm_drop_departure(struct Aqm *const aqm, const CnetTime sojourn,
+                        const size_t size, const size_t queued) {
+  if (aqm->mode != AQM_CODEL) {
+    return false;
+  }
+
+  if (size > aqm->largest_packet) {
+    aqm->largest_packet = size;
+    codel_times(aqm);
+  }
+
+  const CnetTime now = nodeinfo.time_in_usec;
+  const bool over_target = codel_over_target(aqm, sojourn, queued);
+
+  if (aqm->dropping) {
+    if (!over_target) {
+      aqm->dropping = false;
+      return false;
+    }
+
+    if (now >= aqm->drop_next) {
+      ++aqm->count;
+      aqm->drop_next = codel_control_law(aqm, aqm->drop_next);
+      return true;
+    }
+
+    return false;
+  }
+
+  if (!over_target) {
+    return false;
+  }
+
+  const int delta = aqm->count - aqm->last_count;
+
+  aqm->dropping = true;
+  aqm->count = (delta > 1 && now - aqm->drop_next < 16 * aqm->interval) ?
+      delta : 1;
+  aqm->last_count = aqm->count;
+  aqm->drop_next = codel_control_law(aqm, now);
+
+  return true;
+}
+
+/*
+ * CoDel times
+ *
+ * Sets the target and interval, from the config if they were given,
+ * otherwise from the link and the largest packet so far.
+ *
+ * Globals:
+ *   config - CoDel's target and interval.
+ */
+static void codel_times(struct Aqm *const aqm) {
+  const CnetTime transmission = (aqm->bandwidth > 0) ?
+      (CnetTime) aqm->largest_packet * 8000000 / aqm->bandwidth : 0;
+
+  aqm->target = config.codel_target;
+  if (aqm->target == 0) {
+    aqm->target = (transmission > CODEL_TARGET) ?
+        transmission : CODEL_TARGET;
+  }
+
+  aqm->interval = config.codel_interval;
+  if (aqm->interval == 0) {
+    aqm->interval = 4 * aqm->target + 2 * aqm->propagation_delay;
+
+    if (aqm->interval < CODEL_INTERVAL) {
+      aqm->interval = CODEL_INTERVAL;
+    }
+  }
+}
+
+/*
+ * CoDel over target
+ *
+ * Whether packets have been leaving after more than the target for at
+ * least an interval. A packet that leaves the queue empty doesn't
+ * count, there's no standing queue behind it.
+ */
+static bool codel_over_target(struct Aqm *const aqm, const CnetTime sojourn,
+                              const size_t queued) {
+  const CnetTime now = nodeinfo.time_in_usec;
+
+  if (sojourn < aqm->target || queued == 0) {
+    aqm->first_above_time = 0;
+    return false;
+  }
+
+  if (aqm->first_above_time == 0) {
+    aqm->first_above_time = now + aqm->interval;
+    return false;
+  }
+
+  return now >= aqm->first_above_time;
+}
+
+/*
+ * CoDel control law
+ *
+ * When the drop after one at time is due, the interval over the square
+ * root of the drop count. The root is taken with 10 bits after the
+ * point.
+ */
+static CnetTime codel_control_law(const struct Aqm *const aqm,
+                                  const CnetTime time) {
+  const unsigned long long root =
+      square_root((unsigned long long) aqm->count << 20);
+
+  return time + (CnetTime)(((unsigned long long) aqm->interval << 10) / root);
+}
+
+/*
+ * Square root
+ *
+ * Rounded down, a bit at a time.
+ */
+static unsigned long long square_root(const unsigned long long value) {
+  unsigned long long remainder = value;
+  unsigned long long root = 0;
+  unsigned long long bit = 1ull << 62;
+
+  while (bit > remainder) {
+    bit >>= 2;
+  }
+
+  while (bit != 0) {
+    if (remainder >= root + bit) {
+      remainder -= root + bit;
+      root = (root >> 1) + bit;
+    } else {
+      root >>= 1;
+    }
+    bit >>= 2;
+  }
+
+  return root;
+}
@@ -0,0 +1,123 @@
+/*
+ * CC200 Assignment
+ *
+ * Author: Mike Aldred
+ *
+ * Active Queue Management
+ *
+ * Description:
+ *
+ *   A node forwarding for others (Perth, mostly) can't stop its
+ *   neighbours' applications, so a busy link's queue sits near its
+ *   limit, and everything going through it waits behind the lot. The
+ *   aqm option drops some packets early instead, keeping the queue
+ *   short, so the packets that do get through aren't held up for
+ *   seconds. A dropped message is only sent again by the transport
+ *   layer, without it the destination gets a gap and CNET stops the
+ *   simulation (message out of sequence), so any mode other than off
+ *   turns transport on.
+ *
+ *   RED drops packets as they arrive. It keeps a moving average of
+ *   the queue's length, with no drops below redmin packets, every
+ *   packet dropped at redmax, and in between a drop chance going up
+ *   to redpercent. The drops are spread out evenly rather than at
+ *   random, one every 1/chance packets, so runs can be repeated.
+ *
+ *   CoDel drops packets as they leave, by how long they've been
+ *   queued. Once packets have been leaving after more than the target
+ *   for a whole interval, it drops one, then drops more often, the
+ *   interval over the square root of the drops so far, until a packet
+ *   gets through under the target. The standard 5ms target is less
+ *   than a large frame takes to send on CNET's links, so by default
+ *   the target is the time to send the largest packet that's left the
+ *   queue so far, and the interval four of those plus the link's
+ *   round trip, with the standard values as the least they can be.
+ *
+ *   Each link can have its own mode. Only packets being forwarded are
+ *   dropped, the node's own messages are already held back by the
+ *   link's high water mark, and routing packets are never dropped.
+ */
+
+#ifndef AQM_H_
+#define AQM_H_
+
+#include <cnet.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "config.h"
+#include "network_layer.h"
+
+// CoDel's standard target and interval, the least they can be.
+#define CODEL_TARGET 5000
+#define CODEL_INTERVAL 100000
+
+// AQM state for a link's queue.
+struct Aqm {
+  enum AqmMode mode;
+
+  // RED: average queue length, in 1/256ths of a packet, and packets
+  // let through since the last drop.
+  long red_average;
+  long red_count;
+
+  // Link's bandwidth and propagation delay, and the largest packet
+  // taken off the queue, for the default CoDel target and interval.
+  int64_t bandwidth;
+  CnetTime propagation_delay;
+  size_t largest_packet;
+
+  // CoDel: when packets have been over the target for an interval,
+  // whether it's dropping, when the next drop is due, and how many
+  // drops since it started dropping, and when it last started.
+  CnetTime target;
+  CnetTime interval;
+  CnetTime first_above_time;
+  bool dropping;
+  CnetTime drop_next;
+  int count;
+  int last_count;
+};
+
+/*
+ * Setup AQM
+ *
+ * Sets the link's AQM up with its mode from the config, with nothing
+ * seen yet.
+ *
+ * link - Link whose queue it is.
+ */
+void setup_aqm(struct Aqm *const aqm, const int link);
+
+/*
+ * AQM applies
+ *
+ * Whether the packet can be dropped early, a data packet from another
+ * node.
+ */
+bool aqm_applies(const struct Packet *const packet);
+
+/*
+ * AQM drop arrival
+ *
+ * Whether RED drops a packet arriving at the queue.
+ *
+ * queued - Packets already in the queue.
+ */
+bool aqm_drop_arrival(struct Aqm *const aqm, const size_t queued);
+
+/*
+ * AQM drop departure
+ *
+ * Whether CoDel drops a packet just taken off the queue. If it does,
+ * the next one should be asked about in turn.
+ *
+ * sojourn - How long the packet was queued, in usecs.
+ * size - Size of the packet on the wire.
+ * queued - Packets left in the queue.
+ */
+bool aqm_drop_departure(struct Aqm *const aqm, const CnetTime sojourn,
+                        const size_t size, const size_t queued);
+
+#endif
@@ -6,31 +6,80 @@
 
 #include <cnet.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "application_layer.h"
+#include "checksum.h"
+#include "config.h"
 #include "data_link_layer.h"
+#include "fragment.h"
+#include "frame_buffer.h"
+#include "latency.h"
+#include "log.h"
 #include "physical_layer.h"
+#include "routing.h"
+#include "stats.h"
+#include "transport_layer.h"
+#include "wire.h"
 
 EVENT_HANDLER(draw_frame);
 EVENT_HANDLER(showstate);
+EVENT_HANDLER(shutdown_node);
 
+/*
+ * Reboot node
+ *
+ * Any command line arguments after the topology file are passed in
+ * through data, these are the protocol options (see config.h).
+ */
 EVENT_HANDLER(reboot_node) {
+  parse_config((char **)data);
+  init_log();
+  init_checksum();
+  init_frame_buffers();
+  init_stats();
+  init_latency();
   init_data_link_layer();
+  init_transport_layer();
+  init_fragments();
 
   CHECK(CNET_set_handler(EV_APPLICATIONREADY, application_ready, 0));
   CHECK(CNET_set_handler(EV_PHYSICALREADY, physical_ready, 0));
   CHECK(CNET_set_handler(EV_TIMER1, timeouts, 0));
+  CHECK(CNET_set_handler(EV_TIMER2, ack_timeouts, 0));
   CHECK(CNET_set_handler(EV_DEBUG0, showstate, 0));
   CHECK(CNET_set_debug_string(EV_DEBUG0, "Show status"));
   CHECK(CNET_set_handler(EV_DRAWFRAME, draw_frame, 0));
+  CHECK(CNET_set_handler(EV_TIMER3, routing_timeouts, 0));
+  CHECK(CNET_set_handler(EV_TIMER4, transport_timeouts, 0));
+  CHECK(CNET_set_handler(EV_TIMER5, reassembly_timeouts, 0));
+  CHECK(CNET_set_handler(EV_SHUTDOWN, shutdown_node, 0));
 
-  // Start the traffic
-  CNET_enable_application(ALLNODES);
+  /*
+   * Start the routing, the application is turned on for each
+   * destination as a route to it is found.
+   */
+  init_routing();
 }
 
 EVENT_HANDLER(draw_frame) {
   CnetDrawFrame *draw_frame = (CnetDrawFrame *)data;
-  struct Frame *frame = (struct Frame *)draw_frame->frame;
+
+  // The frame is as it is on the wire, so it has to be unpacked into
+  // a frame of our own first. Too big for the stack.
+  static struct FrameBuffer unpacked;
+  struct Frame *frame = &unpacked.frame;
+  const size_t length = (draw_frame->len < sizeof(struct Message) +
+                         MAX_WIRE_TRAILER_SIZE) ?
+      draw_frame->len : sizeof(struct Message) + MAX_WIRE_TRAILER_SIZE;
+
+  memcpy(wire_bytes(frame), draw_frame->frame, length);
+
+  if (!decode_frame(frame, length)) {
+    draw_frame->nfields = 1;
+    sprintf(draw_frame->text, "Unknown");
+    return;
+  }
 
   draw_frame->colours[0] = (frame->sequence == 0) ? "red" : "purple";
   draw_frame->pixels[0] = 20;
@@ -40,13 +89,51 @@ EVENT_HANDLER(draw_frame) {
       draw_frame->nfields = 1;
       sprintf(draw_frame->text, "A:%d", frame->sequence);
       break;
+    case DL_PARITY:
+      draw_frame->nfields = 1;
+      draw_frame->colours[0] = "orange";
+      sprintf(draw_frame->text, "P:%d", frame->fec_group);
+      break;
     case DL_DATA:
+      if (frame->packet.type == PACKET_ROUTING) {
+        draw_frame->nfields = 1;
+        sprintf(draw_frame->text, "Route, D:%d", frame->sequence);
+        break;
+      }
+
+      if (frame->packet.type == PACKET_ACK) {
+        draw_frame->nfields = 1;
+        sprintf(draw_frame->text, "Dst:%d, D:%d, TA:%u",
+                frame->packet.destination_address, frame->sequence,
+                (unsigned) frame->packet.sequence);
+        break;
+      }
+
       draw_frame->nfields = 2;
       draw_frame->colours[1] = "green";
       draw_frame->pixels[1] = 60;
-      sprintf(draw_frame->text, "Dst:%d, D:%d",
-              frame->packet.destination_address,
-              frame->sequence);
+
+      if (frame->ack != NO_ACK) {
+        sprintf(draw_frame->text, "Dst:%d, D:%d, A:%d",
+                frame->packet.destination_address,
+                frame->sequence,
+                frame->ack);
+      } else {
+        sprintf(draw_frame->text, "Dst:%d, D:%d",
+                frame->packet.destination_address,
+                frame->sequence);
+      }
+
+      if (frame->packet.fragment) {
+        sprintf(draw_frame->text + strlen(draw_frame->text), ", F:%u",
+                (unsigned) frame->packet.fragment_offset);
+      }
+
+      // Aggregated, only the first packet's destination is shown.
+      if (frame->packet_count > 1) {
+        sprintf(draw_frame->text + strlen(draw_frame->text), " (x%d)",
+                frame->packet_count);
+      }
       break;
     default:
       draw_frame->nfields = 1;
@@ -55,5 +142,19 @@ EVENT_HANDLER(draw_frame) {
 }
 
 EVENT_HANDLER(showstate) {
+  // Anything logged so far comes before the tables.
+  flush_log();
+
   debug_data_link_layer();
+  debug_transport_layer();
+  debug_fragments();
+  debug_frame_buffers();
+  debug_routing();
+  debug_stats();
+  debug_latency();
+}
+
+EVENT_HANDLER(shutdown_node) {
+  flush_log();
+  write_stats();
 }
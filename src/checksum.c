@@ -0,0 +1,292 @@
+/*
+ * CC200 Assignment
+ *
+ * Author: Mike Aldred
+ *
+ * Checksums
+ *
+ * Description:
+ *   Look at the header file for details.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "checksum.h"
+#include "config.h"
+
+// Reversed polynomials, both CRCs work from the low bit up.
+#define CRC32_POLYNOMIAL 0xedb88320u
+#define CRC32C_POLYNOMIAL 0x82f63b78u
+
+/*
+ * The SSE4.2 crc32 instruction only does CRC-32C. It's compiled in
+ * for any x86 gcc, but only used if the CPU turns out to have it.
+ */
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_SSE42_CRC32C 1
+#include <nmmintrin.h>
+#endif
+
+/*
+ * Slice-by-8 reads eight bytes as two little endian words. On
+ * anything else the tables are only used a byte at a time.
+ */
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define HAVE_SLICE_BY_8 1
+#endif
+
+typedef uint32_t (*CrcUpdate)(uint32_t, const unsigned char *, size_t);
+
+/*
+ * Entry [0] is the usual byte at a time table. Entry [k] is the CRC
+ * of a byte followed by k zero bytes, so eight bytes can be looked up
+ * at once and combined.
+ */
+static uint32_t crc32_tables[8][256];
+static uint32_t crc32c_tables[8][256];
+static bool tables_built = false;
+
+static CrcUpdate crc32c_best = NULL;
+
+// Forward declarations
+static void build_tables(uint32_t tables[8][256], const uint32_t polynomial);
+static uint32_t slice_by_8(const uint32_t tables[8][256], uint32_t crc,
+                           const unsigned char *data, size_t length);
+static uint32_t crc32c_tables_update(uint32_t crc, const unsigned char *data,
+                                     size_t length);
+#ifdef HAVE_SSE42_CRC32C
+static uint32_t crc32c_sse42_update(uint32_t crc, const unsigned char *data,
+                                    size_t length);
+#endif
+
+/*
+ * Init checksum
+ *
+ * Check header file for details.
+ *
+ * Globals:
+ *   crc32_tables, crc32c_tables - Built, the first time.
+ *   crc32c_best - The SSE4.2 version if the CPU has it.
+ */
+void init_checksum() {
+  if (!tables_built) {
+    build_tables(crc32_tables, CRC32_POLYNOMIAL);
+    build_tables(crc32c_tables, CRC32C_POLYNOMIAL);
+    tables_built = true;
+  }
+
+  crc32c_best = crc32c_tables_update;
+
+#ifdef HAVE_SSE42_CRC32C
+  if (__builtin_cpu_supports("sse4.2")) {
+    crc32c_best = crc32c_sse42_update;
+  }
+#endif
+}
+
+/*
+ * Checksum frame
+ *
+ * Check header file for details.
+ */
+uint32_t checksum_frame(const void *const frame, const size_t length,
+                        const size_t checksum_offset) {
+  const unsigned char *bytes = (const unsigned char *) frame;
+  const uint32_t zero = 0;
+
+  // Too short to have a checksum field, so just do all of it.
+  if (checksum_offset + sizeof(zero) > length) {
+    if (config.checksum_mode == CHECKSUM_CNET) {
+      return CNET_crc32((unsigned char *) bytes, (int) length);
+    }
+
+    return (config.checksum_mode == CHECKSUM_CRC32) ?
+        ~crc32_update(~0u, bytes, length) :
+        ~crc32c_update(~0u, bytes, length);
+  }
+
+  const unsigned char *after = bytes + checksum_offset + sizeof(zero);
+  const size_t after_length = length - checksum_offset - sizeof(zero);
+  uint32_t crc;
+
+  switch (config.checksum_mode) {
+    case CHECKSUM_CNET: {
+      // CNET_crc32 only does a whole buffer, so the field has to be
+      // zero while it's worked out.
+      unsigned char *field = (unsigned char *) bytes + checksum_offset;
+      uint32_t saved;
+
+      memcpy(&saved, field, sizeof(saved));
+      memcpy(field, &zero, sizeof(zero));
+      crc = CNET_crc32((unsigned char *) bytes, (int) length);
+      memcpy(field, &saved, sizeof(saved));
+      return crc;
+    }
+    case CHECKSUM_CRC32:
+      crc = crc32_update(~0u, bytes, checksum_offset);
+      crc = crc32_update(crc, &zero, sizeof(zero));
+      return ~crc32_update(crc, after, after_length);
+    default:
+      crc = crc32c_update(~0u, bytes, checksum_offset);
+      crc = crc32c_update(crc, &zero, sizeof(zero));
+      return ~crc32c_update(crc, after, after_length);
+  }
+}
+
+uint32_t crc32_update(uint32_t crc, const void *const data,
+                      const size_t length) {
+  if (!tables_built) {
+    init_checksum();
+  }
+
+  return slice_by_8(crc32_tables, crc, (const unsigned char *) data, length);
+}
+
+uint32_t crc32c_update(uint32_t crc, const void *const data,
+                       const size_t length) {
+  if (crc32c_best == NULL) {
+    init_checksum();
+  }
+
+  return crc32c_best(crc, (const unsigned char *) data, length);
+}
+
+uint32_t crc32c_portable_update(uint32_t crc, const void *const data,
+                                const size_t length) {
+  if (!tables_built) {
+    init_checksum();
+  }
+
+  return crc32c_tables_update(crc, (const unsigned char *) data, length);
+}
+
+const char *crc32c_implementation() {
+  if (crc32c_best == NULL) {
+    init_checksum();
+  }
+
+#ifdef HAVE_SSE42_CRC32C
+  if (crc32c_best == crc32c_sse42_update) {
+    return "sse4.2";
+  }
+#endif
+
+#ifdef HAVE_SLICE_BY_8
+  return "slice-by-8";
+#else
+  return "table";
+#endif
+}
+
+static void build_tables(uint32_t tables[8][256], const uint32_t polynomial) {
+  for (int i = 0; i < 256; ++i) {
+    uint32_t crc = i;
+
+    for (int bit = 0; bit < 8; ++bit) {
+      crc = (crc & 1) ? (crc >> 1) ^ polynomial : crc >> 1;
+    }
+    tables[0][i] = crc;
+  }
+
+  for (int i = 0; i < 256; ++i) {
+    for (int k = 1; k < 8; ++k) {
+      const uint32_t previous = tables[k - 1][i];
+
+      tables[k][i] = (previous >> 8) ^ tables[0][previous & 0xff];
+    }
+  }
+}
+
+/*
+ * Slice by 8
+ *
+ * A byte at a time until the data is 8 byte aligned, then 8 bytes at
+ * a time, eight table lookups each, then a byte at a time for what's
+ * left.
+ */
+static uint32_t slice_by_8(const uint32_t tables[8][256], uint32_t crc,
+                           const unsigned char *data, size_t length) {
+#ifdef HAVE_SLICE_BY_8
+  while (length > 0 && ((uintptr_t) data & 7) != 0) {
+    crc = tables[0][(crc ^ *data++) & 0xff] ^ (crc >> 8);
+    --length;
+  }
+
+  while (length >= 8) {
+    uint32_t low, high;
+
+    memcpy(&low, data, sizeof(low));
+    memcpy(&high, data + 4, sizeof(high));
+    low ^= crc;
+
+    crc = tables[7][low & 0xff] ^ tables[6][(low >> 8) & 0xff] ^
+        tables[5][(low >> 16) & 0xff] ^ tables[4][low >> 24] ^
+        tables[3][high & 0xff] ^ tables[2][(high >> 8) & 0xff] ^
+        tables[1][(high >> 16) & 0xff] ^ tables[0][high >> 24];
+
+    data += 8;
+    length -= 8;
+  }
+#endif
+
+  while (length > 0) {
+    crc = tables[0][(crc ^ *data++) & 0xff] ^ (crc >> 8);
+    --length;
+  }
+
+  return crc;
+}
+
+static uint32_t crc32c_tables_update(uint32_t crc, const unsigned char *data,
+                                     size_t length) {
+  return slice_by_8(crc32c_tables, crc, data, length);
+}
+
+#ifdef HAVE_SSE42_CRC32C
+/*
+ * CRC-32C SSE4.2 update
+ *
+ * The crc32 instruction, 8 bytes at a time (4 on 32 bit x86), once
+ * the data is aligned. Only called if the CPU has SSE4.2.
+ */
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_sse42_update(uint32_t crc, const unsigned char *data,
+                                    size_t length) {
+  while (length > 0 && ((uintptr_t) data & 7) != 0) {
+    crc = _mm_crc32_u8(crc, *data++);
+    --length;
+  }
+
+#ifdef __x86_64__
+  uint64_t wide = crc;
+
+  while (length >= 8) {
+    uint64_t word;
+
+    memcpy(&word, data, sizeof(word));
+    wide = _mm_crc32_u64(wide, word);
+    data += 8;
+    length -= 8;
+  }
+  crc = (uint32_t) wide;
+#endif
+
+  while (length >= 4) {
+    uint32_t word;
+
+    memcpy(&word, data, sizeof(word));
+    crc = _mm_crc32_u32(crc, word);
+    data += 4;
+    length -= 4;
+  }
+
+  while (length > 0) {
+    crc = _mm_crc32_u8(crc, *data++);
+    --length;
+  }
+
+  return crc;
+}
+#endif
@@ -0,0 +1,76 @@
+/*
+ * CC200 Assignment
+ *
+ * Author: Mike Aldred
+ *
+ * Checksums
+ *
+ * Description:
+ *
+ *   Frame checksums. Every frame is checksummed when it's sent, and
+ *   again when it arrives, and both used to go through CNET_crc32,
+ *   which works a byte at a time. The checksum option (see config.h)
+ *   picks the algorithm, every node has to use the same one:
+ *
+ *     cnet    CNET_crc32, as before.
+ *     crc32   The same CRC-32 (IEEE), eight bytes at a time with
+ *             slice-by-8 tables.
+ *     crc32c  CRC-32C (Castagnoli), using the SSE4.2 crc32
+ *             instruction when the CPU has it, and slice-by-8 tables
+ *             when it doesn't. The default.
+ *
+ *   The frame's own checksum field counts as zero when checksumming,
+ *   so the receiver can check a frame without having to clear the
+ *   field first.
+ */
+
+#ifndef CHECKSUM_H_
+#define CHECKSUM_H_
+
+#include <cnet.h>
+#include <stddef.h>
+
+/*
+ * Init checksum
+ *
+ * Builds the tables, and picks the fastest CRC-32C the CPU can do.
+ */
+void init_checksum();
+
+/*
+ * Checksum frame
+ *
+ * Checksums length bytes of the frame, with the algorithm from the
+ * config. The 4 byte checksum field at checksum_offset is taken to be
+ * zero, whatever's in it.
+ *
+ * The frame isn't changed, apart from with the cnet checksum, which
+ * can only do a whole buffer, so the field has to be cleared while
+ * it's worked out, then put back.
+ *
+ * frame - The frame.
+ * length - Size of the frame.
+ * checksum_offset - Where the frame's checksum field is.
+ *
+ * Returns the checksum.
+ */
+uint32_t checksum_frame(const void *const frame, const size_t length,
+                        const size_t checksum_offset);
+
+/*
+ * CRC-32 and CRC-32C update
+ *
+ * Add length bytes to a running CRC, which starts (and ends) inverted,
+ * i.e. crc = ~update(~0, data, length). crc32c_update is the fastest
+ * the CPU can do, crc32c_portable_update is always the tables, and
+ * crc32c_implementation names which crc32c_update is.
+ */
+uint32_t crc32_update(uint32_t crc, const void *const data,
+                      const size_t length);
+uint32_t crc32c_update(uint32_t crc, const void *const data,
+                       const size_t length);
+uint32_t crc32c_portable_update(uint32_t crc, const void *const data,
+                                const size_t length);
+const char *crc32c_implementation();
+
+#endif
@@ -0,0 +1,338 @@
+/*
+ * CC200 Assignment
+ *
+ * Author: Mike Aldred
+ *
+ * Configuration
+ *
+ * Description:
+ *   Look at the header file for details.
+ */
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "config.h"
+
+struct Config config;
+
+// Forward declarations
+static void set_defaults(struct Config *const options);
+static void parse_option(const char *const name, const char *const value);
+static void parse_aqm_modes(const char *const value);
+static int clamp(const int value, const int low, const int high);
+
+void parse_config(char **argv) {
+  set_defaults(&config);
+
+  for (int i = 0; argv != NULL && argv[i] != NULL; ++i) {
+    char name[32];
+    const char *equals = strchr(argv[i], '=');
+
+    if (equals == NULL || (size_t)(equals - argv[i]) >= sizeof(name)) {
+      printf("Ignoring argument: %s\n", argv[i]);
+      continue;
+    }
+
+    memcpy(name, argv[i], equals - argv[i]);
+    name[equals - argv[i]] = '\0';
+    parse_option(name, equals + 1);
+  }
+
+  // Stop and wait only ever has the one frame outstanding.
+  if (config.arq_mode == ARQ_STOP_AND_WAIT) {
+    config.window_size = 1;
+  }
+
+  // The water marks have to fit under the limit, in the right order.
+  if (config.queue_limit != 0 &&
+      config.queue_high_water > config.queue_limit) {
+    config.queue_high_water = config.queue_limit;
+  }
+
+  if (config.queue_low_water >= config.queue_high_water) {
+    config.queue_low_water = config.queue_high_water / 2;
+  }
+
+  // RED needs some room between its thresholds.
+  if (config.red_min >= config.red_max) {
+    config.red_min = config.red_max - 1;
+  }
+
+  // A message AQM drops is only sent again by the transport layer,
+  // without it the destination gets a gap and CNET stops.
+  if (!config.transport) {
+    for (int i = 0; i < config.aqm_mode_count; ++i) {
+      if (config.aqm_modes[i] != AQM_OFF) {
+        printf("AQM needs transport=on, turning transport on.\n");
+        config.transport = true;
+        break;
+      }
+    }
+  }
+
+  // Early forwarding needs gaps to forward past, and something to put
+  // the messages back in order.
+  if (config.cut_through &&
+      (config.arq_mode != ARQ_SELECTIVE_REPEAT || !config.transport)) {
+    printf("cutthrough only works with arq=sr and transport=on.\n");
+  }
+}
+
+/*
+ * Set defaults
+ *
+ * The defaults are the original stop and wait protocol. The window
+ * size only gets used if go back N or selective repeat is picked.
+ */
+static void set_defaults(struct Config *const options) {
+  options->arq_mode = ARQ_STOP_AND_WAIT;
+  options->window_size = 8;
+  options->ack_mode = ACK_IMMEDIATE;
+  options->ack_delay = 0;
+  options->rto_mode = RTO_ADAPTIVE;
+  options->queue_limit = DEFAULT_QUEUE_LIMIT;
+  options->queue_high_water = DEFAULT_QUEUE_HIGH_WATER;
+  options->queue_low_water = DEFAULT_QUEUE_LOW_WATER;
+  options->route_period = DEFAULT_ROUTE_PERIOD;
+  options->multipath_mode = MULTIPATH_OFF;
+  options->multipath_slack = 0;
+  options->stats_format = STATS_OFF;
+  options->stats_prefix = "stats-";
+  options->trace = false;
+  options->checksum_mode = CHECKSUM_CRC32C;
+  options->aggregate = false;
+  options->fec_mode = FEC_OFF;
+  options->fec_group = DEFAULT_FEC_GROUP;
+  options->fec_threshold = DEFAULT_FEC_THRESHOLD;
+  options->qos_mode = QOS_OFF;
+  options->qos_small = DEFAULT_QOS_SMALL;
+  options->qos_weight = DEFAULT_QOS_WEIGHT;
+  options->aqm_modes[0] = AQM_OFF;
+  options->aqm_mode_count = 1;
+  options->red_min = DEFAULT_RED_MIN;
+  options->red_max = DEFAULT_RED_MAX;
+  options->red_percent = DEFAULT_RED_PERCENT;
+  options->codel_target = 0;
+  options->codel_interval = 0;
+  options->transport = false;
+  options->transport_window = DEFAULT_TRANSPORT_WINDOW;
+  options->mtu = 0;
+  options->reassembly_slots = DEFAULT_REASSEMBLY_SLOTS;
+  options->reassembly_timeout = 0;
+  options->cut_through = false;
+}
+
+/*
+ * Parse option
+ *
+ * Takes a single name and value pair and updates the config.
+ */
+static void parse_option(const char *const name, const char *const value) {
+  if (strcmp(name, "arq") == 0) {
+    if (strcmp(value, "saw") == 0) {
+      config.arq_mode = ARQ_STOP_AND_WAIT;
+    } else if (strcmp(value, "gbn") == 0) {
+      config.arq_mode = ARQ_GO_BACK_N;
+    } else if (strcmp(value, "sr") == 0) {
+      config.arq_mode = ARQ_SELECTIVE_REPEAT;
+    } else {
+      printf("Unknown ARQ mode: %s\n", value);
+    }
+  } else if (strcmp(name, "window") == 0) {
+    config.window_size = clamp(atoi(value), 1, MAX_WINDOW_SIZE);
+  } else if (strcmp(name, "ack") == 0) {
+    if (strcmp(value, "immediate") == 0) {
+      config.ack_mode = ACK_IMMEDIATE;
+    } else if (strcmp(value, "delayed") == 0) {
+      config.ack_mode = ACK_DELAYED;
+    } else {
+      printf("Unknown ACK mode: %s\n", value);
+    }
+  } else if (strcmp(name, "ackdelay") == 0) {
+    config.ack_delay = atol(value);
+  } else if (strcmp(name, "rto") == 0) {
+    if (strcmp(value, "fixed") == 0) {
+      config.rto_mode = RTO_FIXED;
+    } else if (strcmp(value, "adaptive") == 0) {
+      config.rto_mode = RTO_ADAPTIVE;
+    } else {
+      printf("Unknown RTO mode: %s\n", value);
+    }
+  } else if (strcmp(name, "queuelimit") == 0) {
+    config.queue_limit = clamp(atoi(value), 0, INT_MAX);
+  } else if (strcmp(name, "highwater") == 0) {
+    config.queue_high_water = clamp(atoi(value), 1, INT_MAX);
+  } else if (strcmp(name, "lowwater") == 0) {
+    config.queue_low_water = clamp(atoi(value), 0, INT_MAX);
+  } else if (strcmp(name, "routeperiod") == 0) {
+    config.route_period = atol(value);
+
+    if (config.route_period <= 0) {
+      config.route_period = DEFAULT_ROUTE_PERIOD;
+    }
+  } else if (strcmp(name, "multipath") == 0) {
+    if (strcmp(value, "off") == 0) {
+      config.multipath_mode = MULTIPATH_OFF;
+    } else if (strcmp(value, "flow") == 0) {
+      config.multipath_mode = MULTIPATH_FLOW;
+    } else if (strcmp(value, "packet") == 0) {
+      config.multipath_mode = MULTIPATH_PACKET;
+    } else {
+      printf("Unknown multipath mode: %s\n", value);
+    }
+  } else if (strcmp(name, "multipathslack") == 0) {
+    config.multipath_slack = clamp(atoi(value), 0, 1000);
+  } else if (strcmp(name, "stats") == 0) {
+    if (strcmp(value, "off") == 0) {
+      config.stats_format = STATS_OFF;
+    } else if (strcmp(value, "csv") == 0) {
+      config.stats_format = STATS_CSV;
+    } else if (strcmp(value, "json") == 0) {
+      config.stats_format = STATS_JSON;
+    } else {
+      printf("Unknown stats format: %s\n", value);
+    }
+  } else if (strcmp(name, "statsprefix") == 0) {
+    // The arguments hang around for the whole run.
+    config.stats_prefix = value;
+  } else if (strcmp(name, "trace") == 0) {
+    if (strcmp(value, "on") == 0) {
+      config.trace = true;
+    } else if (strcmp(value, "off") == 0) {
+      config.trace = false;
+    } else {
+      printf("Unknown trace setting: %s\n", value);
+    }
+  } else if (strcmp(name, "checksum") == 0) {
+    if (strcmp(value, "cnet") == 0) {
+      config.checksum_mode = CHECKSUM_CNET;
+    } else if (strcmp(value, "crc32") == 0) {
+      config.checksum_mode = CHECKSUM_CRC32;
+    } else if (strcmp(value, "crc32c") == 0) {
+      config.checksum_mode = CHECKSUM_CRC32C;
+    } else {
+      printf("Unknown checksum: %s\n", value);
+    }
+  } else if (strcmp(name, "aggregate") == 0) {
+    if (strcmp(value, "on") == 0) {
+      config.aggregate = true;
+    } else if (strcmp(value, "off") == 0) {
+      config.aggregate = false;
+    } else {
+      printf("Unknown aggregate setting: %s\n", value);
+    }
+  } else if (strcmp(name, "fec") == 0) {
+    if (strcmp(value, "off") == 0) {
+      config.fec_mode = FEC_OFF;
+    } else if (strcmp(value, "on") == 0) {
+      config.fec_mode = FEC_ON;
+    } else if (strcmp(value, "auto") == 0) {
+      config.fec_mode = FEC_AUTO;
+    } else {
+      printf("Unknown FEC mode: %s\n", value);
+    }
+  } else if (strcmp(name, "fecgroup") == 0) {
+    config.fec_group = clamp(atoi(value), 1, MAX_FEC_GROUP);
+  } else if (strcmp(name, "fecthreshold") == 0) {
+    config.fec_threshold = clamp(atoi(value), 0, 100);
+  } else if (strcmp(name, "qos") == 0) {
+    if (strcmp(value, "off") == 0) {
+      config.qos_mode = QOS_OFF;
+    } else if (strcmp(value, "size") == 0) {
+      config.qos_mode = QOS_SIZE;
+    } else {
+      printf("Unknown QoS mode: %s\n", value);
+    }
+  } else if (strcmp(name, "qossmall") == 0) {
+    config.qos_small = clamp(atoi(value), 0, MAX_MESSAGE_SIZE);
+  } else if (strcmp(name, "qosweight") == 0) {
+    config.qos_weight = clamp(atoi(value), 1, MAX_QOS_WEIGHT);
+  } else if (strcmp(name, "aqm") == 0) {
+    parse_aqm_modes(value);
+  } else if (strcmp(name, "redmin") == 0) {
+    config.red_min = clamp(atoi(value), 0, INT_MAX);
+  } else if (strcmp(name, "redmax") == 0) {
+    config.red_max = clamp(atoi(value), 1, INT_MAX);
+  } else if (strcmp(name, "redpercent") == 0) {
+    config.red_percent = clamp(atoi(value), 0, 100);
+  } else if (strcmp(name, "codeltarget") == 0) {
+    config.codel_target = (atol(value) > 0) ? atol(value) : 0;
+  } else if (strcmp(name, "codelinterval") == 0) {
+    config.codel_interval = (atol(value) > 0) ? atol(value) : 0;
+  } else if (strcmp(name, "transport") == 0) {
+    if (strcmp(value, "on") == 0) {
+      config.transport = true;
+    } else if (strcmp(value, "off") == 0) {
+      config.transport = false;
+    } else {
+      printf("Unknown transport setting: %s\n", value);
+    }
+  } else if (strcmp(name, "transportwindow") == 0) {
+    config.transport_window = clamp(atoi(value), 1, MAX_TRANSPORT_WINDOW);
+  } else if (strcmp(name, "mtu") == 0) {
+    config.mtu = (atoi(value) > 0) ? atoi(value) : 0;
+
+    if (config.mtu > 0 && config.mtu < MIN_MTU) {
+      config.mtu = MIN_MTU;
+    }
+  } else if (strcmp(name, "reassembly") == 0) {
+    config.reassembly_slots = clamp(atoi(value), 1, MAX_REASSEMBLY_SLOTS);
+  } else if (strcmp(name, "reassemblytimeout") == 0) {
+    config.reassembly_timeout = (atol(value) > 0) ? atol(value) : 0;
+  } else if (strcmp(name, "cutthrough") == 0) {
+    if (strcmp(value, "on") == 0) {
+      config.cut_through = true;
+    } else if (strcmp(value, "off") == 0) {
+      config.cut_through = false;
+    } else {
+      printf("Unknown cutthrough setting: %s\n", value);
+    }
+  } else {
+    printf("Unknown option: %s\n", name);
+  }
+}
+
+/*
+ * Parse AQM modes
+ *
+ * A comma separated mode per link, in link order. Links past the end
+ * of the list get the last mode given, so a single mode is every
+ * link's.
+ */
+static void parse_aqm_modes(const char *const value) {
+  const char *mode = value;
+
+  config.aqm_mode_count = 0;
+
+  while (config.aqm_mode_count < MAX_AQM_LINKS) {
+    const size_t length = strcspn(mode, ",");
+    enum AqmMode *aqm_mode = &config.aqm_modes[config.aqm_mode_count++];
+
+    if (length == 3 && strncmp(mode, "off", length) == 0) {
+      *aqm_mode = AQM_OFF;
+    } else if (length == 3 && strncmp(mode, "red", length) == 0) {
+      *aqm_mode = AQM_RED;
+    } else if (length == 5 && strncmp(mode, "codel", length) == 0) {
+      *aqm_mode = AQM_CODEL;
+    } else {
+      printf("Unknown AQM mode: %.*s\n", (int) length, mode);
+      *aqm_mode = AQM_OFF;
+    }
+
+    if (mode[length] == '\0') {
+      break;
+    }
+    mode += length + 1;
+  }
+}
+
+static int clamp(const int value, const int low, const int high) {
+  if (value < low) {
+    return low;
+  }
+
+  return (value > high) ? high : value;
+}
@@ -0,0 +1,222 @@
+/*
+ * CC200 Assignment
+ *
+ * Author: Mike Aldred
+ *
+ * Configuration
+ *
+ * Description:
+ *
+ *   Protocol options that can be changed without recompiling. CNET
+ *   passes any command line arguments given after the topology file
+ *   through to reboot_node, these are parsed here as "name=value"
+ *   pairs, for example:
+ *
+ *     cnet ASSIGNMENT.MAP arq=sr window=8
+ *
+ *   Anything not given on the command line keeps its default, the
+ *   defaults give the original stop and wait behaviour, with
+ *   adaptive ACK timeouts.
+ */
+
+#ifndef CONFIG_H_
+#define CONFIG_H_
+
+#include <cnet.h>
+#include <stdbool.h>
+
+/*
+ * Which automatic repeat request scheme the data link layer uses.
+ *
+ * Stop and wait is really just go back N with a window of one, but
+ * it's kept as its own option so the window size doesn't have to be
+ * given as well.
+ */
+enum ArqMode {
+  ARQ_STOP_AND_WAIT,
+  ARQ_GO_BACK_N,
+  ARQ_SELECTIVE_REPEAT};
+
+/*
+ * When the receiver sends ACKs. Immediate sends an ACK frame for
+ * every DATA frame. Delayed holds onto the ACK for a short time, if a
+ * DATA frame goes out on the link in that time the ACK rides along
+ * with it, otherwise a single cumulative ACK frame is sent.
+ */
+enum AckMode {
+  ACK_IMMEDIATE,
+  ACK_DELAYED};
+
+/*
+ * How the data link layer times out waiting for ACKs. Fixed is a
+ * multiple of how long the frame takes to get across the link.
+ * Adaptive estimates the round trip time from the ACKs that come
+ * back, and backs off on repeated timeouts.
+ */
+enum RtoMode {
+  RTO_FIXED,
+  RTO_ADAPTIVE};
+
+/*
+ * How the network layer picks between links when a destination has
+ * more than one usable route. Off always uses the cheapest. Flow
+ * keeps each source and destination pair on the one link (so their
+ * packets stay in order), unless that link is congested. Packet
+ * sends each packet out on whichever link has the least queued.
+ */
+enum MultipathMode {
+  MULTIPATH_OFF,
+  MULTIPATH_FLOW,
+  MULTIPATH_PACKET};
+
+/*
+ * What the counters are written out as at shutdown, if at all.
+ */
+enum StatsFormat {
+  STATS_OFF,
+  STATS_CSV,
+  STATS_JSON};
+
+/*
+ * Which algorithm frames are checksummed with (see checksum.h). Every
+ * node has to use the same one.
+ */
+enum ChecksumMode {
+  CHECKSUM_CNET,
+  CHECKSUM_CRC32,
+  CHECKSUM_CRC32C};
+
+/*
+ * Forward error correction on DATA frames (see fec.h). On always sends
+ * parity frames, auto only on links where errors are being seen.
+ */
+enum FecMode {
+  FEC_OFF,
+  FEC_ON,
+  FEC_AUTO};
+
+/*
+ * How packets share a link (see packet_queue.h). Off is the one FIFO
+ * queue. Size gives each traffic class its own queue, routing packets,
+ * small messages and large ones sharing the link by deficit round
+ * robin.
+ */
+enum QosMode {
+  QOS_OFF,
+  QOS_SIZE};
+
+/*
+ * Active queue management on a link's queue (see aqm.h). RED drops
+ * packets as they arrive, more of them the longer the queue has been
+ * on average. CoDel drops them as they leave, once they've been
+ * spending too long in the queue.
+ */
+enum AqmMode {
+  AQM_OFF,
+  AQM_RED,
+  AQM_CODEL};
+
+// Largest window that can be asked for.
+#define MAX_WINDOW_SIZE 64
+
+// Largest transport congestion window, and the default.
+#define MAX_TRANSPORT_WINDOW 64
+#define DEFAULT_TRANSPORT_WINDOW 32
+
+/*
+ * Per link queue limits, in packets. Once a link's queue reaches the
+ * high water mark, the application stops generating messages for the
+ * destinations that are sent out on that link, until the queue drains
+ * back down to the low water mark. Packets that arrive when the queue
+ * is at its limit (i.e. forwarded packets) are dropped.
+ */
+#define DEFAULT_QUEUE_LIMIT 256
+#define DEFAULT_QUEUE_HIGH_WATER 64
+#define DEFAULT_QUEUE_LOW_WATER 16
+
+// Most DATA frames a parity frame can cover, and the defaults.
+#define MAX_FEC_GROUP 16
+#define DEFAULT_FEC_GROUP 4
+#define DEFAULT_FEC_THRESHOLD 2
+
+// Largest interactive message, and its share of a link against bulk.
+#define DEFAULT_QOS_SMALL 256
+#define DEFAULT_QOS_WEIGHT 4
+#define MAX_QOS_WEIGHT 64
+
+// Links that can be given their own AQM mode, the rest get the last.
+#define MAX_AQM_LINKS 16
+
+// RED's queue thresholds in packets, and drop chance at the top one.
+#define DEFAULT_RED_MIN 8
+#define DEFAULT_RED_MAX 32
+#define DEFAULT_RED_PERCENT 10
+
+/*
+ * Smallest MTU that can be asked for, and messages reassembling at
+ * once at a destination.
+ */
+#define MIN_MTU 128
+#define MAX_REASSEMBLY_SLOTS 64
+#define DEFAULT_REASSEMBLY_SLOTS 16
+
+// Least time between distance vectors on a link (see routing.h).
+#define DEFAULT_ROUTE_PERIOD 2000000
+
+struct Config {
+  enum ArqMode arq_mode;   // arq=saw|gbn|sr
+  int window_size;         // window=N, ignored for stop and wait.
+  enum AckMode ack_mode;   // ack=immediate|delayed
+  CnetTime ack_delay;      // ackdelay=usecs, 0 for half the link delay.
+  enum RtoMode rto_mode;   // rto=fixed|adaptive
+  int queue_limit;         // queuelimit=N, 0 for no limit.
+  int queue_high_water;    // highwater=N
+  int queue_low_water;     // lowwater=N
+  CnetTime route_period;   // routeperiod=usecs
+  enum MultipathMode multipath_mode;  // multipath=off|flow|packet
+  int multipath_slack;     // multipathslack=percent over the cheapest.
+  enum StatsFormat stats_format;  // stats=off|csv|json
+  const char *stats_prefix;       // statsprefix=path, put before nodename.
+  bool trace;              // trace=on|off, record each packet's route.
+  enum ChecksumMode checksum_mode;  // checksum=cnet|crc32|crc32c
+  bool aggregate;          // aggregate=on|off, small packets share frames.
+  enum FecMode fec_mode;   // fec=off|on|auto
+  int fec_group;           // fecgroup=N, DATA frames per parity frame.
+  int fec_threshold;       // fecthreshold=percent of frames in error.
+  enum QosMode qos_mode;   // qos=off|size
+  int qos_small;           // qossmall=bytes, largest interactive message.
+  int qos_weight;          // qosweight=N, interactive's share to bulk's.
+
+  // aqm=mode[,mode...], off|red|codel for link 1, link 2 and so on.
+  enum AqmMode aqm_modes[MAX_AQM_LINKS];
+  int aqm_mode_count;
+  int red_min;             // redmin=packets, average depth drops start.
+  int red_max;             // redmax=packets, average depth all drop.
+  int red_percent;         // redpercent=drop chance at redmax.
+  CnetTime codel_target;   // codeltarget=usecs, 0 for from the link.
+  CnetTime codel_interval; // codelinterval=usecs, 0 for from the link.
+  bool transport;          // transport=on|off, end to end reliability.
+  int transport_window;    // transportwindow=N, largest congestion window.
+  int mtu;                 // mtu=bytes, 0 for each link's own.
+  int reassembly_slots;    // reassembly=N, messages reassembling at once.
+  CnetTime reassembly_timeout;  // reassemblytimeout=usecs, 0 for from the link.
+  bool cut_through;        // cutthrough=on|off, forward past SR gaps.
+};
+
+/*
+ * The options for this node, only valid after parse_config has been
+ * called.
+ */
+extern struct Config config;
+
+/*
+ * Parse config
+ *
+ * Sets up the config from the arguments CNET gives reboot_node. Any
+ * argument that isn't recognised is reported and ignored.
+ *
+ * argv - NULL terminated argument list, can be NULL.
+ */
+void parse_config(char **argv);
+
+#endif
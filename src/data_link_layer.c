@@ -6,69 +6,270 @@
  * Data link layer.
  */
 
+#include <assert.h>
 #include <cnet.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
+#include "aqm.h"
+#include "checksum.h"
+#include "config.h"
 #include "data_link_layer.h"
+#include "fec.h"
+#include "frame_buffer.h"
+#include "log.h"
 #include "packet_queue.h"
 #include "physical_layer.h"
+#include "stats.h"
+#include "wire.h"
 
 /*
- * To save from dynamically allocating memory for the ack, next frame,
- * and frame expected sequence information, just use a static array.
- * Just allocate the max and leave the others unused.
+ * The link states are lined up on cache lines, so the hot fields at
+ * the front of each one don't share a line with the link before it.
+ * Padded out by the aligned attribute on struct LinkState.
  */
-#define MAX_NO_LINKS 4
+#define CACHE_LINE_SIZE 64
 
 /*
- * Each link keeps track of a timer for ACK timeouts, if we receive
- * the correct ACK, then we remove the timer.
+ * The timer data has to carry both the link and the sequence number
+ * of the frame the timer is for, so pack them together.
  */
-static CnetTimerID timers[MAX_NO_LINKS] = {NULLTIMER,
-                                           NULLTIMER,
-                                           NULLTIMER,
-                                           NULLTIMER};
+#define TIMER_DATA(link, sequence) (((CnetData)(link) << 16) | (sequence))
+#define TIMER_LINK(data) ((int)((data) >> 16))
+#define TIMER_SEQUENCE(data) ((int)((data) & 0xffff))
 
-static int ack_expected[MAX_NO_LINKS] = {0,0,0,0};
-static int next_frame_to_send[MAX_NO_LINKS] = {0,0,0,0};
-static int frame_expected[MAX_NO_LINKS] = {0,0,0,0};
+/*
+ * Adaptive timeouts. Each timeout in a row of the oldest frame in the
+ * window doubles the ACK timeout, up to this many times the estimate,
+ * a bit under a minute on the slowest links. The variance term is never
+ * allowed below the minimum, so a run of identical round trips
+ * doesn't leave the timeout sitting right on the round trip time.
+ */
+#define MAX_TIMEOUT_BACKOFF 8
+#define MIN_RTT_VARIANCE 1000
+
+/*
+ * Sequence numbers run from 0 to sequence_space - 1. Go back N needs
+ * one more sequence number than the window size, selective repeat
+ * needs twice the window so the sender and receiver windows can't
+ * overlap. Stop and wait is go back N with a window of one, which
+ * gives the usual alternating bit.
+ */
+static int sequence_space = 2;
 
 /*
- * We have to hold the last frame sent out on a link, we do this so we
- * can retransmit it if we don't receive an ACK before the timer runs
- * out.
+ * Number of slots in each window. Selective repeat only ever has a
+ * window's worth of frames on the go, but the go back N frames are
+ * consecutive in a sequence space of one more than the window, so it
+ * needs a slot per sequence number to stop them colliding.
  */
-static struct Frame outgoing_frame[MAX_NO_LINKS];
+static int window_slots = 2;
 
 /*
- * Outgoing packet queue, packets are placed in a FIFO queue until the
- * link is free to send (i.e. we're not waiting on an ACK).
+ * Everything kept for one sequence number in a link's window, sending
+ * and receiving.
  */
-static struct PacketQueue packet_queue[MAX_NO_LINKS];
+struct WindowSlot {
+  /*
+   * We have to hold every frame sent out on a link that hasn't been
+   * ACKed, we do this so we can retransmit it if we don't receive an
+   * ACK before the timer runs out. The buffer is released once the
+   * frame is ACKed.
+   */
+  struct FrameBuffer *outgoing_frame;
+
+  /*
+   * When the frame was first sent, and if it's been sent more than
+   * once. Round trip times are only measured from frames that were
+   * sent once, otherwise we can't tell which copy the ACK was for
+   * (Karn's algorithm).
+   */
+  CnetTime send_time;
+
+  // ACK timer for the frame, removed when the ACK turns up.
+  CnetTimerID timer;
+  bool retransmitted;
+
+  /*
+   * Selective repeat only. The sender needs to know which frames in
+   * the window have been ACKed out of order, and the receiver buffers
+   * frames that arrive ahead of the one it's expecting.
+   */
+  bool frame_acked;
+  bool frame_arrived;
+  struct FrameBuffer *incoming_frame;
+};
+
+/*
+ * State for a link. Everything touched for each frame sent or
+ * received is at the front, so it fits in the link's first cache
+ * line. The queue comes after.
+ */
+struct LinkState {
+  int ack_expected;
+  int next_frame_to_send;
+  int frame_expected;
+
+  // Number of frames sent, but not ACKed yet.
+  int frames_buffered;
+
+  /*
+   * A link is congested once its queue reaches the high water mark,
+   * and stays that way until it drains to the low water mark.
+   */
+  bool congested;
+
+  /*
+   * Delayed ACKs. When a link has an ACK waiting to go out, the timer
+   * is running for how long we're willing to hold onto it.
+   */
+  bool ack_pending;
+  CnetTimerID ack_timer;
+
+  // window_slots long, indexed by slot(sequence number).
+  struct WindowSlot *window;
+
+  /*
+   * Round trip time estimate in usecs, smoothed the Jacobson way. A
+   * smoothed RTT of 0 means there's no estimate yet.
+   */
+  CnetTime smoothed_rtt;
+  CnetTime rtt_variance;
+  int timeout_backoff;
+
+  /*
+   * Outgoing packet queue, packets are placed in a queue for their
+   * traffic class until the link is free to send (i.e. the window
+   * isn't full), see packet_queue.h.
+   */
+  struct ClassQueue queue;
+
+  // Fragments a full sized message takes on the link, the queue limits
+  // are multiplied by it.
+  size_t queue_scale;
+
+  // Early drops from the queue, see aqm.h.
+  struct Aqm aqm;
+
+  // Counters for the link, owned by the stats module.
+  struct LinkStats *stats;
+
+  // Parity groups going each way, NULL with fec=off.
+  struct FecLink *fec;
+} __attribute__((aligned(CACHE_LINE_SIZE)));
+
+/*
+ * One state per link on the node, sized from nodeinfo.nlinks when the
+ * data link layer is set up. Link n is links[n - 1]. The memory is
+ * allocated a cache line over, so the array can be started on a line
+ * boundary, link_memory is what gets freed.
+ */
+static struct LinkState *links = NULL;
+static void *link_memory = NULL;
+static int link_count = 0;
 
 // Forward declarations
 static void process_ack(const struct Frame *in_frame,
-                        const CnetTimerID last_timer,
                         const int in_link);
-static void process_data(const struct Frame *const in_frame,
+static bool acknowledge(struct LinkState *const state,
+                        const int sequence_no,
+                        const bool cumulative);
+static void process_data(struct FrameBuffer *const in_buffer,
+                         const int in_link);
+static void process_selective_data(struct FrameBuffer *const in_buffer,
+                                   const int in_link);
+static void process_parity(struct FrameBuffer *const in_buffer,
+                           const int in_link);
+static void pass_up(struct FrameBuffer *const in_buffer, const int in_link);
+static void pack_packets(const int out_link, struct FrameBuffer *const buffer,
+                         const int sequence_no);
+static void transmit_data(const int out_link, const int sequence_no);
+static void transmit_ack(const int out_link, const int sequence_no);
+static void schedule_ack(const int out_link, const int sequence_no);
+static void clear_pending_ack(struct LinkState *const state);
+static int cumulative_ack(const struct LinkState *const state);
+static void transmit_frame(const int out_link, struct Frame *const frame);
+static void add_to_parity(const int out_link, struct Frame *const frame);
+static void transmit_parity(const int out_link);
+static void flush_parity(const int out_link);
+static size_t frame_limit(const int link);
+static void send_off_queued_packets(const int out_link);
+static void send_in_window(const int out_link,
+                           struct FrameBuffer *const buffer);
+static bool forward_early(const struct FrameBuffer *const in_buffer);
+static bool refuse_frame(struct FrameBuffer *const in_buffer,
                          const int in_link);
-static void transmit_frame(const int out_link,
-                           const enum FrameType type,
-                           const int sequence_no);
-static void send_off_queued_packet(const int out_link);
+static void count_forwarded(struct LinkState *const state,
+                            const struct FrameBuffer *const buffer);
+static struct FrameBuffer *next_to_send(struct LinkState *const state);
+static void check_congestion(const int out_link);
+static size_t queue_scale(const int link);
 static size_t frame_size(const struct Frame *const frame);
+static int increment(const int sequence_no);
+static bool between(const int low, const int sequence_no, const int high);
+static int slot(const int sequence_no);
+static void allocate_links(const int count);
+static void free_links();
+static void update_rtt(struct LinkState *const state, const int sequence_no);
+static CnetTime ack_timeout(const int out_link,
+                            const struct Frame *const frame);
 
 /*
  * Init data link layer
  *
- * Here we allocate and initialise our structures for the data link,
- * the packet queue is the only dynamically allocated structure we
- * use.
+ * Here we allocate and initialise our structures for the data link.
+ * There's a link state for every link the node has, and the windows
+ * and the packet queues are dynamically allocated, since the window
+ * size isn't known until the config has been read.
+ *
+ * Any frame buffers held from before a reboot are forgotten about,
+ * init_frame_buffers takes care of putting them back in the pool.
+ *
+ * Globals:
+ *   links - Reallocated, one per link on the node.
  */
 void init_data_link_layer() {
-  for (int i = 0; i < nodeinfo.nlinks; ++i) {
-    setup_queue(&packet_queue[i]);
+  sequence_space = (config.arq_mode == ARQ_SELECTIVE_REPEAT) ?
+      2 * config.window_size : config.window_size + 1;
+  window_slots = (config.arq_mode == ARQ_SELECTIVE_REPEAT) ?
+      config.window_size : sequence_space;
+
+  free_links();
+  allocate_links(nodeinfo.nlinks);
+
+  for (int i = 0; i < link_count; ++i) {
+    struct LinkState *state = &links[i];
+
+    state->queue_scale = queue_scale(i + 1);
+    setup_class_queue(&state->queue, config.queue_limit * state->queue_scale);
+    setup_aqm(&state->aqm, i + 1);
+    state->ack_timer = NULLTIMER;
+    state->timeout_backoff = 1;
+    state->stats = link_stats(i + 1);
+
+    state->window = (struct WindowSlot *)calloc(window_slots,
+                                                sizeof(struct WindowSlot));
+
+    // If we can't allocate memory for this, it's a serious problem
+    // can't recover from.
+    assert(state->window);
+
+    for (int j = 0; j < window_slots; ++j) {
+      state->window[j].timer = NULLTIMER;
+    }
+
+    if (config.fec_mode != FEC_OFF) {
+      state->fec = (struct FecLink *)calloc(1, sizeof(struct FecLink));
+
+      // If we can't allocate memory for this, it's a serious problem
+      // can't recover from.
+      assert(state->fec);
+
+      setup_fec_link(state->fec);
+    }
   }
 }
 
@@ -78,31 +279,71 @@ void init_data_link_layer() {
  * Check header file for details.
  */
 void up_to_datalink_from_physical(const int in_link,
-                                  struct Frame *in_frame,
+                                  struct FrameBuffer *const in_buffer,
                                   size_t frame_length) {
+  struct Frame *in_frame = &in_buffer->frame;
+  const unsigned char *wire = wire_bytes(in_frame);
+  struct LinkStats *stats = links[in_link - 1].stats;
+  struct FecLink *fec = links[in_link - 1].fec;
+  uint32_t in_checksum = 0;
 
-  // Checksum was calculated with the checksum field of 0. So save the
-  // incoming checksum first and clear the checksum so we can
-  // calculate it.
-  uint32_t in_checksum = in_frame->checksum;
-  in_frame->checksum = 0;
+  in_buffer->arrived_time = nodeinfo.time_in_usec;
 
-  // Check if the packet is corrupted.
-  if (CNET_crc32((void *) in_frame, frame_length) == in_checksum) {
+  if (frame_length >= WIRE_CHECKSUM_SIZE) {
+    memcpy(&in_checksum, wire + frame_length - WIRE_CHECKSUM_SIZE,
+           WIRE_CHECKSUM_SIZE);
+  }
+
+  // Check if the frame is corrupted, then unpack its header. The
+  // checksum was calculated with its own field counting as 0, so it
+  // can be checked in place.
+  if (frame_length >= WIRE_CHECKSUM_SIZE &&
+      checksum_frame(wire, frame_length,
+                     frame_length - WIRE_CHECKSUM_SIZE) == in_checksum &&
+      decode_frame(in_frame, frame_length)) {
     // Good checksum!
+    ++stats->frames_received;
+    stats->bytes_received += frame_length;
+
+    if (fec != NULL) {
+      fec_observe(fec, false);
+    }
+
     switch (in_frame->type) {
       case DL_ACK:
-        process_ack(in_frame, timers[in_link - 1], in_link);
+        process_ack(in_frame, in_link);
+        release_frame_buffer(in_buffer);
         break;
       case DL_DATA:
-        process_data(in_frame, in_link);
+        // The parity group has to have the frame before the buffer is
+        // handed on.
+        if (fec != NULL && in_frame->fec_group != NO_FEC_GROUP) {
+          if (fec->receive.group != in_frame->fec_group) {
+            fec_start_group(&fec->receive, in_frame->fec_group);
+          }
+          fec_add_frame(&fec->receive, wire, frame_length);
+        }
+
+        // Takes the buffer.
+        process_data(in_buffer, in_link);
+        break;
+      case DL_PARITY:
+        // Takes the buffer.
+        process_parity(in_buffer, in_link);
         break;
       default:
-        printf("Error: Unexpected frame type.\n");
+        LOG_ERROR("Unexpected frame type.\n");
+        release_frame_buffer(in_buffer);
     }
   } else {
     // Bad checksum, naughty checksum, go to bed.
-    printf("\t\t\t\tBAD checksum - frame ignored.\n");
+    LOG_DEBUG("BAD checksum on link %d - frame ignored.\n", in_link);
+    ++stats->checksum_failures;
+    release_frame_buffer(in_buffer);
+
+    if (fec != NULL) {
+      fec_observe(fec, true);
+    }
   }
 }
 
@@ -112,103 +353,391 @@ void up_to_datalink_from_physical(const int in_link,
  * Check header file for details.
  *
  * Globals:
- *   packet_queue - out_packet added to queue, and top most packet
- *                  sent if link free.
+ *   links - out_buffer added to the link's queue, and top most packets
+ *           sent while the window has room. Dropped count updated if
+ *           the queue is full.
+ *   config - Transport mode, without it nothing is dropped.
  */
 void down_to_datalink_from_network(const int out_link,
-                                   const struct Packet *const out_packet,
+                                   struct FrameBuffer *const out_buffer,
                                    const size_t length) {
-  add_to_queue(&packet_queue[out_link - 1], out_packet, length);
+  struct LinkState *state = &links[out_link - 1];
+
+  out_buffer->frame.length = length;
+  out_buffer->queued_time = nodeinfo.time_in_usec;
+
+  if (aqm_applies(&out_buffer->frame.packet) &&
+      aqm_drop_arrival(&state->aqm, class_queue_length(&state->queue))) {
+    ++state->stats->red_dropped;
+    release_frame_buffer(out_buffer);
+    return;
+  }
+
+  if (!add_to_class_queue(&state->queue, out_buffer, !config.transport)) {
+    LOG_WARN("Queue full on link %d, packet dropped.\n", out_link);
+    ++state->stats->packets_dropped;
+    release_frame_buffer(out_buffer);
+    return;
+  }
+
+  if (class_queue_length(&state->queue) > state->stats->queue_high_water) {
+    state->stats->queue_high_water = class_queue_length(&state->queue);
+  }
 
   /*
-   * If we're waiting on an ACK, we don't send the packet yet, we will
-   * send it when the ACK is received.
+   * If the window is full, we don't send the packet yet, we will
+   * send it when an ACK is received.
    */
-  if (ack_expected[out_link - 1] == next_frame_to_send[out_link - 1]) {
-    send_off_queued_packet(out_link);
+  send_off_queued_packets(out_link);
+}
+
+/*
+ * Drop queued routing
+ *
+ * Check header file for details.
+ *
+ * Globals:
+ *   links - Routing packets removed from the link's queue.
+ */
+void drop_queued_routing(const int out_link) {
+  struct LinkState *state = &links[out_link - 1];
+
+  if (drop_from_class_queue(&state->queue, PACKET_ROUTING) > 0) {
+    check_congestion(out_link);
   }
 }
 
+bool link_is_congested(const int link) {
+  return links[link - 1].congested;
+}
+
+size_t link_queue_room(const int link, const struct Packet *const packet) {
+  return class_queue_room(&links[link - 1].queue, packet);
+}
+
+CnetTime link_round_trip(const int link, const size_t length) {
+  return (CnetTime) length * 8000000 / linkinfo[link].bandwidth +
+      2 * linkinfo[link].propagationdelay;
+}
+
+size_t link_queue_depth(const int link) {
+  const struct LinkState *state = &links[link - 1];
+
+  return class_queue_length(&state->queue) + state->frames_buffered;
+}
+
 /*
  * The event handler that is called when a timer expires waiting for
- * an ACK. When the timer event fires, the number of the link is
- * passed in via the CNET data variable. Resend the frame again, and
- * setup a new timer.
+ * an ACK. The link and sequence number of the frame are passed in via
+ * the CNET data variable.
+ *
+ * Selective repeat only resends the frame that timed out. Go back N
+ * (and stop and wait) resends every frame in the window from the
+ * oldest unACKed one, since the receiver would have thrown away
+ * anything after a lost frame.
+ *
+ * With adaptive timeouts, the timeout for the link is doubled until
+ * an ACK for a frame that wasn't resent comes back. Only the oldest
+ * frame's timer doubles it, each frame in the window has its own
+ * timer, and several running out together is one loss of the link,
+ * not several.
  */
 EVENT_HANDLER(timeouts) {
-  int link_timeout = (int)data;
+  const int link_timeout = TIMER_LINK(data);
+  const int sequence_no = TIMER_SEQUENCE(data);
+  struct LinkState *state = &links[link_timeout - 1];
 
-  printf("Timeout, DATA(%d) out on link: %d\n",
-         ack_expected[link_timeout - 1], link_timeout);
+  state->window[slot(sequence_no)].timer = NULLTIMER;
+
+  LOG_DEBUG("Timeout, DATA(%d) out on link: %d\n", sequence_no, link_timeout);
+
+  if (sequence_no == state->ack_expected &&
+      state->timeout_backoff < MAX_TIMEOUT_BACKOFF) {
+    state->timeout_backoff *= 2;
+  }
 
-  transmit_frame(link_timeout, DL_DATA, ack_expected[link_timeout - 1]);
+  if (config.arq_mode == ARQ_SELECTIVE_REPEAT) {
+    state->window[slot(sequence_no)].retransmitted = true;
+    ++state->stats->retransmissions;
+    transmit_data(link_timeout, sequence_no);
+  } else {
+    for (int resend = state->ack_expected;
+         resend != state->next_frame_to_send;
+         resend = increment(resend)) {
+      state->window[slot(resend)].retransmitted = true;
+      ++state->stats->retransmissions;
+      transmit_data(link_timeout, resend);
+    }
+  }
+
+  flush_parity(link_timeout);
 }
 
 void debug_data_link_layer() {
   printf("Status for links.\n");
-  printf("+------+------------------+----------------+--------------------+\n");
-  printf("| Link | Ack Seq Expected | Next Frame Seq | Frame Seq Expected |\n");
-  printf("+------+------------------+----------------+--------------------+\n");
-  for (int current_link = 0; current_link < nodeinfo.nlinks; current_link++) {
-    printf("|  %d   |        %d         |        %d       |         %d          |\n",
+  printf("+------+------------------+----------------+--------------------+----------+\n");
+  printf("| Link | Ack Seq Expected | Next Frame Seq | Frame Seq Expected | Buffered |\n");
+  printf("+------+------------------+----------------+--------------------+----------+\n");
+  for (int current_link = 0; current_link < link_count; current_link++) {
+    const struct LinkState *state = &links[current_link];
+
+    printf("| %3d  |       %3d        |       %3d      |        %3d         |   %3d    |\n",
+           current_link + 1,
+           state->ack_expected,
+           state->next_frame_to_send,
+           state->frame_expected,
+           state->frames_buffered);
+    printf("+------+------------------+----------------+--------------------+----------+\n");
+  }
+
+  printf("Queues for links.\n");
+  printf("+------+--------+------------+---------+-----------+\n");
+  printf("| Link | Queued | High Water | Dropped | Congested |\n");
+  printf("+------+--------+------------+---------+-----------+\n");
+  for (int current_link = 0; current_link < link_count; current_link++) {
+    const struct LinkState *state = &links[current_link];
+
+    printf("| %3d  | %6zu |   %6zu   | %7llu |    %s    |\n",
+           current_link + 1,
+           class_queue_length(&state->queue),
+           state->queue.high_water,
+           state->stats->packets_dropped,
+           state->congested ? "yes" : "no ");
+    printf("+------+--------+------------+---------+-----------+\n");
+  }
+
+  /*
+   * Without delayed ACKs every DATA frame received gets its own ACK
+   * frame, so saved is how many of those we didn't have to send.
+   */
+  printf("ACK traffic for links.\n");
+  printf("+------+-----------+-----------+-------------+-------+\n");
+  printf("| Link | DATA Recv | ACKs Sent | Piggybacked | Saved |\n");
+  printf("+------+-----------+-----------+-------------+-------+\n");
+  for (int current_link = 0; current_link < link_count; current_link++) {
+    const struct LinkStats *stats = links[current_link].stats;
+    const unsigned long long received = stats->data_frames_received;
+    const int saved = (received == 0) ? 0 :
+        100 - (int)((100 * stats->ack_frames_sent) / received);
+
+    printf("| %3d  |  %7llu  |  %7llu  |   %7llu   |  %3d%% |\n",
            current_link + 1,
-           ack_expected[current_link],
-           next_frame_to_send[current_link],
-           frame_expected[current_link]);
-    printf("+------+------------------+----------------+--------------------+\n");
+           received,
+           stats->ack_frames_sent,
+           stats->acks_piggybacked,
+           saved);
+    printf("+------+-----------+-----------+-------------+-------+\n");
+  }
+
+  printf("ACK timeouts for links (usecs).\n");
+  printf("+------+------------+--------------+---------+-------------+\n");
+  printf("| Link | Smooth RTT | RTT Variance | Backoff | Retransmits |\n");
+  printf("+------+------------+--------------+---------+-------------+\n");
+  for (int current_link = 0; current_link < link_count; current_link++) {
+    const struct LinkState *state = &links[current_link];
+
+    printf("| %3d  | %10lld | %12lld |   %3d   |   %7llu   |\n",
+           current_link + 1,
+           (long long) state->smoothed_rtt,
+           (long long) state->rtt_variance,
+           state->timeout_backoff,
+           state->stats->retransmissions);
+    printf("+------+------------+--------------+---------+-------------+\n");
+  }
+
+  printf("AQM for links (usecs).\n");
+  printf("+------+-------+-----------+----------+----------+-------------+-------------+\n");
+  printf("| Link | Mode  | RED Depth | CoDel On | Target   | RED Dropped | CoDel Drops |\n");
+  printf("+------+-------+-----------+----------+----------+-------------+-------------+\n");
+  for (int current_link = 0; current_link < link_count; current_link++) {
+    const struct LinkState *state = &links[current_link];
+    const char *modes[] = {"off", "red", "codel"};
+
+    printf("| %3d  | %-5s | %9.1f |   %s    | %8lld |   %7llu   |   %7llu   |\n",
+           current_link + 1,
+           modes[state->aqm.mode],
+           state->aqm.red_average / 256.0,
+           state->aqm.dropping ? "yes" : "no ",
+           (long long) state->aqm.target,
+           state->stats->red_dropped,
+           state->stats->codel_dropped);
+    printf("+------+-------+-----------+----------+----------+-------------+-------------+\n");
+  }
+
+  if (config.fec_mode == FEC_OFF) {
+    return;
+  }
+
+  printf("FEC for links.\n");
+  printf("+------+--------+------------+--------+----------+\n");
+  printf("| Link | Active | Error Rate | Parity | Repaired |\n");
+  printf("+------+--------+------------+--------+----------+\n");
+  for (int current_link = 0; current_link < link_count; current_link++) {
+    const struct LinkState *state = &links[current_link];
+
+    printf("| %3d  |  %s   |   %5.1f%%   | %6llu |  %6llu  |\n",
+           current_link + 1,
+           state->fec->active ? "yes" : "no ",
+           100.0 * state->fec->error_rate / FEC_RATE_ONE,
+           state->stats->fec_parity_sent,
+           state->stats->fec_repaired);
+    printf("+------+--------+------------+--------+----------+\n");
+  }
+}
+
+/*
+ * The event handler for when an ACK has been held as long as it can
+ * be. The link is passed in via the CNET data variable.
+ */
+EVENT_HANDLER(ack_timeouts) {
+  const int ack_link = (int)data;
+  struct LinkState *state = &links[ack_link - 1];
+
+  state->ack_timer = NULLTIMER;
+
+  if (state->ack_pending) {
+    transmit_ack(ack_link, cumulative_ack(state));
   }
 }
 
 /*
- * Build and send frame.
+ * Send off queued packets
  *
- * Builds the frame up to be transmitted by the physical layer. The
- * data link layer keeps a copy of the last transmitted frame, because
- * the last frame will need to be transmitted if there's a timeout
- * waiting for an ACK.
+ * With the queue, when we are ready to send data, we always send off
+ * the first queued packet. Keep going until either the queue is
+ * empty or the window is full.
  *
- * This function takes care of that, however, beaware that this will
- * override the previous frame, so this function should only be called
- * if the node is not waiting for an ACK on the given link.
+ * The frame buffer for each packet goes from the queue into its slot
+ * in the window, which is kept around incase of retransmit.
  *
- * out_link - Link to send frame out on.
- * out_packet - Packet to be sent out.
- * length - Size of the packet passed in.
+ * out_link - Link which to check queue and send packets out on.
  *
  * Globals:
- *   outgoing_frame - Updated on corresponding link and transmitted.
+ *   links - Top packets removed from the link's queue and put in the
+ *           window slots, next_frame_to_send moved along for each.
  */
-static void build_and_send_frame(const int out_link,
-                                 const struct Packet *const out_packet,
-                                 const size_t length) {
-  // Build the frame
-  outgoing_frame[out_link - 1].length = length;
-  memcpy(&outgoing_frame[out_link - 1].packet, out_packet, length);
+static void send_off_queued_packets(const int out_link) {
+  struct LinkState *state = &links[out_link - 1];
+
+  while (state->frames_buffered < config.window_size) {
+    struct FrameBuffer *buffer = next_to_send(state);
 
-  // This is a static one as we need to keep a copy around incase of retransmit.
-  transmit_frame(out_link, DL_DATA, next_frame_to_send[out_link - 1]);
-  next_frame_to_send[out_link - 1] = 1 - next_frame_to_send[out_link - 1];
+    if (buffer == NULL) {
+      break;
+    }
+
+    send_in_window(out_link, buffer);
+  }
+
+  flush_parity(out_link);
+  check_congestion(out_link);
 }
 
 /*
- * Send off queued packet
+ * Send in window
  *
- * With the queue, when we are ready to send data, we always send off
- * the first queued packet.
+ * Puts the packet into the next slot in the window, as a frame with
+ * any other packets that are aggregated with it, and sends it.
  *
- * out_link - Link which to check queue and send packet out on.
+ * out_link - Link to send the frame out on, there has to be room in
+ *            its window.
+ * buffer - Buffer holding the packet, the window takes it.
  *
  * Globals:
- *   packet_queue - Top packet removed from queue.
+ *   links - Window slot filled, next_frame_to_send moved along.
  */
-static void send_off_queued_packet(const int out_link) {
-  struct Packet next_packet_to_send;
+static void send_in_window(const int out_link,
+                           struct FrameBuffer *const buffer) {
+  struct LinkState *state = &links[out_link - 1];
+  const int sequence_no = state->next_frame_to_send;
+  struct WindowSlot *window_slot = &state->window[slot(sequence_no)];
 
-  const size_t length = next_packet(&packet_queue[out_link - 1],
-                                    &next_packet_to_send);
+  count_forwarded(state, buffer);
+  pack_packets(out_link, buffer, sequence_no);
 
-  if (length != 0) {
-    build_and_send_frame(out_link, &next_packet_to_send, length);
+  window_slot->outgoing_frame = buffer;
+  window_slot->frame_acked = false;
+  window_slot->retransmitted = false;
+  window_slot->send_time = nodeinfo.time_in_usec;
+  ++state->frames_buffered;
+  state->next_frame_to_send = increment(sequence_no);
+
+  transmit_data(out_link, sequence_no);
+}
+
+/*
+ * Count forwarded
+ *
+ * For a packet from another node, counts how long it was at this node,
+ * from its frame arriving to it going into the window.
+ *
+ * Globals:
+ *   nodeinfo - This node's address, and the time now.
+ */
+static void count_forwarded(struct LinkState *const state,
+                            const struct FrameBuffer *const buffer) {
+  if (buffer->frame.packet.source_address != nodeinfo.address) {
+    record_forward_delay(state->stats,
+                         nodeinfo.time_in_usec - buffer->arrived_time);
+  }
+}
+
+/*
+ * Next to send
+ *
+ * Takes the next packet to go into the window off the link's queue,
+ * dropping any that CoDel wants dropped on the way, and counts its
+ * queueing delay. NULL if the queue's empty.
+ *
+ * Globals:
+ *   links - Packets removed from the state's queue, drops counted.
+ */
+static struct FrameBuffer *next_to_send(struct LinkState *const state) {
+  struct FrameBuffer *buffer;
+
+  while ((buffer = next_from_class_queue(&state->queue)) != NULL) {
+    const struct Packet *packet = &buffer->frame.packet;
+    const CnetTime sojourn = nodeinfo.time_in_usec - buffer->queued_time;
+
+    if (aqm_applies(packet) &&
+        aqm_drop_departure(&state->aqm, sojourn, wire_packet_size(packet),
+                           class_queue_length(&state->queue))) {
+      ++state->stats->codel_dropped;
+      release_frame_buffer(buffer);
+      continue;
+    }
+
+    record_queue_delay(state->stats, packet, sojourn);
+    break;
+  }
+
+  return buffer;
+}
+
+/*
+ * Check congestion
+ *
+ * Called whenever the queue for a link might have changed length.
+ * Lets the network layer know when the link becomes congested, or
+ * stops being congested, so it can throttle the application.
+ *
+ * out_link - Link to check.
+ *
+ * Globals:
+ *   links - Congested flag updated for the link.
+ */
+static void check_congestion(const int out_link) {
+  struct LinkState *state = &links[out_link - 1];
+  const size_t queued = class_queue_length(&state->queue);
+  const size_t high_water = config.queue_high_water * state->queue_scale;
+  const size_t low_water = config.queue_low_water * state->queue_scale;
+
+  if (!state->congested && queued >= high_water) {
+    state->congested = true;
+    datalink_congestion_changed(out_link, true);
+  } else if (state->congested && queued <= low_water) {
+    state->congested = false;
+    datalink_congestion_changed(out_link, false);
   }
 }
 
@@ -216,39 +745,112 @@ static void send_off_queued_packet(const int out_link) {
  * Process ACK
  *
  * Called when a node receives an ACK frame. Will check that the ACK
- * is the expected sequence number, if it is, great, the other node
- * got the data frame. If it isn't, then, it could mean that it just
- * took awhile for an ACK to get to us and we send a duped DATA frame.
+ * is for a frame in the window, if it is, great, the other node got
+ * the data frame. If it isn't, then, it could mean that it just took
+ * awhile for an ACK to get to us and we send a duped DATA frame.
+ *
+ * Go back N ACKs are cumulative, so everything up to and including
+ * the ACKed frame is done with. Selective repeat ACKs are for just the
+ * one frame, but also carry the receiver's cumulative ACK, which
+ * covers for any earlier ACKs that were lost.
  *
  * in_frame - ACK frame we've received.
- * last_timer - Matching timer for the link we received the ACK.
  * in_link - Link we received the ACK on.
  *
- * Globals:
- *   ack_expected - Updated to next sequence number.
- *
  * Assumed that frame has already had its checksum checked.
  */
 static void process_ack(const struct Frame *in_frame,
-                        const CnetTimerID last_timer,
                         const int in_link) {
+  struct LinkState *state = &links[in_link - 1];
+  bool in_window;
+
+  if (config.arq_mode == ARQ_SELECTIVE_REPEAT) {
+    in_window = (in_frame->ack != NO_ACK) &&
+        acknowledge(state, in_frame->ack, true);
+    in_window = acknowledge(state, in_frame->sequence, false) || in_window;
+  } else {
+    in_window = acknowledge(state, in_frame->sequence, true);
+  }
 
-  if (in_frame->sequence == ack_expected[in_link - 1]) {
-    // ACK sequence expected.
-    printf("\t\t\t\tACK received. Link: %d, sequence: %d.\n",
-           in_link, in_frame->sequence);
+  if (in_window) {
+    LOG_DEBUG("ACK received. Link: %d, sequence: %d.\n",
+              in_link, in_frame->sequence);
 
-    // Stop the timer so we don't send out a dup DATA frame.
-    CNET_stop_timer(last_timer);
-    ack_expected[in_link - 1] = 1 - ack_expected[in_link - 1];
+    // The window has room now, so try to send off more packets for
+    // that link.
+    send_off_queued_packets(in_link);
+  } else {
+    LOG_DEBUG("Incorrect ACK. Link: %d, sequence: %d, expected %d\n",
+              in_link, in_frame->sequence, state->ack_expected);
+    ++state->stats->out_of_order_acks;
+  }
+}
+
+/*
+ * Acknowledge
+ *
+ * Marks frames in the window as ACKed, then slides the window along
+ * past every frame that's been ACKed. Does nothing if the sequence
+ * number isn't in the window.
+ *
+ * state - State of the link the ACK is for.
+ * sequence_no - Sequence number ACKed.
+ * cumulative - True if every frame up to sequence_no is ACKed, false
+ *              if it's just the one frame.
+ *
+ * Returns true if the sequence number was in the window. The link's
+ * ack_expected is moved on to the oldest unACKed sequence number, and
+ * the timer stopped for every frame ACKed.
+ */
+static bool acknowledge(struct LinkState *const state,
+                        const int sequence_no,
+                        const bool cumulative) {
+  if (!between(state->ack_expected, sequence_no, state->next_frame_to_send)) {
+    return false;
+  }
+
+  update_rtt(state, sequence_no);
 
-    // Not waiting for ACK anymore, so try to send off another packet
-    // for that link.
-    send_off_queued_packet(in_link);
+  if (cumulative) {
+    for (int acked = state->ack_expected;
+         acked != increment(sequence_no);
+         acked = increment(acked)) {
+      state->window[slot(acked)].frame_acked = true;
+    }
   } else {
-    printf("\t\t\t\tIncorrect ACK. Link: %d, sequence: %d, expected %d\n",
-           in_link, in_frame->sequence, ack_expected[in_link - 1]);
+    state->window[slot(sequence_no)].frame_acked = true;
+  }
+
+  // Slide the window along past every frame that's been ACKed.
+  while (state->frames_buffered > 0 &&
+         state->window[slot(state->ack_expected)].frame_acked) {
+    struct WindowSlot *done = &state->window[slot(state->ack_expected)];
+
+    // Stop the timer so we don't send out a dup DATA frame.
+    if (done->timer != NULLTIMER) {
+      CNET_stop_timer(done->timer);
+      done->timer = NULLTIMER;
+    }
+
+    record_hop_latency(state->stats,
+                       nodeinfo.time_in_usec - done->send_time);
+    release_frame_buffer(done->outgoing_frame);
+    done->outgoing_frame = NULL;
+
+    done->frame_acked = false;
+    --state->frames_buffered;
+    state->ack_expected = increment(state->ack_expected);
+  }
+
+  // Selective repeat frames ACKed out of order don't need their
+  // timer anymore either.
+  struct WindowSlot *acked_slot = &state->window[slot(sequence_no)];
+  if (acked_slot->frame_acked && acked_slot->timer != NULLTIMER) {
+    CNET_stop_timer(acked_slot->timer);
+    acked_slot->timer = NULLTIMER;
   }
+
+  return true;
 }
 
 /*
@@ -256,102 +858,824 @@ static void process_ack(const struct Frame *in_frame,
  *
  * Called when a node receives a DATA frame.
  *
- * Check that the frame sequence matches the sequence number we're
- * expecting. If it does, great, pass it up for the network layer,
- * otherwise just ignore it.
+ * Go back N (and stop and wait) only accepts the frame it's
+ * expecting, anything else is ignored, and the ACK sent back is for
+ * the last frame received in order.
+ *
+ * Selective repeat accepts any frame that falls in the receive
+ * window, holding onto it until the frames before it turn up. Each
+ * frame gets its own ACK, even if it's a dup of one that's already
+ * been passed up, since the ACK for it might have been lost. Frames
+ * that aren't next in order are always ACKed straight away, delayed
+ * ACKs only hold back the cumulative ACK.
  *
- * Regardless, always send an ACK back with the same sequence number
- * so the node at the other end of the link knows we received it.
+ * Any ACK piggybacked on the frame is dealt with first.
  *
- * in_frame - Frame that's been received.
+ * The frame buffer is either passed up to the network layer, held
+ * until the frames before it turn up, or released.
+ *
+ * in_buffer - Frame that's been received.
  * in_link - Link that the frame came in on.
  *
  * Globals:
- *   frame_expected - Updated to new sequence number.
+ *   links - frame_expected updated to new sequence number, out of
+ *           order frames buffered in the window (selective repeat).
  */
-static void process_data(const struct Frame *const in_frame,
+static void process_data(struct FrameBuffer *const in_buffer,
                          const int in_link) {
-  if (in_frame->sequence == frame_expected[in_link - 1]) {
-    printf("\t\t\t\tDATA received. Link: %d, sequence: %d.\n",
-           in_link,
-           in_frame->sequence);
-
-    // Expected, switch to next frame seq number and send the packet
-    // in this frame up to the network layer.
-    frame_expected[in_link - 1] = 1 - frame_expected[in_link - 1];
-    datalink_up_to_network(&in_frame->packet);
+  const struct Frame *in_frame = &in_buffer->frame;
+  struct LinkState *state = &links[in_link - 1];
+  const int sequence_no = in_frame->sequence;
+  const bool window_moved = (in_frame->ack != NO_ACK) &&
+      acknowledge(state, in_frame->ack, true);
+
+  ++state->stats->data_frames_received;
+
+  if (config.arq_mode != ARQ_SELECTIVE_REPEAT) {
+    if (sequence_no == state->frame_expected) {
+      if (refuse_frame(in_buffer, in_link)) {
+        return;
+      }
+
+      LOG_DEBUG("DATA received. Link: %d, sequence: %d.\n",
+                in_link, sequence_no);
+
+      // Expected, switch to next frame seq number and send the packet
+      // in this frame up to the network layer. The ACK is scheduled
+      // first, so if the packet is forwarded straight back out on
+      // this link it can carry the ACK.
+      state->frame_expected = increment(state->frame_expected);
+      schedule_ack(in_link, cumulative_ack(state));
+      pass_up(in_buffer, in_link);
+    } else {
+      LOG_DEBUG("DATA ignored. Link: %d, sequence: %d, expected %d.\n",
+                in_link, sequence_no, state->frame_expected);
+      ++state->stats->duplicate_data;
+      release_frame_buffer(in_buffer);
+
+      // ACK is cumulative, the frame before the one we're expecting.
+      schedule_ack(in_link, cumulative_ack(state));
+    }
   } else {
-    printf("\t\t\t\tDATA received. Link: %d, sequence: %d, expected %d\n",
-           in_link, in_frame->sequence, frame_expected[in_link - 1]);
-    printf("\t\t\t\tIgnored\n");
+    process_selective_data(in_buffer, in_link);
   }
 
-  transmit_frame(in_link, DL_ACK, in_frame->sequence);
+  // Do this last, so any new DATA frames can carry the ACK for this
+  // one.
+  if (window_moved) {
+    send_off_queued_packets(in_link);
+  }
 }
 
 /*
- * Transmit frame
+ * Process selective data
+ *
+ * The selective repeat half of process_data.
+ */
+static void process_selective_data(struct FrameBuffer *const in_buffer,
+                                   const int in_link) {
+  struct LinkState *state = &links[in_link - 1];
+  const int sequence_no = in_buffer->frame.sequence;
+  struct WindowSlot *arrived = &state->window[slot(sequence_no)];
+
+  const int window_end = (state->frame_expected + config.window_size) %
+      sequence_space;
+
+  if (between(state->frame_expected, sequence_no, window_end) &&
+      !arrived->frame_arrived) {
+    if (refuse_frame(in_buffer, in_link)) {
+      return;
+    }
+
+    LOG_DEBUG("DATA received. Link: %d, sequence: %d.\n",
+              in_link, sequence_no);
+
+    arrived->incoming_frame = in_buffer;
+    arrived->frame_arrived = true;
+
+    if (sequence_no != state->frame_expected) {
+      // Out of order, let the sender know now. A packet that's only
+      // passing through can go on now, rather than wait for the gap.
+      transmit_ack(in_link, sequence_no);
+
+      if (forward_early(in_buffer)) {
+        ++state->stats->packets_forwarded_early;
+        arrived->incoming_frame = NULL;
+        pass_up(in_buffer, in_link);
+      }
+      return;
+    }
+
+    schedule_ack(in_link, sequence_no);
+
+    // Pass up everything that's now in order.
+    while (state->window[slot(state->frame_expected)].frame_arrived) {
+      struct WindowSlot *ready = &state->window[slot(state->frame_expected)];
+      struct FrameBuffer *ready_buffer = ready->incoming_frame;
+
+      ready->frame_arrived = false;
+      ready->incoming_frame = NULL;
+      state->frame_expected = increment(state->frame_expected);
+
+      // Already gone up if it was forwarded early.
+      if (ready_buffer != NULL) {
+        pass_up(ready_buffer, in_link);
+      }
+    }
+  } else {
+    LOG_DEBUG("DATA ignored. Link: %d, sequence: %d, expected %d.\n",
+              in_link, sequence_no, state->frame_expected);
+    ++state->stats->duplicate_data;
+    release_frame_buffer(in_buffer);
+
+    transmit_ack(in_link, sequence_no);
+  }
+}
+
+/*
+ * Forward early
+ *
+ * Whether a frame that's arrived ahead of a gap can go up now. Only
+ * with cutthrough=on and transport=on, where the destination puts
+ * messages back in order itself, and only a single packet for another
+ * node. Routing packets, and packets for this node, wait their turn.
+ *
+ * Globals:
+ *   config - Cut through and transport modes.
+ *   nodeinfo - This node's address.
+ */
+static bool forward_early(const struct FrameBuffer *const in_buffer) {
+  const struct Frame *in_frame = &in_buffer->frame;
+
+  return config.cut_through && config.transport &&
+         in_frame->packet_count == 1 &&
+         in_frame->packet.type != PACKET_ROUTING &&
+         in_frame->packet.destination_address != nodeinfo.address;
+}
+
+/*
+ * Refuse frame
+ *
+ * With transport=off a packet passing through can't be dropped for a
+ * full queue, nothing would send it again and the destination would
+ * get a gap. So a DATA frame whose packets haven't room on the link
+ * they go out on is released without being ACKed, as if it had been
+ * lost, and the neighbour sends it again once its timer runs out, by
+ * which time the queue has had a chance to drain. Full queues push
+ * back link by link to the sources, where the high water mark stops
+ * the application.
+ *
+ * Returns true if the frame was refused, and its buffer released.
+ *
+ * Globals:
+ *   config - Transport mode, frames are never refused with it on.
+ *   links - Refused count updated.
+ */
+static bool refuse_frame(struct FrameBuffer *const in_buffer,
+                         const int in_link) {
+  struct Frame *in_frame = &in_buffer->frame;
+
+  if (config.transport ||
+      network_has_room(&in_frame->packet, in_frame->packet_count)) {
+    return false;
+  }
+
+  LOG_DEBUG("DATA refused, no room to forward. Link: %d, sequence: %d.\n",
+            in_link, in_frame->sequence);
+  ++links[in_link - 1].stats->frames_refused;
+  release_frame_buffer(in_buffer);
+
+  return true;
+}
+
+/*
+ * Pass up
  *
- * Send the given frame out on the link.
+ * Sends the packets in a DATA frame up to the network layer, in the
+ * order they were sent. Any packets aggregated behind the first are
+ * copied out into buffers of their own before the first goes up,
+ * since a forwarded packet goes straight back out of its buffer.
+ *
+ * in_buffer - Frame that's in order, the network layer takes it.
+ * in_link - Link that the frame came in on.
+ */
+static void pass_up(struct FrameBuffer *const in_buffer, const int in_link) {
+  const struct Frame *in_frame = &in_buffer->frame;
+  const int packet_count = in_frame->packet_count;
+  struct FrameBuffer *unpacked[MAX_AGGREGATE_PACKETS];
+  size_t offset = in_frame->packet_sizes[0];
+
+  for (int i = 1; i < packet_count; ++i) {
+    const size_t size = in_frame->packet_sizes[i];
+    struct Frame *frame;
+
+    unpacked[i] = allocate_frame_buffer();
+    unpacked[i]->arrived_time = in_buffer->arrived_time;
+    frame = &unpacked[i]->frame;
+
+    memcpy(wire_bytes(frame), wire_bytes(&in_buffer->frame) + offset, size);
+    offset += size;
+
+    // Can't fail, every packet was checked when the frame arrived.
+    decode_packet(&frame->packet, wire_bytes(frame), size);
+    frame->length = size;
+    frame->packet_count = 1;
+    frame->packet_sizes[0] = size;
+  }
+
+  datalink_up_to_network(in_buffer, in_link);
+
+  for (int i = 1; i < packet_count; ++i) {
+    datalink_up_to_network(unpacked[i], in_link);
+  }
+}
+
+/*
+ * Pack packets
+ *
+ * Gets the frame for a packet just taken off the queue ready to go
+ * into the window, by encoding the packet. With aggregate=on, as many
+ * of the packets queued behind it as will fit in the frame limit are
+ * moved into the frame too, and their buffers released. They all go
+ * under the one sequence number, header, checksum and ACK.
+ *
+ * out_link - Link the frame is going out on.
+ * buffer - Buffer holding the first packet.
+ * sequence_no - Sequence number the frame will be sent with.
+ *
+ * Globals:
+ *   links - Packets taken off the link's queue.
+ */
+static void pack_packets(const int out_link, struct FrameBuffer *const buffer,
+                         const int sequence_no) {
+  struct LinkState *state = &links[out_link - 1];
+  struct Frame *frame = &buffer->frame;
+
+  frame->type = DL_DATA;
+  frame->sequence = sequence_no;
+  frame->ack = (config.ack_mode == ACK_DELAYED) ? cumulative_ack(state) :
+      NO_ACK;
+  frame->length = encode_packet(&frame->packet);
+  frame->packet_count = 1;
+  frame->packet_sizes[0] = frame->length;
+
+  if (!config.aggregate) {
+    return;
+  }
+
+  const size_t limit = frame_limit(out_link);
+  struct FrameBuffer *next;
+
+  while (frame->packet_count < MAX_AGGREGATE_PACKETS &&
+         (next = peek_class_queue(&state->queue)) != NULL) {
+    const size_t size = wire_packet_size(&next->frame.packet);
+
+    // Try it in the frame, the frame header grows as well.
+    frame->packet_sizes[frame->packet_count++] = size;
+    frame->length += size;
+
+    if (wire_frame_size(frame) > limit) {
+      --frame->packet_count;
+      frame->length -= size;
+      break;
+    }
+
+    next_from_class_queue(&state->queue);
+    record_queue_delay(state->stats, &next->frame.packet,
+                       nodeinfo.time_in_usec - next->queued_time);
+    count_forwarded(state, next);
+    encode_packet(&next->frame.packet);
+    memcpy(wire_bytes(frame) + frame->length - size,
+           wire_bytes(&next->frame), size);
+    release_frame_buffer(next);
+    ++state->stats->packets_aggregated;
+  }
+}
+
+/*
+ * Transmit data
+ *
+ * Send the DATA frame held in the window slot for the sequence
+ * number out on the link, and start its ACK timer.
  *
  * out_link - Link to send the frame out on.
- * type - Type of frame, ACK, or DATA.
- * sequence_no - Sequence number to go out on the frame.
+ * sequence_no - Sequence number of the frame in the window.
  *
  * Globals:
  *   linkinfo - Provided by CNET.
- *   outgoing_frame - Updated to frame to be sent out.
- *   timers - Updated to new ACK timer.
+ *   links - Window slot updated with the new ACK timer.
  */
-static void transmit_frame(const int out_link,
-                           const enum FrameType type,
-                           const int sequence_no) {
+static void transmit_data(const int out_link, const int sequence_no) {
+  struct LinkState *state = &links[out_link - 1];
+  struct WindowSlot *window_slot = &state->window[slot(sequence_no)];
+  struct Frame *frame = &window_slot->outgoing_frame->frame;
 
-  outgoing_frame[out_link - 1].type = type;
-  outgoing_frame[out_link - 1].sequence = sequence_no;
-  outgoing_frame[out_link - 1].checksum = 0;
+  frame->type = DL_DATA;
+  frame->sequence = sequence_no;
 
-  switch (type) {
-    case DL_ACK:
-      printf("ACK(%d) sent out on link %d.\n", sequence_no, out_link);
-      break;
-    case DL_DATA:
-      printf("DATA(%d) sent out on link %d.\n", sequence_no, out_link);
-
-      CnetTime timeout = frame_size(&outgoing_frame[out_link - 1]) *
-          ((CnetTime) 8000000 / linkinfo[out_link].bandwidth) +
-          linkinfo[out_link].propagationdelay;
-
-      /*
-       * There's a timer per link, set the timer and set which link
-       * the timer is for so if it expires we know which link to send
-       * the packet back out on.
-       */
-      timers[out_link - 1] = CNET_start_timer(EV_TIMER1, 4 * timeout, out_link);
-      break;
-    default:
-      printf("Unexpected frame type.\n");
+  // Always carry the latest cumulative ACK, if there's one waiting to
+  // go out it doesn't need a frame of its own now.
+  if (config.ack_mode == ACK_DELAYED) {
+    frame->ack = cumulative_ack(state);
+
+    if (state->ack_pending) {
+      ++state->stats->acks_piggybacked;
+      clear_pending_ack(state);
+    }
+  } else {
+    frame->ack = NO_ACK;
+  }
+
+  // Only a frame's first send goes in a parity group, and only if the
+  // parity frame will fit on the link.
+  const struct FecLink *fec = state->fec;
+
+  frame->fec_group = NO_FEC_GROUP;
+
+  if (fec != NULL && fec->active && !window_slot->retransmitted) {
+    frame->fec_group = fec->send.group;
+
+    if (frame_size(frame) > frame_limit(out_link)) {
+      frame->fec_group = NO_FEC_GROUP;
+    }
+  }
+
+  LOG_DEBUG("DATA(%d) sent out on link %d.\n", sequence_no, out_link);
+
+  /*
+   * There's a timer per frame in the window, set the timer and set
+   * which link and frame the timer is for so if it expires we know
+   * which frame to send back out and on which link.
+   */
+  if (window_slot->timer != NULLTIMER) {
+    CNET_stop_timer(window_slot->timer);
+  }
+  window_slot->timer = CNET_start_timer(EV_TIMER1,
+                                        ack_timeout(out_link, frame),
+                                        TIMER_DATA(out_link, sequence_no));
+
+  transmit_frame(out_link, frame);
+
+  if (frame->fec_group != NO_FEC_GROUP) {
+    add_to_parity(out_link, frame);
+  }
+}
+
+/*
+ * Transmit ACK
+ *
+ * ACK frames carry no packet, so they don't need to be kept around,
+ * build it on the stack and send it off. The cumulative ACK goes
+ * along as well, so any held ACK is taken care of.
+ *
+ * out_link - Link to send the ACK out on.
+ * sequence_no - Sequence number being ACKed.
+ */
+static void transmit_ack(const int out_link, const int sequence_no) {
+  struct LinkState *state = &links[out_link - 1];
+  struct Frame ack_frame;
+
+  ack_frame.type = DL_ACK;
+  ack_frame.sequence = sequence_no;
+  ack_frame.ack = cumulative_ack(state);
+  ack_frame.length = 0;
+  ack_frame.packet_count = 0;
+
+  LOG_DEBUG("ACK(%d) sent out on link %d.\n", sequence_no, out_link);
+
+  clear_pending_ack(state);
+  ++state->stats->ack_frames_sent;
+  transmit_frame(out_link, &ack_frame);
+}
+
+/*
+ * Schedule ACK
+ *
+ * With immediate ACKs, the ACK is sent straight away. Otherwise the
+ * ACK is held until either a DATA frame goes out on the link, or the
+ * ACK timer fires. Any ACKs for the link in the meantime are rolled
+ * into the one cumulative ACK.
+ *
+ * out_link - Link the ACK is to go out on.
+ * sequence_no - Sequence number being ACKed.
+ *
+ * Globals:
+ *   links - ack_pending set for the link if the ACK is held, and the
+ *           ACK timer started if not already running.
+ */
+static void schedule_ack(const int out_link, const int sequence_no) {
+  struct LinkState *state = &links[out_link - 1];
+
+  if (config.ack_mode == ACK_IMMEDIATE) {
+    transmit_ack(out_link, sequence_no);
+    return;
   }
 
+  state->ack_pending = true;
+
+  if (state->ack_timer == NULLTIMER) {
+    const CnetTime delay = (config.ack_delay > 0) ? config.ack_delay :
+        linkinfo[out_link].propagationdelay / 2;
+
+    state->ack_timer = CNET_start_timer(EV_TIMER2, delay, out_link);
+  }
+}
+
+/*
+ * Clear pending ACK
+ *
+ * The held ACK for the link has gone out, so stop its timer.
+ */
+static void clear_pending_ack(struct LinkState *const state) {
+  state->ack_pending = false;
+
+  if (state->ack_timer != NULLTIMER) {
+    CNET_stop_timer(state->ack_timer);
+    state->ack_timer = NULLTIMER;
+  }
+}
+
+/*
+ * Cumulative ACK
+ *
+ * The sequence number of the last frame received in order on the
+ * link, which is the one before the frame we're expecting.
+ */
+static int cumulative_ack(const struct LinkState *const state) {
+  return (state->frame_expected + sequence_space - 1) % sequence_space;
+}
+
+/*
+ * Transmit frame
+ *
+ * Pack the frame's header after its message (see wire.h), checksum
+ * it and send it out on the link.
+ *
+ * out_link - Link to send the frame out on.
+ * frame - Frame to send, the packed header is written after the
+ *         message.
+ */
+static void transmit_frame(const int out_link, struct Frame *const frame) {
+  size_t length = encode_frame(frame);
+  unsigned char *wire = wire_bytes(frame);
+  const uint32_t checksum = checksum_frame(wire, length,
+                                           length - WIRE_CHECKSUM_SIZE);
+
+  memcpy(wire + length - WIRE_CHECKSUM_SIZE, &checksum, WIRE_CHECKSUM_SIZE);
+
+  struct LinkStats *stats = links[out_link - 1].stats;
+  ++stats->frames_sent;
+  stats->bytes_sent += length;
+
   // Send it off onto the physical link.
-  size_t length = frame_size(&outgoing_frame[out_link - 1]);
-  outgoing_frame[out_link - 1].checksum =
-      CNET_crc32((unsigned char *) &outgoing_frame[out_link - 1], (int) length);
-  CHECK(CNET_write_physical(out_link,
-                            (void *) &outgoing_frame[out_link - 1],
-                            &length));
+  CHECK(CNET_write_physical(out_link, (void *) wire, &length));
+}
+
+/*
+ * Add to parity
+ *
+ * XORs a DATA frame that's just been sent into the link's parity
+ * group, and sends the parity once the group is full.
+ *
+ * out_link - Link the frame went out on.
+ * frame - The frame, as it went out.
+ *
+ * Globals:
+ *   links - Frame added to the link's parity group.
+ */
+static void add_to_parity(const int out_link, struct Frame *const frame) {
+  struct FecLink *fec = links[out_link - 1].fec;
+
+  if (fec->send.count == 0) {
+    fec->group_started = nodeinfo.time_in_usec;
+  }
+
+  fec_add_frame(&fec->send, wire_bytes(frame), frame_size(frame));
+
+  if (fec->send.count >= config.fec_group) {
+    transmit_parity(out_link);
+  }
+}
+
+/*
+ * Transmit parity
+ *
+ * Sends the parity frame for the link's group, then starts the next
+ * group. The parity is sent straight out of the group's buffer, the
+ * header goes after it, and is cleared with it.
+ *
+ * Globals:
+ *   links - The link's next parity group started.
+ */
+static void transmit_parity(const int out_link) {
+  struct LinkState *state = &links[out_link - 1];
+  struct FecGroup *group = &state->fec->send;
+  struct Frame *parity = &group->buffer.frame;
+
+  parity->type = DL_PARITY;
+  parity->ack = NO_ACK;
+  parity->length = group->length;
+  parity->fec_group = group->group;
+  parity->fec_count = group->count;
+  parity->fec_length_xor = group->length_xor;
+
+  LOG_DEBUG("PARITY(%d) sent out on link %d.\n", group->group, out_link);
+
+  ++state->stats->fec_parity_sent;
+  transmit_frame(out_link, parity);
+  fec_start_group(group, (group->group + 1) % FEC_GROUP_SPACE);
+}
+
+/*
+ * Flush parity
+ *
+ * A parity group that isn't full yet is sent anyway if there's nothing
+ * queued to fill it, or if its first frame has been waiting half the
+ * link's propagation delay. Otherwise the missing frame could be
+ * waiting on parity until after its timer has gone off.
+ *
+ * out_link - Link to check.
+ */
+static void flush_parity(const int out_link) {
+  const struct LinkState *state = &links[out_link - 1];
+  const struct FecLink *fec = state->fec;
+
+  if (fec == NULL || fec->send.count == 0) {
+    return;
+  }
+
+  if (class_queue_length(&state->queue) == 0 ||
+      nodeinfo.time_in_usec - fec->group_started >=
+      linkinfo[out_link].propagationdelay / 2) {
+    transmit_parity(out_link);
+  }
+}
+
+/*
+ * Process parity
+ *
+ * A parity frame has arrived. If it's for the group being received,
+ * and just the one frame of the group is missing, the frame is put
+ * back together and goes through as if it had just arrived. Either
+ * way the group is finished with.
+ *
+ * in_buffer - The parity frame, released.
+ * in_link - Link that the frame came in on.
+ *
+ * Globals:
+ *   links - The link's received group emptied.
+ */
+static void process_parity(struct FrameBuffer *const in_buffer,
+                           const int in_link) {
+  struct LinkState *state = &links[in_link - 1];
+  struct FecLink *fec = state->fec;
+  const size_t length = (fec != NULL) ?
+      fec_missing_length(&fec->receive, &in_buffer->frame) : 0;
+
+  if (length == 0) {
+    if (fec != NULL) {
+      fec_start_group(&fec->receive, NO_FEC_GROUP);
+    }
+    release_frame_buffer(in_buffer);
+    return;
+  }
+
+  struct FrameBuffer *repaired = allocate_frame_buffer();
+
+  fec_recover(&fec->receive, wire_bytes(&in_buffer->frame), length,
+              wire_bytes(&repaired->frame));
+  fec_start_group(&fec->receive, NO_FEC_GROUP);
+  release_frame_buffer(in_buffer);
+
+  LOG_DEBUG("Frame repaired from parity on link %d.\n", in_link);
+
+  ++state->stats->fec_repaired;
+  fec_observe(fec, true);
+
+  // The checksum is checked again, in case it was more than the one
+  // frame that went missing after all.
+  up_to_datalink_from_physical(in_link, repaired, length);
+}
+
+/*
+ * Frame limit
+ *
+ * Most bytes a frame can take on the wire going out on the link, the
+ * link's MTU, the mtu option if that's less, or what fits in a frame
+ * buffer if that's less again. If parity is being sent on the link,
+ * enough is left for the parity frame's header.
+ *
+ * Globals:
+ *   linkinfo - Provided by CNET.
+ *   config - MTU from the options.
+ */
+static size_t frame_limit(const int link) {
+  const struct FecLink *fec = links[link - 1].fec;
+  size_t mtu = linkinfo[link].mtu;
+
+  if (config.mtu > 0 && (mtu == 0 || (size_t) config.mtu < mtu)) {
+    mtu = config.mtu;
+  }
+
+  size_t limit = (mtu > 0 && mtu < MAX_WIRE_FRAME_SIZE) ?
+      mtu : MAX_WIRE_FRAME_SIZE;
+
+  if (fec != NULL && fec->active) {
+    limit -= FEC_PARITY_OVERHEAD;
+  }
+
+  return limit;
+}
+
+/*
+ * Link packet limit
+ *
+ * Check header file for details.
+ */
+size_t link_packet_limit(const int link) {
+  return frame_limit(link) - MAX_DATA_FRAME_OVERHEAD;
+}
+
+/*
+ * Queue scale
+ *
+ * Fragments a full sized message is split into to go out on the link,
+ * 1 if it fits whole.
+ */
+static size_t queue_scale(const int link) {
+  const size_t limit = link_packet_limit(link);
+
+  return (MAX_MESSAGE_SIZE + limit - 1) / limit;
 }
 
 /*
  * Frame size
  *
  * Given a pointer to the frame, it will return the total used size
- * for the frame. This is why the Packet must be at the end of the
- * Frame struct.
+ * for the frame, on the wire.
  */
 static size_t frame_size(const struct Frame *const frame) {
-  const size_t frame_header_size = sizeof(struct Frame) -
-      sizeof(struct Packet);
+  return wire_frame_size(frame);
+}
+
+/*
+ * Increment
+ *
+ * Next sequence number, wrapping around at the end of the sequence
+ * space.
+ */
+static int increment(const int sequence_no) {
+  return (sequence_no + 1) % sequence_space;
+}
+
+/*
+ * Between
+ *
+ * True if sequence_no falls in the range low (inclusive) to high
+ * (exclusive), taking wrap around into account.
+ */
+static bool between(const int low, const int sequence_no, const int high) {
+  return ((low <= sequence_no) && (sequence_no < high)) ||
+      ((high < low) && (low <= sequence_no)) ||
+      ((sequence_no < high) && (high < low));
+}
+
+/*
+ * Slot
+ *
+ * Which slot in a window the sequence number is kept in.
+ */
+static int slot(const int sequence_no) {
+  return sequence_no % window_slots;
+}
+
+/*
+ * Allocate links
+ *
+ * Allocates a zeroed link state for each link, starting on a cache
+ * line boundary.
+ *
+ * count - Number of links on the node.
+ *
+ * Globals:
+ *   links, link_memory, link_count - Set to the new link states.
+ */
+static void allocate_links(const int count) {
+  const size_t size = (count > 0 ? count : 1) * sizeof(struct LinkState);
+
+  link_memory = malloc(size + CACHE_LINE_SIZE - 1);
+
+  // If we can't allocate memory for this, it's a serious problem
+  // can't recover from.
+  assert(link_memory);
+
+  const uintptr_t aligned = ((uintptr_t) link_memory + CACHE_LINE_SIZE - 1) &
+      ~(uintptr_t)(CACHE_LINE_SIZE - 1);
+
+  links = (struct LinkState *) aligned;
+  link_count = count;
+  memset(links, 0, size);
+}
+
+/*
+ * Free links
+ *
+ * Frees the link states from before a reboot, along with their
+ * windows and queues. Any timers went with the reboot.
+ *
+ * Globals:
+ *   links, link_memory, link_count - Cleared.
+ */
+static void free_links() {
+  for (int i = 0; i < link_count; ++i) {
+    free(links[i].window);
+    for (int j = 0; j < TRAFFIC_CLASSES; ++j) {
+      free(links[i].queue.queues[j].buffers);
+    }
+    free(links[i].fec);
+  }
+
+  free(link_memory);
+  link_memory = NULL;
+  links = NULL;
+  link_count = 0;
+}
+
+/*
+ * Update RTT
+ *
+ * Takes a round trip time sample from the ACKed frame, as long as it
+ * was only sent the once, and folds it into the estimate for the
+ * link. A good sample also means the link is getting through again,
+ * so the backoff is reset.
+ *
+ * state - State of the link the ACK came in on.
+ * sequence_no - Sequence number ACKed, must be in the window.
+ */
+static void update_rtt(struct LinkState *const state, const int sequence_no) {
+  const struct WindowSlot *acked_slot = &state->window[slot(sequence_no)];
+
+  if (acked_slot->retransmitted || acked_slot->frame_acked) {
+    return;
+  }
+
+  const CnetTime sample = nodeinfo.time_in_usec - acked_slot->send_time;
+
+  if (state->smoothed_rtt == 0) {
+    // First sample.
+    state->smoothed_rtt = sample;
+    state->rtt_variance = sample / 2;
+  } else {
+    const CnetTime error = sample - state->smoothed_rtt;
+
+    state->rtt_variance += ((error < 0 ? -error : error) -
+                            state->rtt_variance) / 4;
+    state->smoothed_rtt += error / 8;
+  }
+
+  state->timeout_backoff = 1;
+}
+
+/*
+ * ACK timeout
+ *
+ * How long to wait for the ACK for the frame. Fixed timeouts are four
+ * times the time it takes to get the frame to the other end.
+ *
+ * Adaptive timeouts use the smoothed RTT plus four times the variance,
+ * times the backoff. The timeout is never less than the frame could
+ * possibly take to get there and back. Until there's been a sample,
+ * the fixed timeout is used.
+ *
+ * out_link - Link the frame is going out on.
+ * frame - Frame being sent.
+ */
+static CnetTime ack_timeout(const int out_link,
+                            const struct Frame *const frame) {
+  const struct LinkState *state = &links[out_link - 1];
+  const CnetTime transmission = frame_size(frame) *
+      ((CnetTime) 8000000 / linkinfo[out_link].bandwidth);
+  const CnetTime fixed_timeout = 4 * (transmission +
+                                      linkinfo[out_link].propagationdelay);
+
+  if (config.rto_mode == RTO_FIXED) {
+    return fixed_timeout;
+  }
+
+  CnetTime timeout = fixed_timeout;
+
+  if (state->smoothed_rtt != 0) {
+    const CnetTime variance = (state->rtt_variance > MIN_RTT_VARIANCE) ?
+        state->rtt_variance : MIN_RTT_VARIANCE;
+    const CnetTime round_trip = transmission +
+        2 * linkinfo[out_link].propagationdelay;
+
+    timeout = state->smoothed_rtt + 4 * variance;
+
+    if (timeout < round_trip) {
+      timeout = round_trip;
+    }
+  }
 
-  return frame_header_size + frame->length;
+  return timeout * state->timeout_backoff;
 }
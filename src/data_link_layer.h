@@ -6,40 +6,88 @@
  * Description:
  *
  *   This is where the majority of the hard work is done. As per the
- *   assignment specs, this impliments a stop and wait protocol.
- *   Additionally, each link on a node has a boundless queue, this
- *   means that any new packets will be queued if the node is waiting
- *   for an ACK to be received.
+ *   assignment specs, this impliments a stop and wait protocol by
+ *   default. Go back N and selective repeat sliding windows can be
+ *   picked instead at reboot (check config.h), stop and wait is just
+ *   the case of a window of one. Additionally, each link on a node
+ *   has a queue, this means that any new packets will be queued if
+ *   the node is waiting for an ACK to be received.
  *
  *   This was done to remove the need to have
  *   CNET_(enable/disable)_application function calls. This
  *   implimentation supports all node applications generating messages
  *   fulltime. However, given the efficiency of the stop and wait
- *   protocol, these queues will keep growing. Since CNET runs for 5
- *   minutes only as a default, this shouldn't be a problem.
+ *   protocol, these queues will keep growing (a larger window helps
+ *   on the longer links). So the queues have a limit, and the network
+ *   layer is told when a queue gets too long, so it can hold off the
+ *   application for just the destinations using that link.
  */
 
 #ifndef DATA_LINK_LAYER_H_
 #define DATA_LINK_LAYER_H_
 
+#include <stdint.h>
+
 #include "network_layer.h"
 #include "physical_layer.h"
 
-// We only use two types of frames.
+struct FrameBuffer;
+
+// Parity frames are only sent with FEC on (see fec.h).
 enum FrameType {
   DL_DATA,
-  DL_ACK};
+  DL_ACK,
+  DL_PARITY};
+
+// Value of the ack field when a frame isn't carrying an ACK.
+#define NO_ACK (-1)
+
+// Value of the fec_group field when a frame isn't in a parity group.
+#define NO_FEC_GROUP (-1)
+
+// Most packets that can be aggregated into one DATA frame.
+#define MAX_AGGREGATE_PACKETS 16
 
 /*
- * The frame, this wraps the packet from the network layer.
+ * The frame, this wraps the packet from the network layer. This is
+ * how it's kept in memory, it's packed much smaller to be sent, see
+ * wire.h, which also has the checksum.
  */
 struct Frame {
   enum FrameType type;
-  uint32_t checksum;
+
+  // Wraps around at the sequence space for the ARQ mode in use, for
+  // ACK frames it's the sequence number being ACKed. Parity frames
+  // don't have one.
   int sequence;
 
-  // Size of the packet.
+  // Cumulative ACK, every frame up to and including this sequence
+  // number has been received. DATA frames piggyback it when delayed
+  // ACKs are on.
+  int ack;
+
+  // Size of the frame's packets on the wire, all of them. For parity
+  // frames, the size of the parity.
   size_t length;
+
+  /*
+   * With FEC, the parity group a DATA frame was first sent in, or
+   * NO_FEC_GROUP. A parity frame has the group it's for, how many
+   * frames were in it, and their sizes XORed together.
+   */
+  int fec_group;
+  int fec_count;
+  size_t fec_length_xor;
+
+  /*
+   * With aggregate=on, several small packets can go in one DATA frame.
+   * The first is the packet below, the rest follow it on the wire, and
+   * each one's size on the wire is kept here. Frames that haven't been
+   * aggregated have the one packet.
+   */
+  int packet_count;
+  uint16_t packet_sizes[MAX_AGGREGATE_PACKETS];
+
   struct Packet packet;
 };
 
@@ -59,12 +107,15 @@ void init_data_link_layer();
  * keep track of expected sequences on the link), the frame itself,
  * and it's length.
  *
+ * The data link layer takes the frame buffer, either passing it up to
+ * the network layer or releasing it.
+ *
  * in_link - Link that frame arrived on.
- * in_frame - Pointer to frame that arrived.
+ * in_buffer - Buffer holding the frame that arrived.
  * frame_length - Size of the frame.
  */
 void up_to_datalink_from_physical(const int in_link,
-                                  struct Frame *in_frame,
+                                  struct FrameBuffer *const in_buffer,
                                   size_t frame_length);
 
 /*
@@ -73,29 +124,106 @@ void up_to_datalink_from_physical(const int in_link,
  * Since we have a queue, just add any packets from the network layer
  * onto that queue straight away. Then we will test to see if that
  * link is waiting on an ACK, if it isn't, then send off the first
- * packet in the queue.
+ * packet in the queue. If the queue is at its limit, the packet is
+ * dropped, but only with transport=on, where the transport layer sends
+ * it again.
+ *
+ * With transport=off a dropped packet would leave a gap at its
+ * destination, so the packet is always queued, and the limit is kept
+ * by pushing back instead. The application is stopped at the high
+ * water mark, and a DATA frame from a neighbour whose packets haven't
+ * room where they're going is refused (not ACKed), so the neighbour
+ * holds it and sends it again. The limit can still be gone over by
+ * frames already accepted, such as a selective repeat window's worth
+ * held for a gap, or packets aggregated behind the first in a frame
+ * that go out on another link.
  *
  * This will most likly be the packet we just added.
  *
+ * The packet is queued in place, the data link layer takes the frame
+ * buffer and releases it once the frame has been ACKed.
+ *
  * out_link - Link that packet is to go out on.
- * out_packet - Pointer to packet to be sent.
+ * out_buffer - Frame buffer with the packet filled in.
  * length - Size of the packet.
  */
 void down_to_datalink_from_network(const int out_link,
-                                   const struct Packet *const out_packet,
+                                   struct FrameBuffer *const out_buffer,
                                    const size_t length);
 
+/*
+ * Drop queued routing
+ *
+ * Throws away the routing packets queued on the link that haven't
+ * been sent yet, a newer distance vector is about to go out after
+ * them.
+ *
+ * out_link - Link to drop them from.
+ */
+void drop_queued_routing(const int out_link);
+
+/*
+ * Link is congested
+ *
+ * True if the link's queue has passed its high water mark, and hasn't
+ * drained back down to the low water mark yet.
+ */
+bool link_is_congested(const int link);
+
+/*
+ * Link packet limit
+ *
+ * Largest packet, on the wire, that fits in a DATA frame of its own on
+ * the link, under the link's MTU. The network layer fragments anything
+ * bigger (see fragment.h).
+ */
+size_t link_packet_limit(const int link);
+
+/*
+ * Link queue room
+ *
+ * Packets like this one that can still be queued on the link before
+ * it starts dropping them, SIZE_MAX if the queue has no limit.
+ */
+size_t link_queue_room(const int link, const struct Packet *const packet);
+
+/*
+ * Link round trip
+ *
+ * How long a frame of length bytes takes to go out on the link, and
+ * its ACK to come back, with nothing else in the way.
+ */
+CnetTime link_round_trip(const int link, const size_t length);
+
+/*
+ * Link queue depth
+ *
+ * Number of packets queued on the link plus frames sent but not yet
+ * ACKed, how far behind the link is.
+ */
+size_t link_queue_depth(const int link);
+
 /*
  * Timeouts
  *
- * A timer is set to go off if we don't receive an ACK from a node. If
- * the timer is fired, then the frame needs to be resent on the link
- * again, and the timer is set again.
+ * A timer is set for each frame to go off if we don't receive an ACK
+ * from a node. If the timer is fired, then the frame (and for go back
+ * N, every frame after it) needs to be resent on the link again, and
+ * the timer is set again.
  *
  * This will keep happening until it works, or the zombie apocalypse.
  */
 EVENT_HANDLER(timeouts);
 
+/*
+ * ACK timeouts
+ *
+ * With delayed ACKs, a timer is set when a DATA frame arrives. If no
+ * DATA frame has gone out on the link to carry the ACK by the time it
+ * fires, the ACK is sent on its own.
+ */
+EVENT_HANDLER(ack_timeouts);
+
 
 /*
  * For printing out debug information about the data link layer.
@@ -0,0 +1,122 @@
+/*
+ * CC200 Assignment
+ *
+ * Author: Mike Aldred
+ *
+ * Forward Error Correction
+ *
+ * Description:
+ *   Look at the header file for details.
+ */
+
+#include <string.h>
+
+#include "config.h"
+#include "fec.h"
+#include "wire.h"
+
+/*
+ * The error rate is a moving average, each frame counts for 1/64th,
+ * so it follows the last hundred or so frames on the link.
+ */
+#define FEC_RATE_SHIFT 6
+
+void setup_fec_link(struct FecLink *const fec) {
+  fec->active = (config.fec_mode == FEC_ON);
+  fec->error_rate = 0;
+  fec->group_started = 0;
+
+  fec->send.length = MAX_WIRE_FRAME_SIZE;
+  fec->receive.length = MAX_WIRE_FRAME_SIZE;
+  fec_start_group(&fec->send, 0);
+  fec_start_group(&fec->receive, NO_FEC_GROUP);
+}
+
+/*
+ * FEC observe
+ *
+ * Check header file for details.
+ */
+void fec_observe(struct FecLink *const fec, const bool error) {
+  fec->error_rate -= fec->error_rate >> FEC_RATE_SHIFT;
+
+  if (error) {
+    fec->error_rate += FEC_RATE_ONE >> FEC_RATE_SHIFT;
+  }
+
+  if (config.fec_mode != FEC_AUTO) {
+    return;
+  }
+
+  // Percent of frames in error, scaled up rather than the rate down,
+  // so small rates aren't rounded to nothing.
+  const uint64_t percent = (uint64_t) fec->error_rate * 100;
+  const uint64_t threshold = (uint64_t) config.fec_threshold * FEC_RATE_ONE;
+
+  if (!fec->active && percent >= threshold && threshold > 0) {
+    fec->active = true;
+  } else if (fec->active && percent < threshold / 2) {
+    fec->active = false;
+  }
+}
+
+/*
+ * FEC start group
+ *
+ * Only as much of the parity as the last group used needs clearing,
+ * plus the parity frame header a sent group had written after it.
+ */
+void fec_start_group(struct FecGroup *const group, const int number) {
+  size_t used = group->length + FEC_PARITY_OVERHEAD;
+
+  if (used > MAX_WIRE_FRAME_SIZE) {
+    used = MAX_WIRE_FRAME_SIZE;
+  }
+
+  memset(wire_bytes(&group->buffer.frame), 0, used);
+
+  group->group = number;
+  group->count = 0;
+  group->length = 0;
+  group->length_xor = 0;
+}
+
+void fec_add_frame(struct FecGroup *const group,
+                   const unsigned char *const wire, const size_t length) {
+  unsigned char *parity = wire_bytes(&group->buffer.frame);
+
+  for (size_t i = 0; i < length; ++i) {
+    parity[i] ^= wire[i];
+  }
+
+  if (length > group->length) {
+    group->length = length;
+  }
+
+  group->length_xor ^= length;
+  ++group->count;
+}
+
+size_t fec_missing_length(const struct FecGroup *const received,
+                          const struct Frame *const parity) {
+  if (received->group != parity->fec_group ||
+      received->count != parity->fec_count - 1) {
+    return 0;
+  }
+
+  const size_t length = received->length_xor ^ parity->fec_length_xor;
+
+  return (length <= parity->length) ? length : 0;
+}
+
+void fec_recover(const struct FecGroup *const received,
+                 const unsigned char *const parity, const size_t length,
+                 unsigned char *const out) {
+  // Anything past the longest frame received is still zero.
+  const unsigned char *bytes =
+      wire_bytes((struct Frame *) &received->buffer.frame);
+
+  for (size_t i = 0; i < length; ++i) {
+    out[i] = parity[i] ^ bytes[i];
+  }
+}
@@ -0,0 +1,152 @@
+/*
+ * CC200 Assignment
+ *
+ * Author: Mike Aldred
+ *
+ * Forward Error Correction
+ *
+ * Description:
+ *
+ *   Every DATA frame that's lost or corrupted costs an ACK timeout and
+ *   a resend, and the frames behind it wait the whole time. With the
+ *   fec option on, the first send of each DATA frame on a link is
+ *   XORed into a parity group, and after every fecgroup frames (or
+ *   sooner, if the link goes quiet) a parity frame goes out with the
+ *   XOR of the lot. The receiver XORs together the frames of the group
+ *   that arrive safely, and if exactly one is missing when the parity
+ *   frame turns up, the parity XOR what it has is the missing frame,
+ *   checksum and all. It goes through the data link layer as if it had
+ *   just arrived, before the sender's timer has run out.
+ *
+ *   Frames are XORed as they are on the wire, zero padded to the
+ *   longest, so the parity is as long as the longest frame in the
+ *   group. The sizes are XORed as well, to get the missing frame's
+ *   size back. Resent frames aren't put in a group, the receiver
+ *   couldn't tell which copy it had.
+ *
+ *   Selective repeat gets the most out of it, since it holds onto the
+ *   frames after the missing one. Go back N has already thrown them
+ *   away by the time the missing one is repaired.
+ *
+ *   fec=on always sends parity. fec=auto keeps an estimate of the
+ *   fraction of frames arriving in error on each link, corrupted or
+ *   repaired from parity, and only sends parity on a link once it
+ *   passes fecthreshold percent, stopping again once it's under half
+ *   of that. Links are taken to be as bad one way as the other. Lost
+ *   frames can't be seen until parity is being sent, and timeouts
+ *   aren't counted, since a frame held up behind a long queue times
+ *   out just the same as a lost one.
+ */
+
+#ifndef FEC_H_
+#define FEC_H_
+
+#include <cnet.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "frame_buffer.h"
+
+/*
+ * Group numbers wrap around at this, so they're sent in one byte. The
+ * receiver only ever has one group on the go, so it just has to tell
+ * the next one apart.
+ */
+#define FEC_GROUP_SPACE 128
+
+/*
+ * Most bytes a parity frame has on top of its parity, the header,
+ * header length and checksum. Frames that go in a group have to leave
+ * this much room under the MTU, so the parity frame fits.
+ */
+#define FEC_PARITY_OVERHEAD 16
+
+/*
+ * A parity group, either being built to send, or being received. The
+ * parity is built in a frame buffer, so it can be sent straight from
+ * there.
+ */
+struct FecGroup {
+  int group;          // Group number, or NO_FEC_GROUP.
+  int count;          // Frames XORed in so far.
+  size_t length;      // Longest of them.
+  size_t length_xor;  // Their sizes XORed together.
+  struct FrameBuffer buffer;
+};
+
+// Error rates are fractions of this.
+#define FEC_RATE_ONE 65536
+
+// FEC state for a link.
+struct FecLink {
+  // Whether DATA frames going out on the link go in parity groups.
+  bool active;
+
+  // Estimated fraction of frames in error, out of FEC_RATE_ONE.
+  uint32_t error_rate;
+
+  // When the frame that started the group being sent went out.
+  CnetTime group_started;
+
+  struct FecGroup send;
+  struct FecGroup receive;
+};
+
+/*
+ * Setup FEC link
+ *
+ * Starts the link off with no groups, active only with fec=on.
+ */
+void setup_fec_link(struct FecLink *const fec);
+
+/*
+ * FEC observe
+ *
+ * Adds a frame that's arrived to the link's error rate, and with
+ * fec=auto, turns FEC on or off for the link if the rate has crossed
+ * the threshold.
+ *
+ * error - True if the frame was lost or corrupted.
+ */
+void fec_observe(struct FecLink *const fec, const bool error);
+
+/*
+ * FEC start group
+ *
+ * Empties the group, ready for the frames of a new one.
+ */
+void fec_start_group(struct FecGroup *const group, const int number);
+
+/*
+ * FEC add frame
+ *
+ * XORs a frame, as it is on the wire, into the group's parity.
+ */
+void fec_add_frame(struct FecGroup *const group,
+                   const unsigned char *const wire, const size_t length);
+
+/*
+ * FEC missing length
+ *
+ * If the parity frame is for the group being received, and exactly one
+ * of its frames is missing, the size of the missing frame, otherwise
+ * 0.
+ */
+size_t fec_missing_length(const struct FecGroup *const received,
+                          const struct Frame *const parity);
+
+/*
+ * FEC recover
+ *
+ * Rebuilds the missing frame from the parity and the frames received.
+ *
+ * received - The group being received.
+ * parity - Parity frame's parity.
+ * length - From fec_missing_length.
+ * out - Where the frame goes, at least length bytes.
+ */
+void fec_recover(const struct FecGroup *const received,
+                 const unsigned char *const parity, const size_t length,
+                 unsigned char *const out);
+
+#endif
@@ -0,0 +1,131 @@
+/*
+ * CC200 Assignment
+ *
+ * Author: Mike Aldred
+ *
+ * Forwarding Table
+ *
+ * Description:
+ *   Look at the header file for details.
+ */
+
+#include <assert.h>
+#include <stdlib.h>
+
+#include "forwarding_table.h"
+
+// Value marking an entry that's not in use.
+#define EMPTY_ENTRY UINT32_MAX
+
+#define INITIAL_TABLE_CAPACITY 16
+
+// Forward declarations
+static size_t hash_address(const CnetAddr address, const size_t capacity);
+static struct ForwardingEntry *allocate_entries(const size_t capacity);
+static void grow_table(struct ForwardingTable *const table);
+
+void setup_forwarding_table(struct ForwardingTable *const table) {
+  free(table->entries);
+
+  table->entries = allocate_entries(INITIAL_TABLE_CAPACITY);
+  table->capacity = INITIAL_TABLE_CAPACITY;
+  table->count = 0;
+}
+
+void forwarding_table_insert(struct ForwardingTable *const table,
+                             const CnetAddr address,
+                             const uint32_t value) {
+  // Keep it at most half full, so probe runs stay short.
+  if (2 * (table->count + 1) > table->capacity) {
+    grow_table(table);
+  }
+
+  size_t index = hash_address(address, table->capacity);
+
+  while (table->entries[index].value != EMPTY_ENTRY &&
+         table->entries[index].address != address) {
+    index = (index + 1) & (table->capacity - 1);
+  }
+
+  if (table->entries[index].value == EMPTY_ENTRY) {
+    ++table->count;
+  }
+
+  table->entries[index].address = address;
+  table->entries[index].value = value;
+}
+
+bool forwarding_table_lookup(const struct ForwardingTable *const table,
+                             const CnetAddr address,
+                             uint32_t *const value) {
+  size_t index = hash_address(address, table->capacity);
+
+  while (table->entries[index].value != EMPTY_ENTRY) {
+    if (table->entries[index].address == address) {
+      *value = table->entries[index].value;
+      return true;
+    }
+
+    index = (index + 1) & (table->capacity - 1);
+  }
+
+  return false;
+}
+
+/*
+ * Hash address
+ *
+ * Fibonacci hashing, multiplying by 2^32 / golden ratio spreads
+ * addresses that are close together (the usual case) all over the
+ * table. The top half is folded back in, since the low bits of the
+ * product only depend on the low bits of the address.
+ */
+static size_t hash_address(const CnetAddr address, const size_t capacity) {
+  uint32_t hash = (uint32_t) address * 2654435761u;
+
+  hash ^= hash >> 16;
+  return hash & (capacity - 1);
+}
+
+/*
+ * Allocate entries
+ *
+ * Allocates a block of empty entries.
+ */
+static struct ForwardingEntry *allocate_entries(const size_t capacity) {
+  struct ForwardingEntry *entries =
+      (struct ForwardingEntry *)malloc(capacity * sizeof(struct ForwardingEntry));
+
+  // If we can't allocate memory for this, it's a serious problem
+  // can't recover from.
+  assert(entries);
+
+  for (size_t i = 0; i < capacity; ++i) {
+    entries[i].value = EMPTY_ENTRY;
+  }
+
+  return entries;
+}
+
+/*
+ * Grow table
+ *
+ * Doubles the size of the table, putting every entry back in.
+ */
+static void grow_table(struct ForwardingTable *const table) {
+  struct ForwardingEntry *old_entries = table->entries;
+  const size_t old_capacity = table->capacity;
+
+  table->capacity *= 2;
+  table->entries = allocate_entries(table->capacity);
+  table->count = 0;
+
+  for (size_t i = 0; i < old_capacity; ++i) {
+    if (old_entries[i].value != EMPTY_ENTRY) {
+      forwarding_table_insert(table, old_entries[i].address,
+                              old_entries[i].value);
+    }
+  }
+
+  free(old_entries);
+}
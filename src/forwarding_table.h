@@ -0,0 +1,68 @@
+/*
+ * CC200 Assignment
+ *
+ * Author: Mike Aldred
+ *
+ * Forwarding Table
+ *
+ * Description:
+ *
+ *   Maps node addresses onto a small number, for the routing module
+ *   this is where the route for the address is in the route table.
+ *   Addresses don't have to be 0 to N-1, any CnetAddr will do.
+ *
+ *   It's an open addressing hash table with linear probing. Each entry
+ *   is just the address and its value side by side, so a lookup is
+ *   normally a single cache line no matter how many nodes there are.
+ *   The table is kept at most half full, and doubled when it gets
+ *   there. Entries can't be removed, the routing table never forgets
+ *   a destination anyway.
+ */
+
+#ifndef FORWARDING_TABLE_H_
+#define FORWARDING_TABLE_H_
+
+#include <cnet.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+struct ForwardingEntry {
+  CnetAddr address;
+  uint32_t value;
+};
+
+struct ForwardingTable {
+  struct ForwardingEntry *entries;
+  size_t capacity;  // Always a power of two.
+  size_t count;
+};
+
+/*
+ * Setup forwarding table
+ *
+ * Gets the table ready to use, calling it again on a table that's
+ * been set up empties it.
+ */
+void setup_forwarding_table(struct ForwardingTable *const table);
+
+/*
+ * Forwarding table insert
+ *
+ * Adds the address to the table, or updates its value if it's
+ * already there.
+ */
+void forwarding_table_insert(struct ForwardingTable *const table,
+                             const CnetAddr address,
+                             const uint32_t value);
+
+/*
+ * Forwarding table lookup
+ *
+ * Finds the value for the address. Returns false if the address isn't
+ * in the table.
+ */
+bool forwarding_table_lookup(const struct ForwardingTable *const table,
+                             const CnetAddr address,
+                             uint32_t *const value);
+
+#endif
@@ -0,0 +1,389 @@
+/*
+ * CC200 Assignment
+ *
+ * Author: Mike Aldred
+ *
+ * Fragmentation
+ *
+ * Description:
+ *   Look at the header file for details.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "config.h"
+#include "data_link_layer.h"
+#include "fragment.h"
+#include "network_layer.h"
+#include "stats.h"
+#include "wire.h"
+
+/*
+ * With reassemblytimeout=0, a message has this many times what its
+ * fragments take to cross the link they arrive on, one after the
+ * other, to be put back together.
+ */
+#define REASSEMBLY_ROUND_TRIPS 4
+
+// A message being put back together, free if buffer is NULL.
+struct Reassembly {
+  struct FrameBuffer *buffer;
+  CnetAddr source;
+  uint32_t id;
+  size_t received;     // Bytes of the message arrived so far.
+  CnetTime started;    // When its first fragment arrived.
+  CnetTimerID timer;
+};
+
+static struct Reassembly reassemblies[MAX_REASSEMBLY_SLOTS];
+
+// Id for the next message this node splits up.
+static uint32_t next_fragment_id;
+
+// Forward declarations
+static size_t fragment_overhead(struct Packet *const packet);
+static struct Reassembly *find_reassembly(const struct Packet *const packet);
+static struct Reassembly *start_reassembly(struct FrameBuffer *const fragment,
+                                           const int in_link);
+static CnetTime reassembly_timeout(const struct Packet *const packet,
+                                   const int in_link);
+static void free_reassembly(struct Reassembly *const reassembly);
+
+/*
+ * Init fragments
+ *
+ * Ids carry on from the time, so fragments from before a reboot that
+ * are still on their way aren't taken for the same message as new
+ * ones.
+ *
+ * Globals:
+ *   reassemblies - All freed.
+ *   next_fragment_id - Set from the time.
+ */
+void init_fragments() {
+  for (int i = 0; i < MAX_REASSEMBLY_SLOTS; ++i) {
+    reassemblies[i].buffer = NULL;
+    reassemblies[i].timer = NULLTIMER;
+  }
+
+  next_fragment_id = (uint32_t) nodeinfo.time_in_usec;
+}
+
+/*
+ * Fragment count
+ *
+ * A packet that isn't a fragment yet is made into one while its
+ * overhead is worked out, with the id it would get, then put back.
+ *
+ * Check header file for details.
+ */
+int fragment_count(struct Packet *const packet, const size_t limit) {
+  if (packet->type != PACKET_DATA || wire_packet_size(packet) <= limit) {
+    return 1;
+  }
+
+  const bool was_fragment = packet->fragment;
+
+  if (!was_fragment) {
+    packet->fragment = true;
+    packet->fragment_id = next_fragment_id;
+    packet->fragment_offset = 0;
+    packet->message_length = packet->length;
+  }
+
+  const size_t overhead = fragment_overhead(packet);
+
+  packet->fragment = was_fragment;
+
+  if (limit < overhead + MIN_FRAGMENT_SIZE) {
+    return 0;
+  }
+
+  const size_t room = limit - overhead;
+
+  return (int) ((packet->length + room - 1) / room);
+}
+
+/*
+ * Fragment packet
+ *
+ * The packet's turned into a fragment first if it isn't one already,
+ * so the header size takes in the fragment fields. Each fragment's
+ * header is copied from the packet's, only the length and offset
+ * change.
+ *
+ * Check header file for details.
+ *
+ * Globals:
+ *   node_stats - Messages split up, and fragments made.
+ */
+int fragment_packet(struct FrameBuffer *const buffer, const size_t limit,
+                    struct FrameBuffer *fragments[MAX_FRAGMENTS]) {
+  struct Packet *packet = &buffer->frame.packet;
+  const int fragments_needed = fragment_count(packet, limit);
+
+  fragments[0] = buffer;
+
+  if (fragments_needed <= 1) {
+    return fragments_needed;
+  }
+
+  if (!packet->fragment) {
+    packet->fragment = true;
+    packet->fragment_id = next_fragment_id++;
+    packet->fragment_offset = 0;
+    packet->message_length = packet->length;
+    ++node_stats.messages_fragmented;
+  }
+
+  const size_t length = packet->length;
+  const size_t count = (size_t) fragments_needed;
+  const size_t size = (length + count - 1) / count;
+
+  // Copied out before the first fragment's header is written over the
+  // rest of the message.
+  for (size_t i = 1; i < count; ++i) {
+    struct FrameBuffer *piece = allocate_frame_buffer();
+    struct Packet *piece_packet = &piece->frame.packet;
+    const size_t start = i * size;
+
+    piece->arrived_time = buffer->arrived_time;
+    memcpy(piece_packet, packet, offsetof(struct Packet, message));
+    piece_packet->fragment_offset = packet->fragment_offset + start;
+    piece_packet->length = (length - start < size) ? length - start : size;
+    memcpy(&piece_packet->message, (unsigned char *) &packet->message + start,
+           piece_packet->length);
+
+    fragments[i] = piece;
+  }
+
+  packet->length = size;
+  node_stats.fragments_sent += count;
+
+  return (int) count;
+}
+
+/*
+ * Reassemble
+ *
+ * Check header file for details.
+ *
+ * Globals:
+ *   node_stats - Messages put back together.
+ */
+struct FrameBuffer *reassemble(struct FrameBuffer *const fragment,
+                               const int in_link) {
+  const struct Packet *packet = &fragment->frame.packet;
+  struct Reassembly *reassembly = find_reassembly(packet);
+
+  if (reassembly == NULL) {
+    reassembly = start_reassembly(fragment, in_link);
+  } else {
+    struct Packet *whole = &reassembly->buffer->frame.packet;
+
+    memcpy((unsigned char *) &whole->message + packet->fragment_offset,
+           &packet->message, packet->length);
+    reassembly->received += packet->length;
+
+    if (packet->hops > whole->hops) {
+      whole->hops = packet->hops;
+    }
+
+    release_frame_buffer(fragment);
+  }
+
+  struct FrameBuffer *buffer = reassembly->buffer;
+  struct Packet *whole = &buffer->frame.packet;
+
+  if (reassembly->received < whole->message_length) {
+    return NULL;
+  }
+
+  whole->fragment = false;
+  whole->length = whole->message_length;
+  ++node_stats.messages_reassembled;
+
+  reassembly->buffer = NULL;
+  free_reassembly(reassembly);
+
+  return buffer;
+}
+
+/*
+ * The message is thrown away, what's arrived of it is no use.
+ */
+EVENT_HANDLER(reassembly_timeouts) {
+  struct Reassembly *reassembly = &reassemblies[(size_t)data];
+
+  reassembly->timer = NULLTIMER;
+
+  if (reassembly->buffer == NULL) {
+    return;
+  }
+
+  ++node_stats.reassembly_timeouts;
+  free_reassembly(reassembly);
+}
+
+void debug_fragments() {
+  printf("Messages reassembling.\n");
+  printf("+--------+------------+----------+--------+------------+\n");
+  printf("| Source |         Id | Received | Length |    Started |\n");
+  printf("+--------+------------+----------+--------+------------+\n");
+  for (int i = 0; i < config.reassembly_slots; ++i) {
+    const struct Reassembly *reassembly = &reassemblies[i];
+
+    if (reassembly->buffer == NULL) {
+      continue;
+    }
+
+    printf("| %6u | %10u | %8u | %6u | %10lld |\n",
+           (unsigned) reassembly->source,
+           (unsigned) reassembly->id,
+           (unsigned) reassembly->received,
+           (unsigned) reassembly->buffer->frame.packet.message_length,
+           (long long) reassembly->started);
+    printf("+--------+------------+----------+--------+------------+\n");
+  }
+}
+
+/*
+ * Fragment overhead
+ *
+ * Bytes a fragment of the packet takes on the wire besides its
+ * message. The offset's varint is sized for the end of the message,
+ * so every fragment's header is covered.
+ */
+static size_t fragment_overhead(struct Packet *const packet) {
+  const size_t length = packet->length;
+  const size_t offset = packet->fragment_offset;
+
+  packet->length = 0;
+  packet->fragment_offset = packet->message_length;
+
+  const size_t overhead = wire_packet_size(packet);
+
+  packet->length = length;
+  packet->fragment_offset = offset;
+
+  return overhead;
+}
+
+/*
+ * Find reassembly
+ *
+ * The slot the fragment's message is being put back together in, NULL
+ * if it's the first of the message to arrive.
+ *
+ * Globals:
+ *   reassemblies - Searched, it's only a few slots.
+ */
+static struct Reassembly *find_reassembly(const struct Packet *const packet) {
+  for (int i = 0; i < config.reassembly_slots; ++i) {
+    struct Reassembly *reassembly = &reassemblies[i];
+
+    if (reassembly->buffer != NULL &&
+        reassembly->source == packet->source_address &&
+        reassembly->id == packet->fragment_id) {
+      return reassembly;
+    }
+  }
+
+  return NULL;
+}
+
+/*
+ * Start reassembly
+ *
+ * Puts the message in a free slot, or in the one that's been going
+ * longest if there isn't one. The fragment's buffer becomes the
+ * message's, with its part moved to where it goes.
+ *
+ * Globals:
+ *   reassemblies - Slot taken.
+ *   node_stats - Messages thrown away for the slot.
+ *   config - Slots to use.
+ */
+static struct Reassembly *start_reassembly(struct FrameBuffer *const fragment,
+                                           const int in_link) {
+  struct Packet *packet = &fragment->frame.packet;
+  struct Reassembly *reassembly = &reassemblies[0];
+
+  for (int i = 0; i < config.reassembly_slots; ++i) {
+    if (reassemblies[i].buffer == NULL) {
+      reassembly = &reassemblies[i];
+      break;
+    }
+
+    if (reassemblies[i].started < reassembly->started) {
+      reassembly = &reassemblies[i];
+    }
+  }
+
+  if (reassembly->buffer != NULL) {
+    ++node_stats.reassembly_dropped;
+    free_reassembly(reassembly);
+  }
+
+  if (packet->fragment_offset > 0) {
+    memmove((unsigned char *) &packet->message + packet->fragment_offset,
+            &packet->message, packet->length);
+  }
+
+  reassembly->buffer = fragment;
+  reassembly->source = packet->source_address;
+  reassembly->id = packet->fragment_id;
+  reassembly->received = packet->length;
+  reassembly->started = nodeinfo.time_in_usec;
+  reassembly->timer = CNET_start_timer(EV_TIMER5,
+                                       reassembly_timeout(packet, in_link),
+                                       (CnetData)(reassembly - reassemblies));
+
+  return reassembly;
+}
+
+/*
+ * Reassembly timeout
+ *
+ * How long the fragment's message has to be put back together,
+ * reassemblytimeout, or if that's 0, REASSEMBLY_ROUND_TRIPS times
+ * what the message's fragments take to cross the link, going by the
+ * size of the first to arrive.
+ *
+ * Globals:
+ *   config - reassemblytimeout.
+ */
+static CnetTime reassembly_timeout(const struct Packet *const packet,
+                                   const int in_link) {
+  if (config.reassembly_timeout > 0) {
+    return config.reassembly_timeout;
+  }
+
+  const size_t count = (packet->message_length + packet->length - 1) /
+      packet->length;
+
+  return REASSEMBLY_ROUND_TRIPS * (CnetTime) count *
+      link_round_trip(in_link, wire_packet_size(packet) +
+                      MAX_DATA_FRAME_OVERHEAD);
+}
+
+/*
+ * Free reassembly
+ *
+ * Releases the slot's buffer, if it still has one, and stops its
+ * timer.
+ */
+static void free_reassembly(struct Reassembly *const reassembly) {
+  if (reassembly->buffer != NULL) {
+    release_frame_buffer(reassembly->buffer);
+    reassembly->buffer = NULL;
+  }
+
+  if (reassembly->timer != NULLTIMER) {
+    CNET_stop_timer(reassembly->timer);
+    reassembly->timer = NULLTIMER;
+  }
+}
@@ -0,0 +1,124 @@
+/*
+ * CC200 Assignment
+ *
+ * Author: Mike Aldred
+ *
+ * Fragmentation
+ *
+ * Description:
+ *
+ *   A message used to go out in a single frame however big it was, so
+ *   a link with a small MTU couldn't carry the larger messages at all,
+ *   and on a slow link one large message held the link for the whole
+ *   of its send, with a bit error anywhere in it meaning all of it was
+ *   sent again.
+ *
+ *   Now when a packet is about to go out on a link it doesn't fit (see
+ *   link_packet_limit), the network layer splits it into fragments
+ *   that do, each a packet of its own with the same header, plus the
+ *   message's id from its source, where the fragment starts in the
+ *   message, and the message's length. The fragments are as near the
+ *   same size as they can be, rather than full ones and a scrap. A
+ *   node forwarding a fragment onto a link with a smaller MTU splits
+ *   it again, the offsets are from the start of the message, so the
+ *   destination doesn't need to know.
+ *
+ *   Fragments are put back together at the destination, before the
+ *   transport layer sees them. The first fragment to arrive keeps its
+ *   frame buffer, with its part of the message moved to where it goes,
+ *   and the rest are copied in as they come, in any order. There are
+ *   reassembly slots for messages being put back together, a fragment
+ *   of another message when they're all in use throws away the
+ *   message that's been reassembling longest. A message not complete
+ *   in time is thrown away too, the time is a few times what its
+ *   fragments take to cross the link they arrive on, or
+ *   reassemblytimeout if that's set.
+ *   With transport=on, a message that's thrown away is sent again by
+ *   its source, in new fragments.
+ *
+ *   The mtu option caps every link's MTU, for trying this out without
+ *   changing the topology.
+ */
+
+#ifndef FRAGMENT_H_
+#define FRAGMENT_H_
+
+#include <cnet.h>
+
+#include "frame_buffer.h"
+
+/*
+ * Smallest a fragment's message can be, a link whose MTU doesn't leave
+ * this much room after the headers can't take fragments. So a message
+ * is never split into more than MAX_FRAGMENTS.
+ */
+#define MIN_FRAGMENT_SIZE 64
+#define MAX_FRAGMENTS (MAX_MESSAGE_SIZE / MIN_FRAGMENT_SIZE)
+
+/*
+ * Init fragments
+ *
+ * Throws away any messages being reassembled, their frame buffers are
+ * already back in the pool after a reboot.
+ */
+void init_fragments();
+
+/*
+ * Fragment count
+ *
+ * How many fragments fragment_packet would split the packet into,
+ * without splitting it, so the caller can check they'll all fit in
+ * the queue first. The packet is left as it was.
+ *
+ * packet - Packet to be sent.
+ * limit - Largest a packet can be on the wire.
+ *
+ * Returns 1 if the packet fits or isn't a data packet, 0 if the limit
+ * is too small to split the packet into.
+ */
+int fragment_count(struct Packet *const packet, const size_t limit);
+
+/*
+ * Fragment packet
+ *
+ * Splits the packet in the buffer into fragments that each fit in
+ * limit bytes on the wire. The buffer keeps the first fragment, the
+ * rest are in new buffers. A packet that already fits, or isn't a
+ * data packet, is left as it is.
+ *
+ * buffer - Buffer holding the packet, the caller still owns it and
+ *          every fragment.
+ * limit - Largest a packet can be on the wire.
+ * fragments - Filled in with the fragments in order, buffer first.
+ *
+ * Returns the number of fragments, 0 if the limit is too small to
+ * split the packet into.
+ */
+int fragment_packet(struct FrameBuffer *const buffer, const size_t limit,
+                    struct FrameBuffer *fragments[MAX_FRAGMENTS]);
+
+/*
+ * Reassemble
+ *
+ * Takes a fragment that's arrived at its destination, and the link it
+ * came in on.
+ *
+ * Returns the buffer with the whole message once its last fragment has
+ * arrived, as a packet that isn't a fragment, NULL until then.
+ */
+struct FrameBuffer *reassemble(struct FrameBuffer *const fragment,
+                               const int in_link);
+
+/*
+ * The event handler for a message that's taken too long to
+ * reassemble. The reassembly slot is passed in via the CNET data
+ * variable.
+ */
+EVENT_HANDLER(reassembly_timeouts);
+
+/*
+ * For printing out the messages being reassembled.
+ */
+void debug_fragments();
+
+#endif
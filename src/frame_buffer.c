@@ -0,0 +1,112 @@
+/*
+ * CC200 Assignment
+ *
+ * Author: Mike Aldred
+ *
+ * Frame Buffers
+ *
+ * Description:
+ *   Look at the header file for details.
+ */
+
+#include <assert.h>
+#include <cnet.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "frame_buffer.h"
+
+// Number of buffers the pool grows by when it runs out.
+#define BUFFERS_PER_CHUNK 32
+
+/*
+ * The pool keeps every chunk it's allocated in a list, so they can all
+ * be put back on the free list on reboot.
+ */
+struct BufferChunk {
+  struct BufferChunk *next;
+  struct FrameBuffer buffers[BUFFERS_PER_CHUNK];
+};
+
+static struct BufferChunk *chunks = NULL;
+static struct FrameBuffer *free_buffers = NULL;
+
+static size_t buffers_total = 0;
+static size_t buffers_in_use = 0;
+static size_t buffers_high_water = 0;
+
+// Forward declarations
+static void add_chunk();
+static void free_chunk_buffers(struct BufferChunk *const chunk);
+
+void init_frame_buffers() {
+  free_buffers = NULL;
+
+  for (struct BufferChunk *chunk = chunks; chunk != NULL; chunk = chunk->next) {
+    free_chunk_buffers(chunk);
+  }
+
+  buffers_in_use = 0;
+  buffers_high_water = 0;
+}
+
+struct FrameBuffer *allocate_frame_buffer() {
+  if (free_buffers == NULL) {
+    add_chunk();
+  }
+
+  struct FrameBuffer *buffer = free_buffers;
+  free_buffers = buffer->next_free;
+  buffer->next_free = NULL;
+
+  ++buffers_in_use;
+  if (buffers_in_use > buffers_high_water) {
+    buffers_high_water = buffers_in_use;
+  }
+
+  return buffer;
+}
+
+void release_frame_buffer(struct FrameBuffer *const buffer) {
+  buffer->next_free = free_buffers;
+  free_buffers = buffer;
+  --buffers_in_use;
+}
+
+void debug_frame_buffers() {
+  printf("Frame buffers: %zu allocated, %zu in use, high water %zu.\n",
+         buffers_total, buffers_in_use, buffers_high_water);
+}
+
+/*
+ * Add chunk
+ *
+ * The pool is empty, so allocate another chunk of buffers and put
+ * them on the free list.
+ */
+static void add_chunk() {
+  struct BufferChunk *chunk =
+      (struct BufferChunk *)malloc(sizeof(struct BufferChunk));
+
+  // If we can't allocate memory for this, it's a serious problem
+  // can't recover from.
+  assert(chunk);
+
+  chunk->next = chunks;
+  chunks = chunk;
+  buffers_total += BUFFERS_PER_CHUNK;
+
+  free_chunk_buffers(chunk);
+}
+
+/*
+ * Free chunk buffers
+ *
+ * Puts every buffer in the chunk on the free list.
+ */
+static void free_chunk_buffers(struct BufferChunk *const chunk) {
+  for (int i = 0; i < BUFFERS_PER_CHUNK; ++i) {
+    chunk->buffers[i].next_free = free_buffers;
+    free_buffers = &chunk->buffers[i];
+  }
+}
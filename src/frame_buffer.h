@@ -0,0 +1,74 @@
+/*
+ * CC200 Assignment
+ *
+ * Author: Mike Aldred
+ *
+ * Frame Buffers
+ *
+ * Description:
+ *
+ *   A frame buffer holds a whole frame, with room for every layer's
+ *   header in front of the message. A message is read from the
+ *   application (or a frame from the physical layer) straight into a
+ *   buffer, and from then on only a pointer to the buffer is handed
+ *   between the layers. Each layer fills in its own header in place,
+ *   so the message itself is never copied on the way down, and a
+ *   forwarded packet goes back out of the same buffer it came in on.
+ *
+ *   Whoever holds the pointer owns the buffer, it has to be either
+ *   passed on or released.
+ *
+ *   Buffers come from a pool, which grows a chunk at a time, and are
+ *   never given back to the heap, so after the first few messages
+ *   there's no heap traffic at all.
+ */
+
+#ifndef FRAME_BUFFER_H_
+#define FRAME_BUFFER_H_
+
+#include "data_link_layer.h"
+#include "wire.h"
+
+struct FrameBuffer {
+  struct FrameBuffer *next_free;
+
+  // When the frame arrived off the wire, and when the packet was put
+  // on a link's queue.
+  CnetTime arrived_time;
+  CnetTime queued_time;
+
+  struct Frame frame;
+
+  // The packed header goes after the message, see wire.h.
+  unsigned char trailer[MAX_WIRE_TRAILER_SIZE];
+};
+
+/*
+ * Init frame buffers
+ *
+ * Called on reboot, every buffer goes back into the pool, anything
+ * still holding one from before the reboot has been reset anyway.
+ */
+void init_frame_buffers();
+
+/*
+ * Allocate frame buffer
+ *
+ * Takes a buffer out of the pool. The contents are whatever was left
+ * in it last time.
+ */
+struct FrameBuffer *allocate_frame_buffer();
+
+/*
+ * Release frame buffer
+ *
+ * Puts a buffer back into the pool.
+ */
+void release_frame_buffer(struct FrameBuffer *const buffer);
+
+/*
+ * For printing out debug information about the pool.
+ */
+void debug_frame_buffers();
+
+#endif
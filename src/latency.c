@@ -0,0 +1,296 @@
+/*
+ * CC200 Assignment
+ *
+ * Author: Mike Aldred
+ *
+ * Latency
+ *
+ * Description:
+ *   Look at the header file for details.
+ */
+
+#include <assert.h>
+#include <cnet.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "forwarding_table.h"
+#include "latency.h"
+
+/*
+ * Latencies under SUB_BUCKETS usecs get a bucket each, above that
+ * every power of two is split into SUB_BUCKETS buckets. Anything
+ * past MAX_LATENCY_BITS (about 12 days) goes in the last bucket.
+ */
+#define SUB_BUCKET_BITS 4
+#define SUB_BUCKETS (1 << SUB_BUCKET_BITS)
+#define MAX_LATENCY_BITS 40
+#define LATENCY_BUCKETS ((MAX_LATENCY_BITS - SUB_BUCKET_BITS + 1) * SUB_BUCKETS)
+
+struct SourceLatency {
+  CnetAddr source;
+  unsigned long long samples;
+  CnetTime min;
+  CnetTime max;
+  int min_hops;
+  int max_hops;
+
+  // Route taken by the slowest packet, if it was traced.
+  int slowest_trace_length;
+  CnetAddr slowest_trace[MAX_TRACE_HOPS];
+
+  uint32_t buckets[LATENCY_BUCKETS];
+};
+
+// Latencies by traffic class, the source is left as 0.
+static struct SourceLatency classes[TRAFFIC_CLASSES];
+
+static struct SourceLatency *sources = NULL;
+static int source_count = 0;
+static int source_capacity = 0;
+
+// Source address to index in sources.
+static struct ForwardingTable source_index = {NULL, 0, 0};
+
+// Forward declarations
+static struct SourceLatency *find_source(const CnetAddr address);
+static void add_sample(struct SourceLatency *const latency,
+                       const struct Packet *const packet);
+static CnetTime percentile(const struct SourceLatency *const latency,
+                           const int percent);
+static int bucket(CnetTime latency);
+static CnetTime bucket_value(const int index);
+
+void init_latency() {
+  memset(classes, 0, sizeof(classes));
+  source_count = 0;
+  setup_forwarding_table(&source_index);
+}
+
+void record_delivery(const struct Packet *const packet) {
+  add_sample(find_source(packet->source_address), packet);
+  add_sample(&classes[packet_class(packet)], packet);
+}
+
+int latency_sources() {
+  return source_count;
+}
+
+CnetAddr latency_source(const int source) {
+  return sources[source].source;
+}
+
+unsigned long long latency_samples(const int source) {
+  return sources[source].samples;
+}
+
+CnetTime latency_percentile(const int source, const int percent) {
+  return percentile(&sources[source], percent);
+}
+
+unsigned long long class_latency_samples(const enum TrafficClass class_id) {
+  return classes[class_id].samples;
+}
+
+CnetTime class_latency_percentile(const enum TrafficClass class_id,
+                                  const int percent) {
+  return percentile(&classes[class_id], percent);
+}
+
+/*
+ * Percentile
+ *
+ * Walks the buckets until percent of the samples have been passed,
+ * and gives back the middle of that bucket, kept inside the smallest
+ * and largest latencies actually seen.
+ */
+static CnetTime percentile(const struct SourceLatency *const latency,
+                           const int percent) {
+  if (latency->samples == 0) {
+    return 0;
+  }
+
+  // Rank of the sample wanted, rounded up, from 1.
+  unsigned long long rank = (latency->samples * percent + 99) / 100;
+  unsigned long long seen = 0;
+
+  if (rank == 0) {
+    rank = 1;
+  }
+
+  for (int i = 0; i < LATENCY_BUCKETS; ++i) {
+    seen += latency->buckets[i];
+
+    if (seen >= rank) {
+      const CnetTime value = (bucket_value(i) + bucket_value(i + 1)) / 2;
+
+      if (value < latency->min) {
+        return latency->min;
+      }
+
+      return (value > latency->max) ? latency->max : value;
+    }
+  }
+
+  return latency->max;
+}
+
+void debug_latency() {
+  printf("Latency of messages delivered (usecs).\n");
+  printf("+--------+---------+----------+----------+----------+----------+------+\n");
+  printf("| Source | Samples |   p50    |   p95    |   p99    |   Max    | Hops |\n");
+  printf("+--------+---------+----------+----------+----------+----------+------+\n");
+  for (int i = 0; i < source_count; ++i) {
+    const struct SourceLatency *latency = &sources[i];
+
+    printf("| %6d | %7llu | %8lld | %8lld | %8lld | %8lld | %2d-%-2d|\n",
+           (int) latency->source,
+           latency->samples,
+           (long long) latency_percentile(i, 50),
+           (long long) latency_percentile(i, 95),
+           (long long) latency_percentile(i, 99),
+           (long long) latency->max,
+           latency->min_hops,
+           latency->max_hops);
+    printf("+--------+---------+----------+----------+----------+----------+------+\n");
+  }
+
+  printf("Latency by traffic class (usecs).\n");
+  printf("+-------------+---------+----------+----------+----------+----------+\n");
+  printf("| Class       | Samples |   p50    |   p95    |   p99    |   Max    |\n");
+  printf("+-------------+---------+----------+----------+----------+----------+\n");
+  for (int i = 0; i < TRAFFIC_CLASSES; ++i) {
+    const struct SourceLatency *latency = &classes[i];
+
+    printf("| %-11s | %7llu | %8lld | %8lld | %8lld | %8lld |\n",
+           traffic_class_name((enum TrafficClass) i),
+           latency->samples,
+           (long long) percentile(latency, 50),
+           (long long) percentile(latency, 95),
+           (long long) percentile(latency, 99),
+           (long long) latency->max);
+    printf("+-------------+---------+----------+----------+----------+----------+\n");
+  }
+
+  for (int i = 0; i < source_count; ++i) {
+    const struct SourceLatency *latency = &sources[i];
+
+    if (latency->slowest_trace_length == 0) {
+      continue;
+    }
+
+    printf("Slowest from %d:", (int) latency->source);
+    for (int hop = 0; hop < latency->slowest_trace_length; ++hop) {
+      printf(" %d ->", (int) latency->slowest_trace[hop]);
+    }
+    printf(" %d\n", (int) nodeinfo.address);
+  }
+}
+
+/*
+ * Find source
+ *
+ * The latencies for the source address, added if it hasn't been seen
+ * before.
+ *
+ * Globals:
+ *   sources, source_count - Grown for a new source.
+ *   source_index - New source added.
+ */
+static struct SourceLatency *find_source(const CnetAddr address) {
+  uint32_t index;
+
+  if (forwarding_table_lookup(&source_index, address, &index)) {
+    return &sources[index];
+  }
+
+  if (source_count == source_capacity) {
+    source_capacity = (source_capacity == 0) ? 8 : source_capacity * 2;
+    sources = (struct SourceLatency *)realloc(
+        sources, source_capacity * sizeof(struct SourceLatency));
+
+    // If we can't allocate memory for this, it's a serious problem
+    // can't recover from.
+    assert(sources);
+  }
+
+  struct SourceLatency *source = &sources[source_count];
+
+  memset(source, 0, sizeof(struct SourceLatency));
+  source->source = address;
+  forwarding_table_insert(&source_index, address, (uint32_t) source_count);
+  ++source_count;
+
+  return source;
+}
+
+/*
+ * Add sample
+ *
+ * Puts the packet's latency and hops into the histogram.
+ */
+static void add_sample(struct SourceLatency *const latency,
+                       const struct Packet *const packet) {
+  const CnetTime sample = nodeinfo.time_in_usec - packet->sent_time;
+
+  if (latency->samples == 0 || sample < latency->min) {
+    latency->min = sample;
+  }
+
+  if (latency->samples == 0 || packet->hops < latency->min_hops) {
+    latency->min_hops = packet->hops;
+  }
+
+  if (packet->hops > latency->max_hops) {
+    latency->max_hops = packet->hops;
+  }
+
+  if (latency->samples == 0 || sample > latency->max) {
+    latency->max = sample;
+    latency->slowest_trace_length = packet->trace_length;
+    memcpy(latency->slowest_trace, packet->trace,
+           packet->trace_length * sizeof(CnetAddr));
+  }
+
+  ++latency->buckets[bucket(sample)];
+  ++latency->samples;
+}
+
+/*
+ * Bucket
+ *
+ * Which histogram bucket the latency goes in.
+ */
+static int bucket(CnetTime latency) {
+  if (latency < SUB_BUCKETS) {
+    return (latency < 0) ? 0 : (int) latency;
+  }
+
+  int shift = 0;
+
+  while ((latency >> shift) >= 2 * SUB_BUCKETS) {
+    ++shift;
+  }
+
+  const int index = (shift + 1) * SUB_BUCKETS +
+      (int)((latency >> shift) & (SUB_BUCKETS - 1));
+
+  return (index < LATENCY_BUCKETS) ? index : LATENCY_BUCKETS - 1;
+}
+
+/*
+ * Bucket value
+ *
+ * The smallest latency that goes in the bucket.
+ */
+static CnetTime bucket_value(const int index) {
+  if (index < SUB_BUCKETS) {
+    return index;
+  }
+
+  const int shift = index / SUB_BUCKETS - 1;
+
+  return (CnetTime)(SUB_BUCKETS + index % SUB_BUCKETS) << shift;
+}
@@ -0,0 +1,97 @@
+/*
+ * CC200 Assignment
+ *
+ * Author: Mike Aldred
+ *
+ * Latency
+ *
+ * Description:
+ *
+ *   End to end latency of the messages delivered to this node, kept
+ *   separately for each source. Every packet is stamped with the time
+ *   it left its source, so when it arrives the latency goes into the
+ *   source's histogram, along with how many hops it took.
+ *
+ *   The histograms have 16 buckets for each power of two, so a
+ *   percentile read off one is within about 6% of the real value, and
+ *   recording a sample costs the same however many there have been.
+ *
+ *   With trace=on, the route taken by the slowest packet from each
+ *   source is kept too, which shows the path behind the tail latency.
+ *
+ *   The same histograms are kept for each traffic class (see
+ *   network_layer.h), from every source, to compare how the classes
+ *   fare with qos on and off.
+ */
+
+#ifndef LATENCY_H_
+#define LATENCY_H_
+
+#include <cnet.h>
+#include <stdio.h>
+
+#include "network_layer.h"
+
+/*
+ * Init latency
+ *
+ * Forgets every source and sample.
+ */
+void init_latency();
+
+/*
+ * Record delivery
+ *
+ * Called by the transport layer with each packet whose message is
+ * passed up to the application. With transport=on, the time is from
+ * when the copy that arrived was sent, retransmitted or not.
+ */
+void record_delivery(const struct Packet *const packet);
+
+/*
+ * Latency sources
+ *
+ * Number of sources that have delivered to this node. The sources are
+ * numbered from 0 for the functions below, in the order they were
+ * first heard from.
+ */
+int latency_sources();
+
+/*
+ * Latency source
+ *
+ * Address of the source.
+ */
+CnetAddr latency_source(const int source);
+
+/*
+ * Latency samples
+ *
+ * Number of messages delivered from the source.
+ */
+unsigned long long latency_samples(const int source);
+
+/*
+ * Latency percentile
+ *
+ * The latency, in usecs, that percent of the messages from the source
+ * arrived within. 0 if there aren't any.
+ */
+CnetTime latency_percentile(const int source, const int percent);
+
+/*
+ * Class latency samples and percentile
+ *
+ * The same, for the messages in a traffic class, from every source.
+ */
+unsigned long long class_latency_samples(const enum TrafficClass class_id);
+CnetTime class_latency_percentile(const enum TrafficClass class_id,
+                                  const int percent);
+
+/*
+ * For printing out the percentiles, hops, and slowest route for each
+ * source.
+ */
+void debug_latency();
+
+#endif
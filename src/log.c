@@ -0,0 +1,125 @@
+/*
+ * CC200 Assignment
+ *
+ * Author: Mike Aldred
+ *
+ * Logging
+ *
+ * Description:
+ *   Look at the header file for details.
+ */
+
+#include <cnet.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "log.h"
+
+// Number of lines held before the ring is flushed.
+#define LOG_RING_SIZE 1024
+
+// Lines are formatted into here, and written out when it fills.
+#define LOG_OUTPUT_SIZE 65536
+
+// Longest a single formatted line can be.
+#define LOG_LINE_SIZE 256
+
+struct LogRecord {
+  CnetTime time;
+  int level;
+  const char *format;
+  int args[LOG_MAX_ARGS];
+};
+
+static struct LogRecord ring[LOG_RING_SIZE];
+static size_t ring_head = 0;
+static size_t ring_count = 0;
+
+static const char *const level_names[] = {"", "ERROR", "WARN", "INFO", "DEBUG"};
+
+// Forward declarations
+static size_t format_record(const struct LogRecord *const record,
+                            char *const out, const size_t size);
+
+void init_log() {
+  ring_head = 0;
+  ring_count = 0;
+}
+
+void log_record(const int level, const char *const format, ...) {
+  if (ring_count == LOG_RING_SIZE) {
+    flush_log();
+  }
+
+  struct LogRecord *record = &ring[(ring_head + ring_count) % LOG_RING_SIZE];
+  va_list args;
+
+  record->time = nodeinfo.time_in_usec;
+  record->level = level;
+  record->format = format;
+
+  va_start(args, format);
+  for (int i = 0; i < LOG_MAX_ARGS; ++i) {
+    record->args[i] = va_arg(args, int);
+  }
+  va_end(args);
+
+  ++ring_count;
+}
+
+/*
+ * Flush log
+ *
+ * The lines are formatted into one big buffer, which is written out
+ * with a single fwrite whenever it fills, rather than a printf each.
+ */
+void flush_log() {
+  static char output[LOG_OUTPUT_SIZE];
+  size_t used = 0;
+
+  for (; ring_count > 0; --ring_count) {
+    if (LOG_OUTPUT_SIZE - used < LOG_LINE_SIZE) {
+      fwrite(output, 1, used, stdout);
+      used = 0;
+    }
+
+    used += format_record(&ring[ring_head], output + used, LOG_LINE_SIZE);
+    ring_head = (ring_head + 1) % LOG_RING_SIZE;
+  }
+
+  fwrite(output, 1, used, stdout);
+  fflush(stdout);
+  ring_head = 0;
+}
+
+/*
+ * Format record
+ *
+ * Writes the line out as "time node LEVEL message".
+ *
+ * Returns the number of characters written, never more than size - 1.
+ */
+static size_t format_record(const struct LogRecord *const record,
+                            char *const out, const size_t size) {
+  int length = snprintf(out, size, "%10lld %s %-5s ",
+                        (long long) record->time, nodeinfo.nodename,
+                        level_names[record->level]);
+
+  if (length < 0 || (size_t) length >= size) {
+    return size - 1;
+  }
+
+  const int message_length = snprintf(out + length, size - length,
+                                      record->format,
+                                      record->args[0], record->args[1],
+                                      record->args[2], record->args[3]);
+
+  if (message_length < 0 || (size_t)(length + message_length) >= size) {
+    // Cut short, at least keep it on its own line.
+    out[size - 2] = '\n';
+    return size - 1;
+  }
+
+  return length + message_length;
+}
@@ -0,0 +1,102 @@
+/*
+ * CC200 Assignment
+ *
+ * Author: Mike Aldred
+ *
+ * Logging
+ *
+ * Description:
+ *
+ *   Printing a line for every frame sent and received was most of the
+ *   time a simulation took, so log lines now go through here instead
+ *   of straight to printf.
+ *
+ *   Each line has a level. Anything above LOG_LEVEL is compiled out
+ *   altogether, arguments and all. LOG_LEVEL defaults to
+ *   LOG_LEVEL_INFO, which leaves out the per frame lines, add
+ *   -DLOG_LEVEL=LOG_LEVEL_DEBUG to the compile line in ASSIGNMENT.MAP
+ *   to get them back.
+ *
+ *   Lines that are compiled in aren't formatted straight away. The
+ *   time, format string and arguments are saved in a ring of records
+ *   for the node, and the whole ring is formatted and written out in
+ *   one go when it fills up, when the debug button is pressed, and at
+ *   shutdown. So the format has to be a string literal, and the
+ *   arguments have to be ints, at most LOG_MAX_ARGS of them.
+ */
+
+#ifndef LOG_H_
+#define LOG_H_
+
+#include <cnet.h>
+
+#define LOG_LEVEL_NONE 0
+#define LOG_LEVEL_ERROR 1
+#define LOG_LEVEL_WARN 2
+#define LOG_LEVEL_INFO 3
+#define LOG_LEVEL_DEBUG 4
+
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_INFO
+#endif
+
+// Most arguments a log line can have.
+#define LOG_MAX_ARGS 4
+
+/*
+ * The zeros pad out the arguments, so log_record can always read
+ * LOG_MAX_ARGS of them. printf ignores any the format doesn't use.
+ */
+#define LOG_RECORD(level, ...) log_record((level), __VA_ARGS__, 0, 0, 0, 0)
+
+#if LOG_LEVEL >= LOG_LEVEL_ERROR
+#define LOG_ERROR(...) LOG_RECORD(LOG_LEVEL_ERROR, __VA_ARGS__)
+#else
+#define LOG_ERROR(...) do {} while (0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_WARN
+#define LOG_WARN(...) LOG_RECORD(LOG_LEVEL_WARN, __VA_ARGS__)
+#else
+#define LOG_WARN(...) do {} while (0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_INFO
+#define LOG_INFO(...) LOG_RECORD(LOG_LEVEL_INFO, __VA_ARGS__)
+#else
+#define LOG_INFO(...) do {} while (0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(...) LOG_RECORD(LOG_LEVEL_DEBUG, __VA_ARGS__)
+#else
+#define LOG_DEBUG(...) do {} while (0)
+#endif
+
+/*
+ * Init log
+ *
+ * Throws away anything left in the ring from before a reboot.
+ */
+void init_log();
+
+/*
+ * Log record
+ *
+ * Use the LOG_ macros rather than calling this. Saves a line in the
+ * ring, flushing the ring first if it's full.
+ *
+ * level - LOG_LEVEL_ of the line.
+ * format - printf format, has to be a string literal.
+ * ... - LOG_MAX_ARGS ints.
+ */
+void log_record(const int level, const char *const format, ...);
+
+/*
+ * Flush log
+ *
+ * Formats every line in the ring and writes them all out.
+ */
+void flush_log();
+
+#endif
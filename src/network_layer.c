@@ -11,103 +11,355 @@
  */
 
 #include <cnet.h>
-#include <string.h>
 
 #include "application_layer.h"
+#include "config.h"
 #include "network_layer.h"
 #include "data_link_layer.h"
-
-/*
- * Routing Table
- *
- * There's no need for dynamic routing, so we will just have a
- * hardcoded static table for routing. This, and the NUM_NODES
- * constant must be updated if there's any changes in the topography
- * file.
- *
- * The routing table is a simple matrix, the first index is the
- * current node address, and the second index is the destination node
- * address. This will return the link number to send the packet out
- * onto.
- */
-#define NUM_NODES 5
-
-static const int routing_table[NUM_NODES][NUM_NODES] = {{0, 1, 2, 2, 2},
-                                                        {1, 0, 2, 2, 2},
-                                                        {1, 2, 0, 3, 4},
-                                                        {2, 2, 2, 0, 1},
-                                                        {2, 2, 2, 1, 0}};
+#include "fragment.h"
+#include "frame_buffer.h"
+#include "latency.h"
+#include "log.h"
+#include "routing.h"
+#include "stats.h"
+#include "transport_layer.h"
+#include "wire.h"
 
 /*
  * Forward function declarations.
  */
 static int link_to_use(const struct Packet *const in_packet);
-static size_t packet_size(const struct Packet *const packet);
-
-void application_down_to_network(const CnetAddr destination_address,
-                                 const struct Message *const message,
-                                 const size_t length) {
+static int least_loaded_link(const struct Route *const route);
+static bool uses_link(const struct Route *const route, const int link);
+static void update_application(const CnetAddr destination);
+static void add_to_trace(struct Packet *const packet);
+static void send_on_link(const int out_link, struct FrameBuffer *const buffer);
 
-  // Stack automatic safe because it gets copied.
-  struct Packet outgoing_packet;
+void transport_down_to_network(const CnetAddr destination_address,
+                               struct FrameBuffer *const buffer,
+                               const size_t length) {
+  struct Packet *outgoing_packet = &buffer->frame.packet;
 
-  // Build the packet.
-  outgoing_packet.destination_address = destination_address;
-  outgoing_packet.source_address = nodeinfo.address;
-  outgoing_packet.length = length;
-  memcpy(&outgoing_packet.message, message, length);
+  // Build the packet, the message is already in place.
+  outgoing_packet->destination_address = destination_address;
+  outgoing_packet->source_address = nodeinfo.address;
+  outgoing_packet->length = length;
+  outgoing_packet->sent_time = nodeinfo.time_in_usec;
+  outgoing_packet->hops = 0;
+  outgoing_packet->trace_length = 0;
+  outgoing_packet->fragment = false;
 
   // Routing table lookup.
-  down_to_datalink_from_network(link_to_use(&outgoing_packet),
-                                &outgoing_packet,
-                                packet_size(&outgoing_packet));
+  const int out_link = link_to_use(outgoing_packet);
+
+  if (out_link == 0) {
+    // The route went away before the application caught up.
+    LOG_WARN("No route to %d, message dropped.\n", destination_address);
+    ++node_stats.packets_unroutable;
+    release_frame_buffer(buffer);
+    return;
+  }
+
+  add_to_trace(outgoing_packet);
+  send_on_link(out_link, buffer);
 }
 
-void datalink_up_to_network(const struct Packet *const in_packet) {
-  printf("Node: %d. Src: %d. Dst: %d. ",
-         nodeinfo.address,
-         in_packet->source_address,
-         in_packet->destination_address);
+void datalink_up_to_network(struct FrameBuffer *const in_buffer,
+                            const int in_link) {
+  struct Packet *in_packet = &in_buffer->frame.packet;
+
+  routing_heard(in_link);
+
+  if (in_packet->type == PACKET_ROUTING) {
+    routing_update(in_link, in_packet);
+    release_frame_buffer(in_buffer);
+    return;
+  }
+
+  ++in_packet->hops;
 
   if (in_packet->destination_address == nodeinfo.address) {
     // Packet is for this node.
-    printf("Arrived at destination node.\n");
-    network_up_to_application(&in_packet->message, in_packet->length);
+    LOG_DEBUG("Src: %d. Dst: %d. Arrived at destination node.\n",
+              in_packet->source_address, in_packet->destination_address);
+
+    // A fragment's message goes up once all its fragments are here.
+    struct FrameBuffer *whole = in_packet->fragment ?
+        reassemble(in_buffer, in_link) : in_buffer;
+
+    if (whole != NULL) {
+      network_up_to_transport(whole);
+    }
   } else {
     // Not for this node, forward it on.
-    printf("Forwarding packet for Node: %d\n",
-           in_packet->destination_address);
+    LOG_DEBUG("Src: %d. Dst: %d. Forwarding packet.\n",
+              in_packet->source_address, in_packet->destination_address);
+
+    // Anything that's come this far is going round in a loop.
+    if (in_packet->hops >= MAX_ROUTE_HOPS) {
+      LOG_WARN("Packet for %d out of hops, dropped.\n",
+               in_packet->destination_address);
+      ++node_stats.packets_expired;
+      release_frame_buffer(in_buffer);
+      return;
+    }
+
+    const int out_link = link_to_use(in_packet);
+
+    if (out_link == 0) {
+      LOG_WARN("No route to %d, packet dropped.\n",
+               in_packet->destination_address);
+      ++node_stats.packets_unroutable;
+      release_frame_buffer(in_buffer);
+      return;
+    }
+
+    ++node_stats.packets_forwarded;
+    add_to_trace(in_packet);
+    send_on_link(out_link, in_buffer);
+  }
+}
+
+bool network_has_room(struct Packet *const packet, const int packet_count) {
+  if (packet->type == PACKET_ROUTING ||
+      packet->destination_address == nodeinfo.address) {
+    return true;
+  }
+
+  // Dropped anyway if there's no route, or the link's MTU is too small.
+  const int out_link = link_to_use(packet);
+
+  if (out_link == 0) {
+    return true;
+  }
+
+  const int needed = fragment_count(packet, link_packet_limit(out_link));
+
+  return link_queue_room(out_link, packet) >=
+      (size_t) needed * (size_t) packet_count;
+}
 
-    down_to_datalink_from_network(link_to_use(in_packet),
-                                  in_packet,
-                                  packet_size(in_packet));
+void datalink_congestion_changed(const int link, const bool congested) {
+  // Log lines can only have int arguments.
+  if (congested) {
+    LOG_INFO("Link %d congested.\n", link);
+  } else {
+    LOG_INFO("Link %d clear.\n", link);
   }
+
+  size_t count;
+  const struct Route *routes = route_table(&count);
+
+  for (size_t i = 0; i < count; ++i) {
+    if (uses_link(&routes[i], link)) {
+      update_application(routes[i].destination);
+    }
+  }
+}
+
+void network_route_changed(const CnetAddr destination) {
+  update_application(destination);
+}
+
+void transport_window_changed(const CnetAddr destination) {
+  update_application(destination);
 }
 
 /*
  * Link to use
  *
  * Takes a packet and will return which link to send that packet out
- * onto.
+ * onto, 0 if there's no route.
+ *
+ * With multipath on, and more than one usable link, per flow picks a
+ * link from a hash of the source and destination, so a flow always
+ * takes the same path, unless that link is congested. Per packet
+ * always picks the least loaded link.
  */
 static int link_to_use(const struct Packet *const packet) {
-  return routing_table[nodeinfo.address][packet->destination_address];
+  const struct Route *route = route_to(packet->destination_address);
+
+  if (route == NULL || route->link == 0) {
+    return 0;
+  }
+
+  if (config.multipath_mode == MULTIPATH_OFF || route->link_count == 1) {
+    return route->link;
+  }
+
+  if (config.multipath_mode == MULTIPATH_FLOW) {
+    const uint32_t flow_hash =
+        ((uint32_t) packet->source_address * 2654435761u) ^
+        (uint32_t) packet->destination_address;
+    const int link = route->links[flow_hash % route->link_count];
+
+    if (!link_is_congested(link)) {
+      return link;
+    }
+  }
+
+  return least_loaded_link(route);
+}
+
+/*
+ * Least loaded link
+ *
+ * Of the route's links, the one with the least queued on it. Ties go
+ * to the cheaper link.
+ */
+static int least_loaded_link(const struct Route *const route) {
+  int best_link = route->links[0];
+  size_t best_depth = link_queue_depth(best_link);
+
+  for (int i = 1; i < route->link_count; ++i) {
+    const size_t depth = link_queue_depth(route->links[i]);
+
+    if (depth < best_depth) {
+      best_link = route->links[i];
+      best_depth = depth;
+    }
+  }
+
+  return best_link;
+}
+
+/*
+ * Uses link
+ *
+ * True if packets for the route can be sent out on the link.
+ */
+static bool uses_link(const struct Route *const route, const int link) {
+  if (config.multipath_mode == MULTIPATH_OFF) {
+    return route->link == link;
+  }
+
+  for (int i = 0; i < route->link_count; ++i) {
+    if (route->links[i] == link) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+/*
+ * Update application
+ *
+ * Turns the application on for the destination if it has a settled
+ * route over a link that isn't congested, and room in its transport
+ * window, otherwise off. With multipath, any of the route's links will
+ * do.
+ */
+static void update_application(const CnetAddr destination) {
+  const struct Route *route = route_to(destination);
+  bool usable = false;
+
+  if (route != NULL && !route->settling) {
+    for (int link = 1; link <= nodeinfo.nlinks && !usable; ++link) {
+      usable = uses_link(route, link) && !link_is_congested(link);
+    }
+  }
+
+  if (usable && transport_window_open(destination)) {
+    CHECK(CNET_enable_application(destination));
+  } else {
+    CHECK(CNET_disable_application(destination));
+  }
+}
+
+/*
+ * Add to trace
+ *
+ * With tracing on, adds this node to the packet's trace as it's sent
+ * on, as long as there's room.
+ */
+static void add_to_trace(struct Packet *const packet) {
+  if (config.trace && packet->trace_length < MAX_TRACE_HOPS) {
+    packet->trace[packet->trace_length++] = nodeinfo.address;
+  }
+}
+
+/*
+ * Send on link
+ *
+ * Hands the packet to the data link layer, split into fragments first
+ * if it's too big for the link. A link too small for fragments can't
+ * take the packet at all. With transport=on, if the link's queue
+ * hasn't room for every fragment, none are sent, the ones that were
+ * would only be thrown away at the destination. With it off the data
+ * link layer queues them all, having already refused the frame if
+ * there wasn't room (see network_has_room).
+ *
+ * Globals:
+ *   node_stats - Packets that couldn't be sent.
+ *   config - Transport mode.
+ */
+static void send_on_link(const int out_link, struct FrameBuffer *const buffer) {
+  struct FrameBuffer *fragments[MAX_FRAGMENTS];
+  struct Packet *packet = &buffer->frame.packet;
+  const size_t limit = link_packet_limit(out_link);
+  const int needed = fragment_count(packet, limit);
+
+  if (needed == 0) {
+    LOG_WARN("MTU on link %d too small, packet dropped.\n", out_link);
+    ++node_stats.packets_unroutable;
+    release_frame_buffer(buffer);
+    return;
+  }
+
+  if (config.transport && needed > 1 &&
+      link_queue_room(out_link, packet) < (size_t) needed) {
+    LOG_WARN("No room on link %d for every fragment, message dropped.\n",
+             out_link);
+    ++node_stats.fragmented_dropped;
+    release_frame_buffer(buffer);
+    return;
+  }
+
+  const int count = fragment_packet(buffer, limit, fragments);
+
+  for (int i = 0; i < count; ++i) {
+    down_to_datalink_from_network(out_link, fragments[i],
+                                  packet_size(&fragments[i]->frame.packet));
+  }
 }
 
 /*
  * Packet size
  *
  * Given a pointer to the packet, it will return the total used size
- * for the packet. This is why the application message must be at the
- * end of the Package struct.
+ * for the packet, as it's sent on the wire.
  *
- * This was a macro, but application_down_to_network had a struct
+ * This was a macro, but transport_down_to_network had a struct
  * directly while datalink_up_to_network uses a pointer. This resulted
  * in a messy (*in_packet) inside the macro args.
  */
-static size_t packet_size(const struct Packet *const packet) {
-  const size_t packet_header_size = sizeof(struct Packet) -
-      sizeof(struct Message);
+size_t packet_size(const struct Packet *const packet) {
+  return wire_packet_size(packet);
+}
+
+/*
+ * Packet class
+ *
+ * The class goes by size even with qos=off, when every class shares
+ * the one queue, so the stats for each class can still be compared.
+ */
+enum TrafficClass packet_class(const struct Packet *const packet) {
+  if (packet->type != PACKET_DATA) {
+    return CLASS_CONTROL;
+  }
 
-  return packet_header_size + packet->length;
+  return (packet->length <= (size_t) config.qos_small) ?
+      CLASS_INTERACTIVE : CLASS_BULK;
+}
+
+const char *traffic_class_name(const enum TrafficClass traffic_class) {
+  switch (traffic_class) {
+    case CLASS_CONTROL:
+      return "control";
+    case CLASS_INTERACTIVE:
+      return "interactive";
+    default:
+      return "bulk";
+  }
 }
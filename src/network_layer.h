@@ -15,39 +15,186 @@
 #ifndef NETWORK_LAYER_H_
 #define NETWORK_LAYER_H_
 
+#include <stdbool.h>
+#include <stdint.h>
+
 #include "application_layer.h"
 
+struct FrameBuffer;
+
+// Most nodes a packet trace can hold.
+#define MAX_TRACE_HOPS 8
+
+/*
+ * Data packets carry application messages, routing packets carry
+ * distance vectors between neighbours (see routing.h), and ACK packets
+ * carry end to end ACKs back to a message's source (see
+ * transport_layer.h).
+ */
+enum PacketType {
+  PACKET_DATA,
+  PACKET_ROUTING,
+  PACKET_ACK};
+
+/*
+ * Traffic classes, for sharing a link between packets (see
+ * packet_queue.h). Control is routing and ACK packets. Data packets
+ * with a message of up to qossmall bytes are interactive, and the
+ * rest bulk.
+ */
+enum TrafficClass {
+  CLASS_CONTROL,
+  CLASS_INTERACTIVE,
+  CLASS_BULK,
+  TRAFFIC_CLASSES};
+
 /*
  * The network layer needs to know where something is going in order
  * to send it off on the correct link. In this implimentation we don't
  * need the source address, but it's included here for debugging.
  *
- * The application's message is copied into the frame, so we don't
- * have to worry.
+ * The application's message is read straight into a frame buffer, the
+ * packet header is filled in around it.
  */
 struct Packet {
+  enum PacketType type;
   CnetAddr destination_address;
   CnetAddr source_address;
 
   size_t length; // Length of the message.
 
-  // Be sure to keep this last in the struct, check the package_size
-  // function for details why.
+  // When the message left the source node, and how many links the
+  // packet has crossed so far.
+  CnetTime sent_time;
+  int hops;
+
+  /*
+   * With trace=on, the address of every node the packet has been sent
+   * out from, source first. Only the first MAX_TRACE_HOPS are kept,
+   * hops has the full count.
+   */
+  int trace_length;
+  CnetAddr trace[MAX_TRACE_HOPS];
+
+  /*
+   * With transport=on, a data packet's sequence number from its
+   * source, or for an ACK packet, the next one the destination is
+   * expecting. An ACK for a message that had already arrived is marked
+   * as a duplicate.
+   */
+  bool sequenced;
+  uint32_t sequence;
+  bool duplicate;
+
+  /*
+   * A fragment of a message too big for a link on the way (see
+   * fragment.h), its id from the source, where it starts in the
+   * message, and the whole message's length.
+   */
+  bool fragment;
+  uint32_t fragment_id;
+  size_t fragment_offset;
+  size_t message_length;
+
+  // Be sure to keep this last in the struct, frames are sent from
+  // the start of the message (see wire.h).
   struct Message message;
 };
 
 /*
- * Take the message from the application and process it so it can be
- * routed through the network.
+ * Take the packet from the transport layer and process it so it can
+ * be routed through the network. The message has already been read
+ * into the packet in the frame buffer, which the network layer takes,
+ * and the transport layer has filled in the type and sequence number.
  */
-void application_down_to_network(const CnetAddr destination_address,
-                                 const struct Message *const message,
-                                 const size_t length);
+void transport_down_to_network(const CnetAddr destination_address,
+                               struct FrameBuffer *const buffer,
+                               const size_t length);
 
 /*
  * Take the packet from the datalink layer, either it's for us, or we
- * forward it onto the next node.
+ * forward it onto the next node. Forwarded packets go back down in
+ * the same frame buffer, packets for us go up to the transport layer
+ * in theirs. Fragments for us are held until their message has been
+ * put back together (see fragment.h).
+ *
+ * Routing packets are handed to the routing module along with the
+ * link they came in on.
+ */
+void datalink_up_to_network(struct FrameBuffer *const in_buffer,
+                            const int in_link);
+
+/*
+ * Network has room
+ *
+ * The data link layer asks before accepting a DATA frame, with
+ * transport=off, so it can refuse one it has nowhere to put. True if
+ * the packet is for this node or a routing packet, or the link it
+ * would be forwarded on has room for it, and the packet_count - 1
+ * packets behind it in the frame. A packet split into fragments for
+ * the link needs room for each of them.
+ *
+ * packet - First packet in the frame.
+ * packet_count - Packets in the frame.
+ */
+bool network_has_room(struct Packet *const packet, const int packet_count);
+
+/*
+ * Datalink congestion changed
+ *
+ * The data link layer calls this when the queue for a link crosses
+ * its high water mark (congested), or drains back to the low water
+ * mark (not congested). The application is stopped from generating
+ * messages for any destination routed out on a congested link.
+ *
+ * link - Link that's changed.
+ * congested - True if the link is now congested.
+ */
+void datalink_congestion_changed(const int link, const bool congested);
+
+/*
+ * Network route changed
+ *
+ * The routing module calls this when a destination becomes
+ * reachable, unreachable, or moves to a different link. The
+ * application only generates messages for destinations that have a
+ * route over a link that isn't congested.
+ *
+ * destination - Destination whose route changed.
+ */
+void network_route_changed(const CnetAddr destination);
+
+/*
+ * Transport window changed
+ *
+ * The transport layer calls this when the congestion window for a
+ * destination fills up, or has room again. The application only
+ * generates messages for destinations with room in their window.
+ *
+ * destination - Destination whose window changed.
+ */
+void transport_window_changed(const CnetAddr destination);
+
+/*
+ * Packet size
+ *
+ * Given a pointer to the packet, it will return the total used size
+ * for the packet, on the wire.
+ */
+size_t packet_size(const struct Packet *const packet);
+
+/*
+ * Packet class
+ *
+ * Which traffic class the packet is in.
+ */
+enum TrafficClass packet_class(const struct Packet *const packet);
+
+/*
+ * Traffic class name
+ *
+ * Name of the class, for the stats.
  */
-void datalink_up_to_network(const struct Packet *const in_packet);
+const char *traffic_class_name(const enum TrafficClass traffic_class);
 
 #endif
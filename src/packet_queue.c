@@ -5,83 +5,311 @@
  */
 
 #include <assert.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include "config.h"
 #include "packet_queue.h"
 
 // Forward declarations
-static struct PacketQueueNode *create_new_node(
-    const struct Packet *const to_copy,
-    const size_t length);
+static size_t flow_slot(const struct Packet *const packet);
+static enum TrafficClass queue_class(const struct ClassQueue *const queue,
+                                     const struct Packet *const packet);
+static void grow_queue(struct PacketQueue *const queue);
+static int scheduled_class(struct ClassQueue *const queue);
+static long class_quantum(const int traffic_class);
 
-void setup_queue(struct PacketQueue *queue) {
-  queue->head = NULL;
-  queue->tail = NULL;
+void setup_queue(struct PacketQueue *queue, const size_t limit) {
+  const size_t capacity = (limit != 0 && limit < INITIAL_QUEUE_CAPACITY) ?
+      limit : INITIAL_QUEUE_CAPACITY;
+
+  free(queue->buffers);
+
+  // Calloc so we can find errors a little easier.
+  queue->buffers = (struct FrameBuffer **)calloc(capacity,
+                                                 sizeof(struct FrameBuffer *));
+
+  // If we can't allocate memory for this, it's a serious problem
+  // can't recover from.
+  assert(queue->buffers);
+
+  queue->capacity = capacity;
+  queue->limit = limit;
+  queue->head = 0;
+  queue->count = 0;
+  queue->high_water = 0;
 }
 
-void add_to_queue(struct PacketQueue *const queue,
-                  const struct Packet *const to_be_added,
-                  const size_t length) {
-  if (queue->tail != NULL) {
-    // Something already in the queue, add to tail.
-    queue->tail->next = create_new_node(to_be_added,length);
-    queue->tail = queue->tail->next;
-  } else {
-    // If it's NULL, we don't have a tail, so the queue must be empty.
-    queue->head = queue->tail = create_new_node(to_be_added,length);
+bool add_to_queue(struct PacketQueue *const queue,
+                  struct FrameBuffer *const to_be_added,
+                  const bool past_limit) {
+  if (!past_limit && queue->limit != 0 && queue->count >= queue->limit) {
+    return false;
   }
+
+  if (queue->count == queue->capacity) {
+    grow_queue(queue);
+  }
+
+  queue->buffers[(queue->head + queue->count) % queue->capacity] = to_be_added;
+
+  ++queue->count;
+  if (queue->count > queue->high_water) {
+    queue->high_water = queue->count;
+  }
+
+  return true;
 }
 
-size_t next_packet(struct PacketQueue *const queue,
-                   struct Packet *const out_packet) {
-  size_t length = 0;
+struct FrameBuffer *next_packet(struct PacketQueue *const queue) {
+  struct FrameBuffer *head = NULL;
 
-  if (queue->head != NULL) {
-    memcpy(out_packet, &queue->head->packet, sizeof(struct Packet));
-    length = queue->head->length;;
+  if (queue->count != 0) {
+    head = queue->buffers[queue->head];
+    queue->buffers[queue->head] = NULL;
 
-    struct PacketQueueNode *old_head_of_queue = queue->head;
+    queue->head = (queue->head + 1) % queue->capacity;
+    --queue->count;
+  }
 
-    if (queue->head == queue->tail) {
-      // We've removed the last item from the queue.
-      queue->head = queue->tail = NULL;
-    } else {
-      queue->head = queue->head->next;
+  return head;
+}
+
+struct FrameBuffer *peek_packet(const struct PacketQueue *const queue) {
+  return (queue->count != 0) ? queue->buffers[queue->head] : NULL;
+}
+
+size_t queue_length(const struct PacketQueue *const queue) {
+  return queue->count;
+}
+
+void setup_class_queue(struct ClassQueue *const queue, const size_t limit) {
+  for (int i = 0; i < TRAFFIC_CLASSES; ++i) {
+    setup_queue(&queue->queues[i], limit);
+    queue->deficits[i] = 0;
+  }
+
+  memset(queue->flows, 0, sizeof(queue->flows));
+  queue->turn = CLASS_CONTROL;
+  queue->quantum_added = false;
+  queue->high_water = 0;
+}
+
+bool add_to_class_queue(struct ClassQueue *const queue,
+                        struct FrameBuffer *const to_be_added,
+                        const bool past_limit) {
+  const struct Packet *packet = &to_be_added->frame.packet;
+  const enum TrafficClass traffic_class = queue_class(queue, packet);
+
+  if (!add_to_queue(&queue->queues[traffic_class], to_be_added,
+                    past_limit)) {
+    return false;
+  }
+
+  ++queue->flows[flow_slot(packet)][traffic_class];
+
+  if (class_queue_length(queue) > queue->high_water) {
+    queue->high_water = class_queue_length(queue);
+  }
+
+  return true;
+}
+
+size_t class_queue_room(const struct ClassQueue *const queue,
+                        const struct Packet *const packet) {
+  const struct PacketQueue *class_queue =
+      &queue->queues[queue_class(queue, packet)];
+
+  if (class_queue->limit == 0) {
+    return SIZE_MAX;
+  }
+
+  return (class_queue->count < class_queue->limit) ?
+      class_queue->limit - class_queue->count : 0;
+}
+
+size_t drop_from_class_queue(struct ClassQueue *const queue,
+                             const enum PacketType type) {
+  size_t dropped = 0;
+
+  for (int i = 0; i < TRAFFIC_CLASSES; ++i) {
+    struct PacketQueue *class_queue = &queue->queues[i];
+    size_t kept = 0;
+
+    // The packets kept are moved up over the gaps, in the same order.
+    for (size_t j = 0; j < class_queue->count; ++j) {
+      const size_t from = (class_queue->head + j) % class_queue->capacity;
+      struct FrameBuffer *buffer = class_queue->buffers[from];
+
+      class_queue->buffers[from] = NULL;
+
+      if (buffer->frame.packet.type == type) {
+        --queue->flows[flow_slot(&buffer->frame.packet)][i];
+        release_frame_buffer(buffer);
+        ++dropped;
+      } else {
+        class_queue->buffers[(class_queue->head + kept++) %
+                             class_queue->capacity] = buffer;
+      }
     }
 
-    free(old_head_of_queue);
+    class_queue->count = kept;
+  }
+
+  return dropped;
+}
+
+struct FrameBuffer *peek_class_queue(struct ClassQueue *const queue) {
+  const int traffic_class = scheduled_class(queue);
+
+  return (traffic_class < 0) ? NULL :
+      peek_packet(&queue->queues[traffic_class]);
+}
+
+struct FrameBuffer *next_from_class_queue(struct ClassQueue *const queue) {
+  const int traffic_class = scheduled_class(queue);
+
+  if (traffic_class < 0) {
+    return NULL;
+  }
+
+  struct FrameBuffer *head = next_packet(&queue->queues[traffic_class]);
+
+  --queue->flows[flow_slot(&head->frame.packet)][traffic_class];
+  queue->deficits[traffic_class] -= wire_packet_size(&head->frame.packet);
+
+  return head;
+}
+
+size_t class_queue_length(const struct ClassQueue *const queue) {
+  size_t length = 0;
+
+  for (int i = 0; i < TRAFFIC_CLASSES; ++i) {
+    length += queue_length(&queue->queues[i]);
   }
 
   return length;
 }
 
 /*
- * Create New Node
+ * Flow slot
  *
- * Given a pointer to the packet, will return a PacketQueueNode that
- * has the packet copied into it.
+ * Slot in the flow table for the packet's source and destination.
+ */
+static size_t flow_slot(const struct Packet *const packet) {
+  const unsigned int hash = (unsigned int) packet->source_address * 31u +
+                            (unsigned int) packet->destination_address;
+
+  return hash % QOS_FLOW_SLOTS;
+}
+
+/*
+ * Queue class
  *
- * to_copy - Packet to copy.
- * length - Size of the packet.
+ * The class the packet goes in, its own unless its flow already has
+ * packets waiting in the other data class, which it can't overtake.
  */
-static struct PacketQueueNode *create_new_node(
-    const struct Packet *const to_copy,
-    const size_t length) {
+static enum TrafficClass queue_class(const struct ClassQueue *const queue,
+                                     const struct Packet *const packet) {
+  const unsigned int *flow = queue->flows[flow_slot(packet)];
+  const enum TrafficClass traffic_class = (config.qos_mode == QOS_OFF) ?
+      CLASS_BULK : packet_class(packet);
 
-  struct PacketQueueNode *new_node;
+  if (traffic_class == CLASS_INTERACTIVE && flow[CLASS_BULK] > 0) {
+    return CLASS_BULK;
+  } else if (traffic_class == CLASS_BULK && flow[CLASS_INTERACTIVE] > 0) {
+    return CLASS_INTERACTIVE;
+  }
 
-  // Calloc so we can find errors a little easier.
-  new_node = (struct PacketQueueNode *)calloc(1, sizeof(struct PacketQueueNode));
+  return traffic_class;
+}
 
-  // If we can't allocate memory for this, it's a serious problem
-  // can't recover from.
-  assert(new_node);
+/*
+ * Scheduled class
+ *
+ * The class the next packet comes from, -1 if there aren't any. The
+ * round robin stays on the class whose turn it is while the packet at
+ * its head fits in its deficit, then moves on, adding the next class's
+ * quantum. A class with nothing queued loses its deficit, so it can't
+ * save up a burst.
+ */
+static int scheduled_class(struct ClassQueue *const queue) {
+  if (class_queue_length(queue) == 0) {
+    return -1;
+  }
 
-  new_node->next = NULL;
-  new_node->length = length;
-  memcpy(&new_node->packet, to_copy, sizeof(struct Packet));
+  for (;;) {
+    const int turn = queue->turn;
+    const struct FrameBuffer *head = peek_packet(&queue->queues[turn]);
+
+    if (head == NULL) {
+      queue->deficits[turn] = 0;
+    } else {
+      if (!queue->quantum_added) {
+        queue->deficits[turn] += class_quantum(turn);
+        queue->quantum_added = true;
+      }
+
+      if (queue->deficits[turn] >=
+          (long) wire_packet_size(&head->frame.packet)) {
+        return turn;
+      }
+    }
+
+    queue->turn = (turn + 1 < TRAFFIC_CLASSES) ? turn + 1 : CLASS_CONTROL;
+    queue->quantum_added = false;
+  }
+}
+
+/*
+ * Class quantum
+ *
+ * Bytes added to the class's deficit on its turn.
+ *
+ * Globals:
+ *   config - qosweight.
+ */
+static long class_quantum(const int traffic_class) {
+  switch (traffic_class) {
+    case CLASS_CONTROL:
+      return QOS_CONTROL_QUANTUM;
+    case CLASS_INTERACTIVE:
+      return (long) QOS_QUANTUM * config.qos_weight;
+    default:
+      return QOS_QUANTUM;
+  }
+}
+
+/*
+ * Grow queue
+ *
+ * The ring is full, so double its size, without going over the
+ * limit, unless it's already there and packets are being added past
+ * it. The packets are moved over so the head of the queue is back at
+ * the first slot.
+ */
+static void grow_queue(struct PacketQueue *const queue) {
+  size_t new_capacity = queue->capacity * 2;
+
+  if (queue->limit != 0 && queue->capacity < queue->limit &&
+      new_capacity > queue->limit) {
+    new_capacity = queue->limit;
+  }
+
+  struct FrameBuffer **new_buffers;
+
+  new_buffers = (struct FrameBuffer **)calloc(new_capacity,
+                                              sizeof(struct FrameBuffer *));
+  assert(new_buffers);
+
+  for (size_t i = 0; i < queue->count; ++i) {
+    new_buffers[i] = queue->buffers[(queue->head + i) % queue->capacity];
+  }
 
-  return new_node;
+  free(queue->buffers);
+  queue->buffers = new_buffers;
+  queue->capacity = new_capacity;
+  queue->head = 0;
 }
@@ -5,58 +5,210 @@
  *
  * Description:
  *   Queue for the datalink layer to queue up pending packet
- *   transmissions. This is being used instead of stopping the
- *   application layer from generating messages via the
- *   CNET_(enable/disable)_application functions. Because it bothers
- *   me.
+ *   transmissions, while the link's window is full.
+ *
+ *   Each queue is bounded, queuelimit packets per class (more on a link
+ *   that fragments messages, see data_link_layer.c). The data link
+ *   layer watches the length of a link's queues against the high and
+ *   low water marks. Once they reach highwater the link is congested,
+ *   and the application is stopped (CNET_disable_application) for
+ *   every destination routed over it, until the queues drain back to
+ *   lowwater. A packet that still finds its queue at the limit, one
+ *   being forwarded from another node, is dropped with transport=on,
+ *   or queued anyway with it off, the data link layer refusing frames
+ *   from its neighbours instead (see data_link_layer.h).
+ *
+ *   The queue is a ring of frame buffer pointers allocated up front,
+ *   so adding and removing packets doesn't touch the heap, and the
+ *   packets themselves are never copied. If the ring fills up, it's
+ *   doubled in size, which should only happen a handful of times over
+ *   a run, until it reaches the queue's limit.
+ *
+ *   Each link has a class queue, a queue per traffic class (see
+ *   network_layer.h), so a small message doesn't have to wait behind
+ *   every large one queued on the link. The classes share the link by
+ *   deficit round robin: on its turn a class has its quantum of bytes
+ *   added to its deficit, and sends packets while the one at its head
+ *   fits in the deficit, which carries over to its next turn if it's
+ *   still got packets waiting. Interactive's quantum is qosweight
+ *   times bulk's, so while both are backed up interactive gets that
+ *   many times the bytes, but bulk is never starved. Control has a
+ *   quantum of its own, it used to always go first, but on a slow
+ *   link the routing packets alone could keep it busy and nothing
+ *   else got sent. With qos=off every packet goes in the bulk queue,
+ *   the one FIFO as before.
+ *
+ *   CNET wants the messages from each source delivered in order, so a
+ *   packet can't overtake one from the same source to the same
+ *   destination. While a flow has packets waiting in one of the data
+ *   classes, its packets keep going in that class whatever their size.
+ *   Flows are counted in a small hash table, and two flows sharing a
+ *   slot only makes them stick together more than they have to.
  */
 
 #ifndef PACKET_QUEUE_H_
 #define PACKET_QUEUE_H_
 
-#include "network_layer.h"
+#include <stdbool.h>
+
+#include "frame_buffer.h"
+
+// Number of slots a queue starts out with.
+#define INITIAL_QUEUE_CAPACITY 16
+
+// Bulk's quantum in bytes, interactive's is qosweight times this.
+#define QOS_QUANTUM 1024
+
+// Control's quantum in bytes.
+#define QOS_CONTROL_QUANTUM 1024
+
+// Slots in the table of packets queued by flow.
+#define QOS_FLOW_SLOTS 64
 
 struct PacketQueue {
-  struct PacketQueueNode *head;
-  struct PacketQueueNode *tail;
+  struct FrameBuffer **buffers;
+  size_t capacity;
+
+  size_t head;   // Slot of the next packet out.
+  size_t count;  // Number of packets in the queue.
+  size_t limit;  // Most packets allowed in the queue, 0 for no limit.
+
+  // Most packets that have been in the queue at once.
+  size_t high_water;
 };
 
-struct PacketQueueNode {
-  struct PacketQueueNode *next;
-  size_t length;
-  struct Packet packet;
+struct ClassQueue {
+  struct PacketQueue queues[TRAFFIC_CLASSES];
+
+  // Bytes each class can still send, deficit round robin.
+  long deficits[TRAFFIC_CLASSES];
+
+  // Packets queued in each class, by hash of source and destination.
+  unsigned int flows[QOS_FLOW_SLOTS][TRAFFIC_CLASSES];
+
+  // Class whose turn it is, and if it's had its quantum yet.
+  int turn;
+  bool quantum_added;
+
+  // Most packets that have been in all the queues at once.
+  size_t high_water;
 };
 
 /*
  * Setup queue
  *
  * Sets the queue up ready to be used. Has to be called before any
- * other functions to operate on the queue.
+ * other functions to operate on the queue. Calling it again on a
+ * queue that's been set up empties it, without releasing the
+ * buffers.
+ *
+ * limit - Most packets the queue will hold, 0 for no limit.
  */
-void setup_queue(struct PacketQueue *const queue);
+void setup_queue(struct PacketQueue *const queue, const size_t limit);
 
 /*
  * Add packet
  *
- * Adds packet to end of the queue.
+ * Adds the frame buffer holding the packet to end of the queue, the
+ * queue owns the buffer until it's taken back out.
  *
- * This will copy the packet to the list, so the packet that's added
- * does not need to be kept around.
+ * past_limit - Add it even if the queue is at its limit.
+ *
+ * Returns false if the queue is at its limit, the buffer isn't added
+ * and still belongs to the caller.
  */
-void add_to_queue(struct PacketQueue *const queue,
-                  const struct Packet *const to_be_added,
-                  const size_t length);
+bool add_to_queue(struct PacketQueue *const queue,
+                  struct FrameBuffer *const to_be_added,
+                  const bool past_limit);
 
 /*
  * Get next packet
  *
- * Remove the next packet from the queue.
+ * Remove the next packet from the queue, and return the frame buffer
+ * holding it. If there is no packet, then the function will return
+ * NULL.
+ */
+struct FrameBuffer *next_packet(struct PacketQueue *const queue);
+
+/*
+ * Peek packet
+ *
+ * The frame buffer holding the next packet, left in the queue. NULL
+ * if the queue is empty.
+ */
+struct FrameBuffer *peek_packet(const struct PacketQueue *const queue);
+
+/*
+ * Queue length
+ *
+ * Number of packets waiting in the queue.
+ */
+size_t queue_length(const struct PacketQueue *const queue);
+
+/*
+ * Setup class queue
+ *
+ * Sets up a queue for each class, each with the limit.
+ */
+void setup_class_queue(struct ClassQueue *const queue, const size_t limit);
+
+/*
+ * Add to class queue
+ *
+ * Adds the frame buffer to the queue for its packet's class.
+ *
+ * past_limit - Add it even if that queue is at its limit.
+ *
+ * Returns false if that queue is at its limit, the buffer still
+ * belongs to the caller.
+ */
+bool add_to_class_queue(struct ClassQueue *const queue,
+                        struct FrameBuffer *const to_be_added,
+                        const bool past_limit);
+
+/*
+ * Class queue room
+ *
+ * Packets that can still be added to the queue the packet would go
+ * in, SIZE_MAX if it has no limit.
+ */
+size_t class_queue_room(const struct ClassQueue *const queue,
+                        const struct Packet *const packet);
+
+/*
+ * Drop from class queue
+ *
+ * Takes every packet of the type out of the queues, and releases its
+ * buffer, for when newer ones make them out of date.
+ *
+ * Returns the number of packets dropped.
+ */
+size_t drop_from_class_queue(struct ClassQueue *const queue,
+                             const enum PacketType type);
+
+/*
+ * Peek class queue
+ *
+ * The frame buffer holding the packet that's to be sent next, left in
+ * its queue. NULL if every queue is empty. Moves the round robin on to
+ * the class that's sending next, if it has to.
+ */
+struct FrameBuffer *peek_class_queue(struct ClassQueue *const queue);
+
+/*
+ * Next from class queue
+ *
+ * Removes the packet that's to be sent next, the one peek_class_queue
+ * gives, and returns the frame buffer holding it. NULL if every queue
+ * is empty.
+ */
+struct FrameBuffer *next_from_class_queue(struct ClassQueue *const queue);
+
+/*
+ * Class queue length
  *
- * It will copy the packet into Packet struct given by out_packet
- * pointer. If there is no packet, then the function will return
- * false.
+ * Number of packets waiting, in every class.
  */
-size_t next_packet(struct PacketQueue *const queue,
-                   struct Packet *const out_packet);
+size_t class_queue_length(const struct ClassQueue *const queue);
 
 #endif
@@ -7,6 +7,7 @@
 #include <cnet.h>
 
 #include "data_link_layer.h"
+#include "frame_buffer.h"
 
 /*
  * Physical Ready
@@ -15,18 +16,20 @@
  * layer and pass it up.
  *
  * Either this node will accept it, pass it up further the layers, or
- * forward it back down, it's safe to have the in_frame as a stack
- * allocated variable, since it will end up being copied or processed
- * before this function ends.
+ * forward it back down. The frame is read into a frame buffer, which
+ * the upper layers take, so a forwarded packet can go straight back
+ * out without being copied.
  */
 EVENT_HANDLER(physical_ready) {
-  struct Frame in_frame;
+  struct FrameBuffer *in_buffer = allocate_frame_buffer();
   int in_link;
-  size_t length = sizeof(struct Frame);
+  size_t length = sizeof(struct Message) + MAX_WIRE_TRAILER_SIZE;
 
-  // Read in the frame from the physical link.
-  CHECK(CNET_read_physical(&in_link, &in_frame, &length));
+  // Read in the frame from the physical link, the message lands where
+  // it would be in the frame.
+  CHECK(CNET_read_physical(&in_link, wire_bytes(&in_buffer->frame),
+                           &length));
 
   // Pass it up to the datalink layer.
-  up_to_datalink_from_physical(in_link, &in_frame, length);
+  up_to_datalink_from_physical(in_link, in_buffer, length);
 }
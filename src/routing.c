@@ -0,0 +1,547 @@
+/*
+ * CC200 Assignment
+ *
+ * Author: Mike Aldred
+ *
+ * Routing
+ *
+ * Description:
+ *   Look at the header file for details.
+ */
+
+#include <assert.h>
+#include <cnet.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "config.h"
+#include "data_link_layer.h"
+#include "forwarding_table.h"
+#include "frame_buffer.h"
+#include "log.h"
+#include "network_layer.h"
+#include "routing.h"
+
+/*
+ * A single entry in a distance vector, these are packed one after the
+ * other into the message of a routing packet.
+ */
+struct RouteAdvert {
+  CnetAddr destination;
+  int hops;
+  CnetTime cost;
+};
+
+#define ADVERTS_PER_PACKET (MAX_MESSAGE_SIZE / sizeof(struct RouteAdvert))
+
+// Most a routing packet's header takes on the wire (see wire.h).
+#define ROUTING_HEADER_SIZE 32
+
+/*
+ * A link's period is at least this many full sized frame times, so
+ * vectors can't take up more than a quarter of a slow link. With
+ * nothing changed, the vector still goes out every few periods to
+ * show we're still there, and a neighbour not heard from for a few of
+ * those is taken to be gone.
+ */
+#define ROUTE_PERIOD_FRAMES 4
+#define ROUTE_REFRESH_PERIODS 8
+#define ROUTE_EXPIRY_REFRESHES 3
+
+// Periods of the new link a route is left to settle (see Route).
+#define ROUTE_SETTLE_PERIODS 2
+
+/*
+ * The routing table, one entry per destination, grown as new
+ * destinations are heard about. Destinations are never removed, just
+ * marked as unreachable.
+ */
+static struct Route *routes = NULL;
+static size_t route_count = 0;
+static size_t route_capacity = 0;
+
+/*
+ * Finds where the route for an address is in the routing table, so
+ * looking up a route takes the same time however many nodes there
+ * are.
+ */
+static struct ForwardingTable route_index;
+
+// Cost of each link, indexed by link - 1.
+static CnetTime *link_costs = NULL;
+
+/*
+ * What's gone out to, and come in from, the neighbour on each link,
+ * indexed by link - 1.
+ */
+struct Neighbour {
+  CnetTime last_sent;   // When our vector last went out on the link.
+  CnetTime last_heard;  // When anything last arrived on the link.
+  bool changed;         // Our routes have changed since last_sent.
+  bool expired;         // Its adverts have been thrown away.
+};
+
+static struct Neighbour *neighbours = NULL;
+
+// Forward declarations
+static struct Route *find_route(const CnetAddr destination);
+static struct Route *add_route(const CnetAddr destination);
+static bool recalculate_route(struct Route *const route);
+static bool update_multipath_links(struct Route *const route);
+static CnetTime link_period(const int link);
+static void routes_changed();
+static void expire_neighbour(const int link);
+static void settle_routes();
+static void send_distance_vector(const int out_link);
+static void clear_routes();
+
+void init_routing() {
+  clear_routes();
+
+  free(link_costs);
+  link_costs = (CnetTime *)calloc(nodeinfo.nlinks, sizeof(CnetTime));
+  free(neighbours);
+  neighbours = (struct Neighbour *)calloc(nodeinfo.nlinks,
+                                          sizeof(struct Neighbour));
+  assert(link_costs && neighbours);
+
+  for (int link = 1; link <= nodeinfo.nlinks; ++link) {
+    link_costs[link - 1] = (CnetTime) sizeof(struct Frame) * 8000000 /
+        linkinfo[link].bandwidth + linkinfo[link].propagationdelay;
+  }
+
+  // We can always get to ourselves for free.
+  struct Route *self = add_route(nodeinfo.address);
+  self->cost = 0;
+  self->hops = 0;
+
+  // Each link has its own timer, its period goes by the link's speed.
+  for (int link = 1; link <= nodeinfo.nlinks; ++link) {
+    neighbours[link - 1].last_heard = nodeinfo.time_in_usec;
+    send_distance_vector(link);
+    CNET_start_timer(EV_TIMER3, link_period(link), (CnetData) link);
+  }
+}
+
+const struct Route *route_to(const CnetAddr destination) {
+  return find_route(destination);
+}
+
+const struct Route *route_table(size_t *const count) {
+  *count = route_count;
+  return routes;
+}
+
+void routing_heard(const int in_link) {
+  struct Neighbour *neighbour = &neighbours[in_link - 1];
+
+  neighbour->last_heard = nodeinfo.time_in_usec;
+
+  // It's back, let it know our routes, its own come with its next
+  // vector.
+  if (neighbour->expired) {
+    neighbour->expired = false;
+    send_distance_vector(in_link);
+  }
+}
+
+void routing_update(const int in_link, const struct Packet *const in_packet) {
+  const size_t advert_count = in_packet->length / sizeof(struct RouteAdvert);
+  bool changed = false;
+
+  for (size_t i = 0; i < advert_count; ++i) {
+    struct RouteAdvert advert;
+    memcpy(&advert, &in_packet->message.data[i * sizeof(advert)],
+           sizeof(advert));
+
+    struct Route *route = find_route(advert.destination);
+
+    if (route == NULL) {
+      if (advert.cost >= ROUTE_INFINITY) {
+        // No point adding a route we can't use.
+        continue;
+      }
+
+      route = add_route(advert.destination);
+    }
+
+    route->advertised_cost[in_link - 1] = advert.cost;
+    route->advertised_hops[in_link - 1] = advert.hops;
+
+    changed = recalculate_route(route) || changed;
+  }
+
+  if (changed) {
+    routes_changed();
+  }
+}
+
+/*
+ * A vector goes out if the routes have changed since the last one, or
+ * as a refresh if it's been long enough. A neighbour that's been quiet
+ * too long has its adverts thrown away first.
+ */
+EVENT_HANDLER(routing_timeouts) {
+  const int link = (int) data;
+  const struct Neighbour *neighbour = &neighbours[link - 1];
+  const CnetTime period = link_period(link);
+  const CnetTime refresh = ROUTE_REFRESH_PERIODS * period;
+
+  if (!neighbour->expired && nodeinfo.time_in_usec - neighbour->last_heard >=
+      ROUTE_EXPIRY_REFRESHES * refresh) {
+    expire_neighbour(link);
+  }
+
+  if (neighbour->changed ||
+      nodeinfo.time_in_usec - neighbour->last_sent >= refresh) {
+    send_distance_vector(link);
+  }
+
+  settle_routes();
+  CNET_start_timer(EV_TIMER3, period, data);
+}
+
+void debug_routing() {
+  printf("Routing table.\n");
+  printf("+-------------+------+------------+------+-------+\n");
+  printf("| Destination | Link |    Cost    | Hops | Paths |\n");
+  printf("+-------------+------+------------+------+-------+\n");
+  for (size_t i = 0; i < route_count; ++i) {
+    if (routes[i].cost >= ROUTE_INFINITY) {
+      printf("|    %5u    |  -   |     -      |  -   |   -   |\n",
+             (unsigned) routes[i].destination);
+    } else {
+      printf("|    %5u    |  %d   | %10lld | %4d |  %3d  |\n",
+             (unsigned) routes[i].destination,
+             routes[i].link,
+             (long long) routes[i].cost,
+             routes[i].hops,
+             routes[i].link_count);
+    }
+  }
+  printf("+-------------+------+------------+------+-------+\n");
+}
+
+/*
+ * Find route
+ *
+ * Returns the route for the destination, or NULL if we've never heard
+ * of it.
+ */
+static struct Route *find_route(const CnetAddr destination) {
+  uint32_t index;
+
+  if (!forwarding_table_lookup(&route_index, destination, &index)) {
+    return NULL;
+  }
+
+  return &routes[index];
+}
+
+/*
+ * Add route
+ *
+ * Adds an unreachable route for a new destination, nothing has been
+ * advertised for it on any link yet.
+ */
+static struct Route *add_route(const CnetAddr destination) {
+  if (route_count == route_capacity) {
+    route_capacity = (route_capacity == 0) ? 16 : route_capacity * 2;
+    routes = (struct Route *)realloc(routes,
+                                     route_capacity * sizeof(struct Route));
+    assert(routes);
+  }
+
+  forwarding_table_insert(&route_index, destination, (uint32_t) route_count);
+  struct Route *route = &routes[route_count++];
+
+  route->destination = destination;
+  route->link = 0;
+  route->cost = ROUTE_INFINITY;
+  route->hops = MAX_ROUTE_HOPS;
+  route->settling = false;
+  route->settled_time = 0;
+
+  route->advertised_cost = (CnetTime *)malloc(nodeinfo.nlinks *
+                                              sizeof(CnetTime));
+  route->advertised_hops = (int *)malloc(nodeinfo.nlinks * sizeof(int));
+  route->links = (int *)malloc(nodeinfo.nlinks * sizeof(int));
+  route->link_count = 0;
+  assert(route->advertised_cost && route->advertised_hops && route->links);
+
+  for (int i = 0; i < nodeinfo.nlinks; ++i) {
+    route->advertised_cost[i] = ROUTE_INFINITY;
+    route->advertised_hops[i] = MAX_ROUTE_HOPS;
+  }
+
+  return route;
+}
+
+/*
+ * Recalculate route
+ *
+ * Picks the cheapest link for the destination, from what the
+ * neighbours have advertised, then the other links that are safe for
+ * multipath. If the destination has become reachable, unreachable or
+ * its links have changed, the network layer is told.
+ *
+ * A route onto a new link is left to settle before it's used, long
+ * enough for the routes still on their way to turn up, and for what's
+ * already been sent on the old link to get ahead of it.
+ *
+ * Returns true if the route changed.
+ */
+static bool recalculate_route(struct Route *const route) {
+  if (route->destination == nodeinfo.address) {
+    return false;
+  }
+
+  const int old_link = route->link;
+  const CnetTime old_cost = route->cost;
+  const int old_hops = route->hops;
+
+  route->link = 0;
+  route->cost = ROUTE_INFINITY;
+  route->hops = MAX_ROUTE_HOPS;
+
+  for (int link = 1; link <= nodeinfo.nlinks; ++link) {
+    const CnetTime advertised = route->advertised_cost[link - 1];
+    const int hops = route->advertised_hops[link - 1] + 1;
+
+    if (advertised >= ROUTE_INFINITY || hops >= MAX_ROUTE_HOPS) {
+      continue;
+    }
+
+    if (link_costs[link - 1] + advertised < route->cost) {
+      route->link = link;
+      route->cost = link_costs[link - 1] + advertised;
+      route->hops = hops;
+    }
+  }
+
+  const bool multipath_changed = update_multipath_links(route);
+
+  if (route->link != old_link) {
+    route->settling = (route->link != 0);
+
+    if (route->settling) {
+      route->settled_time = nodeinfo.time_in_usec +
+          ROUTE_SETTLE_PERIODS * link_period(route->link) +
+          ((old_link != 0) ? old_cost : 0);
+    }
+  }
+
+  if (route->link != old_link || multipath_changed) {
+    network_route_changed(route->destination);
+  }
+
+  return route->link != old_link || route->cost != old_cost ||
+      route->hops != old_hops;
+}
+
+/*
+ * Update multipath links
+ *
+ * Rebuilds the list of links for the route, the cheapest first. A
+ * link other than the cheapest is only used if the neighbour on it is
+ * strictly closer to the destination than we are (which rules out
+ * loops), and its cost is within the slack of the cheapest.
+ *
+ * Returns true if the list changed.
+ */
+static bool update_multipath_links(struct Route *const route) {
+  int links[route->link_count > 0 ? route->link_count : 1];
+  const int old_count = route->link_count;
+
+  memcpy(links, route->links, old_count * sizeof(int));
+  route->link_count = 0;
+
+  if (route->link != 0) {
+    const CnetTime limit = route->cost +
+        route->cost * config.multipath_slack / 100;
+
+    route->links[route->link_count++] = route->link;
+
+    for (int link = 1; link <= nodeinfo.nlinks; ++link) {
+      const CnetTime advertised = route->advertised_cost[link - 1];
+
+      if (link == route->link ||
+          advertised >= route->cost ||
+          route->advertised_hops[link - 1] + 1 >= MAX_ROUTE_HOPS ||
+          link_costs[link - 1] + advertised > limit) {
+        continue;
+      }
+
+      route->links[route->link_count++] = link;
+    }
+  }
+
+  return route->link_count != old_count ||
+      memcmp(links, route->links, old_count * sizeof(int)) != 0;
+}
+
+/*
+ * Link period
+ *
+ * Least time between vectors on the link, routeperiod or
+ * ROUTE_PERIOD_FRAMES frame times, whichever is longer.
+ */
+static CnetTime link_period(const int link) {
+  const CnetTime period = ROUTE_PERIOD_FRAMES * link_costs[link - 1];
+
+  return (period > config.route_period) ? period : config.route_period;
+}
+
+/*
+ * Routes changed
+ *
+ * Sends the vector straight away on links that haven't had one for a
+ * period, the rest wait for their timer, so a burst of changes goes
+ * out as one vector.
+ *
+ * Globals:
+ *   neighbours - Every link marked as changed.
+ */
+static void routes_changed() {
+  for (int link = 1; link <= nodeinfo.nlinks; ++link) {
+    struct Neighbour *neighbour = &neighbours[link - 1];
+
+    neighbour->changed = true;
+
+    if (nodeinfo.time_in_usec - neighbour->last_sent >= link_period(link)) {
+      send_distance_vector(link);
+    }
+  }
+}
+
+/*
+ * Expire neighbour
+ *
+ * Throws away everything the neighbour on the link has advertised, so
+ * routes through it move elsewhere or become unreachable.
+ *
+ * Globals:
+ *   neighbours - The link's neighbour marked as expired.
+ *   routes - The neighbour's adverts made unreachable.
+ */
+static void expire_neighbour(const int link) {
+  bool changed = false;
+
+  LOG_WARN("Nothing heard on link %d, its routes expired.\n", link);
+  neighbours[link - 1].expired = true;
+
+  for (size_t i = 0; i < route_count; ++i) {
+    routes[i].advertised_cost[link - 1] = ROUTE_INFINITY;
+    routes[i].advertised_hops[link - 1] = MAX_ROUTE_HOPS;
+    changed = recalculate_route(&routes[i]) || changed;
+  }
+
+  if (changed) {
+    routes_changed();
+  }
+}
+
+/*
+ * Settle routes
+ *
+ * Lets the network layer know about routes that have finished
+ * settling, so it can use them.
+ *
+ * Globals:
+ *   routes - Settled routes no longer marked as settling.
+ */
+static void settle_routes() {
+  for (size_t i = 0; i < route_count; ++i) {
+    struct Route *route = &routes[i];
+
+    if (route->settling && nodeinfo.time_in_usec >= route->settled_time) {
+      route->settling = false;
+      network_route_changed(route->destination);
+    }
+  }
+}
+
+/*
+ * Send distance vector
+ *
+ * Sends every route out on the link, in as many packets as it takes.
+ * Routes that go out on the same link are advertised as unreachable
+ * (poisoned reverse). Any of the last vector still queued on the link
+ * is dropped, this one replaces it.
+ *
+ * Globals:
+ *   neighbours - The link's vector marked as sent.
+ */
+static void send_distance_vector(const int out_link) {
+  size_t next_route = 0;
+
+  drop_queued_routing(out_link);
+
+  neighbours[out_link - 1].last_sent = nodeinfo.time_in_usec;
+  neighbours[out_link - 1].changed = false;
+
+  // Routing packets aren't fragmented, so they're kept to the link's
+  // MTU. An MTU of MIN_MTU still has room for a couple of adverts.
+  const size_t room = (link_packet_limit(out_link) - ROUTING_HEADER_SIZE) /
+      sizeof(struct RouteAdvert);
+  const size_t adverts_per_packet = (room < ADVERTS_PER_PACKET) ?
+      room : ADVERTS_PER_PACKET;
+
+  do {
+    struct FrameBuffer *buffer = allocate_frame_buffer();
+    struct Packet *packet = &buffer->frame.packet;
+    size_t advert_count = 0;
+
+    for (; next_route < route_count && advert_count < adverts_per_packet;
+         ++next_route) {
+      const struct Route *route = &routes[next_route];
+      struct RouteAdvert advert;
+
+      advert.destination = route->destination;
+
+      if (route->link == out_link || route->cost >= ROUTE_INFINITY) {
+        advert.cost = ROUTE_INFINITY;
+        advert.hops = MAX_ROUTE_HOPS;
+      } else {
+        advert.cost = route->cost;
+        advert.hops = route->hops;
+      }
+
+      memcpy(&packet->message.data[advert_count * sizeof(advert)], &advert,
+             sizeof(advert));
+      ++advert_count;
+    }
+
+    // Routing packets are only for the neighbour, they're never
+    // forwarded, so there's no real destination.
+    packet->type = PACKET_ROUTING;
+    packet->destination_address = nodeinfo.address;
+    packet->source_address = nodeinfo.address;
+    packet->length = advert_count * sizeof(struct RouteAdvert);
+    packet->sent_time = nodeinfo.time_in_usec;
+    packet->hops = 0;
+    packet->trace_length = 0;
+    packet->sequenced = false;
+    packet->fragment = false;
+
+    down_to_datalink_from_network(out_link, buffer, packet_size(packet));
+  } while (next_route < route_count);
+}
+
+/*
+ * Clear routes
+ *
+ * Frees every route, ready to start again after a reboot.
+ */
+static void clear_routes() {
+  for (size_t i = 0; i < route_count; ++i) {
+    free(routes[i].advertised_cost);
+    free(routes[i].advertised_hops);
+    free(routes[i].links);
+  }
+
+  route_count = 0;
+  setup_forwarding_table(&route_index);
+}
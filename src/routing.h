@@ -0,0 +1,142 @@
+/*
+ * CC200 Assignment
+ *
+ * Author: Mike Aldred
+ *
+ * Routing
+ *
+ * Description:
+ *
+ *   Distance vector routing, so the routes don't have to be worked out
+ *   by hand for each topology file. Each node starts off only knowing
+ *   about itself, and sends its distance vector (every destination it
+ *   knows, and what it costs to get there) out on every link. When a
+ *   node hears a vector from a neighbour, it works out the cheapest
+ *   link for each destination, and if anything changed, sends its own
+ *   vector. A link gets a vector at most once a period, routeperiod or
+ *   a few frame times on the link, whichever is longer, so on a slow
+ *   link a burst of changes goes out as one vector rather than taking
+ *   the link over. With nothing changed, a vector only goes out every
+ *   few periods, to show the node is still there. A neighbour nothing
+ *   has been heard from for a few of those has its adverts thrown
+ *   away, so the routes through it move elsewhere.
+ *
+ *   A route that's moved onto a new link is left to settle for a
+ *   couple of periods before the application sends over it, plus the
+ *   old route's cost if it had one. When the network first starts,
+ *   a longer route often turns up before the direct one, and messages
+ *   sent on it would arrive after the ones sent on the direct route.
+ *
+ *   The cost of a link is how long a full sized frame takes to cross
+ *   it, transmission time plus propagation delay, in usecs. Split
+ *   horizon with poisoned reverse stops two nodes bouncing a dead
+ *   route between them, and routes more than MAX_ROUTE_HOPS hops long
+ *   are treated as unreachable, which stops counting to infinity in
+ *   bigger loops.
+ *
+ *   For multipath forwarding, each route also keeps every link that's
+ *   safe to use as well as the cheapest one. A link is only safe if
+ *   the neighbour on it is closer to the destination than we are, so
+ *   packets can't go round in a loop. Of those, the ones within the
+ *   configured slack of the cheapest cost are kept.
+ */
+
+#ifndef ROUTING_H_
+#define ROUTING_H_
+
+#include <cnet.h>
+
+#include "network_layer.h"
+
+// Cost of a route that can't be used.
+#define ROUTE_INFINITY ((CnetTime) 1 << 40)
+#define MAX_ROUTE_HOPS 64
+
+struct Route {
+  CnetAddr destination;
+
+  int link;       // Link to send out on, 0 if unreachable or us.
+  CnetTime cost;  // Total cost to the destination.
+  int hops;
+
+  /*
+   * Every link worth sending out on for multipath, starting with the
+   * cheapest (link). Empty if unreachable.
+   */
+  int *links;
+  int link_count;
+
+  /*
+   * The cost and hops each neighbour has told us for this
+   * destination, indexed by link - 1.
+   */
+  CnetTime *advertised_cost;
+  int *advertised_hops;
+
+  // Moved onto a new link, and not to be used until settled_time.
+  bool settling;
+  CnetTime settled_time;
+};
+
+/*
+ * Init routing
+ *
+ * Forgets any routes, adds the route to this node, and sends the
+ * first distance vector out on every link. The data link layer must
+ * be set up first.
+ */
+void init_routing();
+
+/*
+ * Route to
+ *
+ * Returns the route for the destination, or NULL if we've never
+ * heard of it.
+ */
+const struct Route *route_to(const CnetAddr destination);
+
+/*
+ * Route table
+ *
+ * Read only access to the current routes, for going through every
+ * destination.
+ *
+ * count - Set to the number of routes.
+ */
+const struct Route *route_table(size_t *const count);
+
+/*
+ * Routing heard
+ *
+ * The network layer calls this for every packet that arrives, so a
+ * neighbour sending anything at all isn't taken to be gone.
+ *
+ * in_link - Link the packet arrived on.
+ */
+void routing_heard(const int in_link);
+
+/*
+ * Routing update
+ *
+ * The network layer passes routing packets here. Updates the
+ * neighbour's vector and recalculates the routes.
+ *
+ * in_link - Link the update arrived on.
+ * in_packet - The routing packet.
+ */
+void routing_update(const int in_link, const struct Packet *const in_packet);
+
+/*
+ * Routing timeouts
+ *
+ * Each link's periodic timer, the link is passed in via the CNET data
+ * variable.
+ */
+EVENT_HANDLER(routing_timeouts);
+
+/*
+ * For printing out the routing table.
+ */
+void debug_routing();
+
+#endif
@@ -0,0 +1,435 @@
+/*
+ * CC200 Assignment
+ *
+ * Author: Mike Aldred
+ *
+ * Statistics
+ *
+ * Description:
+ *   Look at the header file for details.
+ */
+
+#include <assert.h>
+#include <cnet.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "config.h"
+#include "latency.h"
+#include "stats.h"
+
+/*
+ * Every counter written out, by name and where it is in the struct,
+ * so the CSV, JSON and debug output all come from the one list.
+ */
+struct Counter {
+  const char *name;
+  size_t offset;
+};
+
+#define LINK_COUNTER(field) {#field, offsetof(struct LinkStats, field)}
+#define NODE_COUNTER(field) {#field, offsetof(struct NodeStats, field)}
+
+static const struct Counter link_counters[] = {
+  LINK_COUNTER(frames_sent),
+  LINK_COUNTER(bytes_sent),
+  LINK_COUNTER(frames_received),
+  LINK_COUNTER(bytes_received),
+  LINK_COUNTER(retransmissions),
+  LINK_COUNTER(checksum_failures),
+  LINK_COUNTER(duplicate_data),
+  LINK_COUNTER(out_of_order_acks),
+  LINK_COUNTER(data_frames_received),
+  LINK_COUNTER(ack_frames_sent),
+  LINK_COUNTER(acks_piggybacked),
+  LINK_COUNTER(packets_aggregated),
+  LINK_COUNTER(fec_parity_sent),
+  LINK_COUNTER(fec_repaired),
+  LINK_COUNTER(packets_dropped),
+  LINK_COUNTER(frames_refused),
+  LINK_COUNTER(red_dropped),
+  LINK_COUNTER(codel_dropped),
+  LINK_COUNTER(queue_high_water),
+  LINK_COUNTER(latency_samples),
+  LINK_COUNTER(forward_samples),
+  LINK_COUNTER(packets_forwarded_early)};
+
+static const struct Counter node_counters[] = {
+  NODE_COUNTER(messages_sent),
+  NODE_COUNTER(messages_received),
+  NODE_COUNTER(bytes_received),
+  NODE_COUNTER(packets_forwarded),
+  NODE_COUNTER(packets_unroutable),
+  NODE_COUNTER(packets_expired),
+  NODE_COUNTER(transport_retransmissions),
+  NODE_COUNTER(transport_timeouts),
+  NODE_COUNTER(transport_duplicates),
+  NODE_COUNTER(messages_fragmented),
+  NODE_COUNTER(fragments_sent),
+  NODE_COUNTER(fragmented_dropped),
+  NODE_COUNTER(messages_reassembled),
+  NODE_COUNTER(reassembly_timeouts),
+  NODE_COUNTER(reassembly_dropped)};
+
+#define LINK_COUNTER_COUNT (sizeof(link_counters) / sizeof(link_counters[0]))
+#define NODE_COUNTER_COUNT (sizeof(node_counters) / sizeof(node_counters[0]))
+
+// End to end latency percentiles written out for each source.
+static const int percentiles[] = {50, 95, 99};
+
+#define PERCENTILE_COUNT (sizeof(percentiles) / sizeof(percentiles[0]))
+
+struct NodeStats node_stats;
+
+static struct LinkStats *links = NULL;
+static int link_count = 0;
+
+// Forward declarations
+static unsigned long long counter_value(const void *const stats,
+                                        const struct Counter *const counter);
+static CnetTime mean_latency(const struct LinkStats *const stats);
+static CnetTime mean_queue_delay(const struct ClassStats *const stats);
+static CnetTime mean_forward_delay(const struct LinkStats *const stats);
+static void write_csv(FILE *out);
+static void write_json(FILE *out);
+
+void init_stats() {
+  free(links);
+
+  link_count = nodeinfo.nlinks;
+  links = (struct LinkStats *)calloc(link_count > 0 ? link_count : 1,
+                                     sizeof(struct LinkStats));
+
+  // If we can't allocate memory for this, it's a serious problem
+  // can't recover from.
+  assert(links);
+
+  node_stats = (struct NodeStats) {0};
+}
+
+struct LinkStats *link_stats(const int link) {
+  return &links[link - 1];
+}
+
+void record_hop_latency(struct LinkStats *const stats,
+                        const CnetTime latency) {
+  if (stats->latency_samples == 0 || latency < stats->latency_min) {
+    stats->latency_min = latency;
+  }
+
+  if (latency > stats->latency_max) {
+    stats->latency_max = latency;
+  }
+
+  stats->latency_total += latency;
+  ++stats->latency_samples;
+}
+
+void record_queue_delay(struct LinkStats *const stats,
+                        const struct Packet *const packet,
+                        const CnetTime delay) {
+  struct ClassStats *class_stats = &stats->classes[packet_class(packet)];
+
+  if (delay > class_stats->queue_delay_max) {
+    class_stats->queue_delay_max = delay;
+  }
+
+  class_stats->queue_delay_total += delay;
+  class_stats->bytes_sent += packet->length;
+  ++class_stats->packets_sent;
+}
+
+void record_forward_delay(struct LinkStats *const stats,
+                          const CnetTime delay) {
+  if (delay > stats->forward_delay_max) {
+    stats->forward_delay_max = delay;
+  }
+
+  stats->forward_delay_total += delay;
+  ++stats->forward_samples;
+}
+
+/*
+ * Write stats
+ *
+ * The file is "<statsprefix><nodename>.csv" (or .json). Nothing is
+ * written if stats are off.
+ */
+void write_stats() {
+  if (config.stats_format == STATS_OFF) {
+    return;
+  }
+
+  const char *extension = (config.stats_format == STATS_CSV) ?
+      "csv" : "json";
+  char filename[256];
+
+  snprintf(filename, sizeof(filename), "%s%s.%s",
+           config.stats_prefix, nodeinfo.nodename, extension);
+
+  FILE *out = fopen(filename, "w");
+
+  if (out == NULL) {
+    printf("Node: %d. Can't write stats to %s.\n",
+           nodeinfo.address, filename);
+    return;
+  }
+
+  if (config.stats_format == STATS_CSV) {
+    write_csv(out);
+  } else {
+    write_json(out);
+  }
+
+  fclose(out);
+}
+
+void debug_stats() {
+  printf("Node counters.\n");
+  for (size_t i = 0; i < NODE_COUNTER_COUNT; ++i) {
+    printf("  %-20s %llu\n", node_counters[i].name,
+           counter_value(&node_stats, &node_counters[i]));
+  }
+
+  printf("Link counters.\n");
+  printf("  %-20s", "Link");
+  for (int link = 1; link <= link_count; ++link) {
+    printf(" %10d", link);
+  }
+  printf("\n");
+
+  for (size_t i = 0; i < LINK_COUNTER_COUNT; ++i) {
+    printf("  %-20s", link_counters[i].name);
+
+    for (int link = 1; link <= link_count; ++link) {
+      printf(" %10llu", counter_value(link_stats(link), &link_counters[i]));
+    }
+    printf("\n");
+  }
+
+  printf("Hop latency (usecs), min/mean/max.\n");
+  for (int link = 1; link <= link_count; ++link) {
+    const struct LinkStats *stats = link_stats(link);
+
+    printf("  Link %d: %lld/%lld/%lld\n", link,
+           (long long) stats->latency_min,
+           (long long) mean_latency(stats),
+           (long long) stats->latency_max);
+  }
+
+  printf("Forward delay (usecs), packets/mean/max.\n");
+  for (int link = 1; link <= link_count; ++link) {
+    const struct LinkStats *stats = link_stats(link);
+
+    printf("  Link %d: %llu/%lld/%lld\n", link,
+           stats->forward_samples,
+           (long long) mean_forward_delay(stats),
+           (long long) stats->forward_delay_max);
+  }
+
+  printf("Traffic classes (usecs queued), packets/mean/max.\n");
+  for (int link = 1; link <= link_count; ++link) {
+    printf("  Link %d:", link);
+
+    for (int i = 0; i < TRAFFIC_CLASSES; ++i) {
+      const struct ClassStats *stats = &link_stats(link)->classes[i];
+
+      printf(" %s %llu/%lld/%lld", traffic_class_name((enum TrafficClass) i),
+             stats->packets_sent,
+             (long long) mean_queue_delay(stats),
+             (long long) stats->queue_delay_max);
+    }
+    printf("\n");
+  }
+}
+
+static unsigned long long counter_value(const void *const stats,
+                                        const struct Counter *const counter) {
+  return *(const unsigned long long *)((const char *) stats + counter->offset);
+}
+
+static CnetTime mean_latency(const struct LinkStats *const stats) {
+  if (stats->latency_samples == 0) {
+    return 0;
+  }
+
+  return stats->latency_total / (CnetTime) stats->latency_samples;
+}
+
+static CnetTime mean_forward_delay(const struct LinkStats *const stats) {
+  if (stats->forward_samples == 0) {
+    return 0;
+  }
+
+  return stats->forward_delay_total / (CnetTime) stats->forward_samples;
+}
+
+static CnetTime mean_queue_delay(const struct ClassStats *const stats) {
+  if (stats->packets_sent == 0) {
+    return 0;
+  }
+
+  return stats->queue_delay_total / (CnetTime) stats->packets_sent;
+}
+
+/*
+ * Write CSV
+ *
+ * A row per counter, node counters have link 0. The latencies go in
+ * as three more link counters, and the traffic class counters are
+ * named after their class.
+ */
+static void write_csv(FILE *out) {
+  fprintf(out, "node,link,counter,value\n");
+  fprintf(out, "%s,0,time_in_usec,%lld\n", nodeinfo.nodename,
+          (long long) nodeinfo.time_in_usec);
+
+  for (size_t i = 0; i < NODE_COUNTER_COUNT; ++i) {
+    fprintf(out, "%s,0,%s,%llu\n", nodeinfo.nodename, node_counters[i].name,
+            counter_value(&node_stats, &node_counters[i]));
+  }
+
+  // End to end latency of messages delivered here, by source.
+  for (int i = 0; i < latency_sources(); ++i) {
+    const int source = (int) latency_source(i);
+
+    fprintf(out, "%s,0,delivered_from_%d,%llu\n", nodeinfo.nodename,
+            source, latency_samples(i));
+
+    for (size_t p = 0; p < PERCENTILE_COUNT; ++p) {
+      fprintf(out, "%s,0,latency_p%d_from_%d,%lld\n", nodeinfo.nodename,
+              percentiles[p], source,
+              (long long) latency_percentile(i, percentiles[p]));
+    }
+  }
+
+  // And by traffic class.
+  for (int i = 0; i < TRAFFIC_CLASSES; ++i) {
+    const char *name = traffic_class_name((enum TrafficClass) i);
+
+    fprintf(out, "%s,0,delivered_%s,%llu\n", nodeinfo.nodename, name,
+            class_latency_samples((enum TrafficClass) i));
+
+    for (size_t p = 0; p < PERCENTILE_COUNT; ++p) {
+      fprintf(out, "%s,0,latency_p%d_%s,%lld\n", nodeinfo.nodename,
+              percentiles[p], name,
+              (long long) class_latency_percentile((enum TrafficClass) i,
+                                                   percentiles[p]));
+    }
+  }
+
+  for (int link = 1; link <= link_count; ++link) {
+    const struct LinkStats *stats = link_stats(link);
+
+    for (size_t i = 0; i < LINK_COUNTER_COUNT; ++i) {
+      fprintf(out, "%s,%d,%s,%llu\n", nodeinfo.nodename, link,
+              link_counters[i].name, counter_value(stats, &link_counters[i]));
+    }
+
+    fprintf(out, "%s,%d,latency_min,%lld\n", nodeinfo.nodename, link,
+            (long long) stats->latency_min);
+    fprintf(out, "%s,%d,latency_mean,%lld\n", nodeinfo.nodename, link,
+            (long long) mean_latency(stats));
+    fprintf(out, "%s,%d,latency_max,%lld\n", nodeinfo.nodename, link,
+            (long long) stats->latency_max);
+    fprintf(out, "%s,%d,forward_delay_mean,%lld\n", nodeinfo.nodename, link,
+            (long long) mean_forward_delay(stats));
+    fprintf(out, "%s,%d,forward_delay_max,%lld\n", nodeinfo.nodename, link,
+            (long long) stats->forward_delay_max);
+
+    for (int i = 0; i < TRAFFIC_CLASSES; ++i) {
+      const struct ClassStats *class_stats = &stats->classes[i];
+      const char *name = traffic_class_name((enum TrafficClass) i);
+
+      fprintf(out, "%s,%d,%s_packets_sent,%llu\n", nodeinfo.nodename, link,
+              name, class_stats->packets_sent);
+      fprintf(out, "%s,%d,%s_bytes_sent,%llu\n", nodeinfo.nodename, link,
+              name, class_stats->bytes_sent);
+      fprintf(out, "%s,%d,%s_queue_delay_mean,%lld\n", nodeinfo.nodename,
+              link, name, (long long) mean_queue_delay(class_stats));
+      fprintf(out, "%s,%d,%s_queue_delay_max,%lld\n", nodeinfo.nodename,
+              link, name, (long long) class_stats->queue_delay_max);
+    }
+  }
+}
+
+static void write_json(FILE *out) {
+  fprintf(out, "{\n  \"node\": \"%s\",\n  \"address\": %d,\n",
+          nodeinfo.nodename, (int) nodeinfo.address);
+  fprintf(out, "  \"time_in_usec\": %lld,\n",
+          (long long) nodeinfo.time_in_usec);
+
+  for (size_t i = 0; i < NODE_COUNTER_COUNT; ++i) {
+    fprintf(out, "  \"%s\": %llu,\n", node_counters[i].name,
+            counter_value(&node_stats, &node_counters[i]));
+  }
+
+  fprintf(out, "  \"sources\": [");
+
+  for (int i = 0; i < latency_sources(); ++i) {
+    fprintf(out, "%s\n    {\"source\": %d, \"delivered\": %llu",
+            (i == 0) ? "" : ",", (int) latency_source(i), latency_samples(i));
+
+    for (size_t p = 0; p < PERCENTILE_COUNT; ++p) {
+      fprintf(out, ", \"latency_p%d\": %lld", percentiles[p],
+              (long long) latency_percentile(i, percentiles[p]));
+    }
+
+    fprintf(out, "}");
+  }
+
+  fprintf(out, "\n  ],\n  \"classes\": [");
+
+  for (int i = 0; i < TRAFFIC_CLASSES; ++i) {
+    fprintf(out, "%s\n    {\"class\": \"%s\", \"delivered\": %llu",
+            (i == 0) ? "" : ",", traffic_class_name((enum TrafficClass) i),
+            class_latency_samples((enum TrafficClass) i));
+
+    for (size_t p = 0; p < PERCENTILE_COUNT; ++p) {
+      fprintf(out, ", \"latency_p%d\": %lld", percentiles[p],
+              (long long) class_latency_percentile((enum TrafficClass) i,
+                                                   percentiles[p]));
+    }
+
+    fprintf(out, "}");
+  }
+
+  fprintf(out, "\n  ],\n  \"links\": [");
+
+  for (int link = 1; link <= link_count; ++link) {
+    const struct LinkStats *stats = link_stats(link);
+
+    fprintf(out, "%s\n    {\"link\": %d", (link == 1) ? "" : ",", link);
+
+    for (size_t i = 0; i < LINK_COUNTER_COUNT; ++i) {
+      fprintf(out, ", \"%s\": %llu", link_counters[i].name,
+              counter_value(stats, &link_counters[i]));
+    }
+
+    fprintf(out, ", \"latency_min\": %lld, \"latency_mean\": %lld,"
+            " \"latency_max\": %lld",
+            (long long) stats->latency_min,
+            (long long) mean_latency(stats),
+            (long long) stats->latency_max);
+    fprintf(out, ", \"forward_delay_mean\": %lld, \"forward_delay_max\": %lld",
+            (long long) mean_forward_delay(stats),
+            (long long) stats->forward_delay_max);
+
+    for (int i = 0; i < TRAFFIC_CLASSES; ++i) {
+      const struct ClassStats *class_stats = &stats->classes[i];
+      const char *name = traffic_class_name((enum TrafficClass) i);
+
+      fprintf(out, ", \"%s_packets_sent\": %llu, \"%s_bytes_sent\": %llu,"
+              " \"%s_queue_delay_mean\": %lld,"
+              " \"%s_queue_delay_max\": %lld",
+              name, class_stats->packets_sent, name, class_stats->bytes_sent,
+              name, (long long) mean_queue_delay(class_stats),
+              name, (long long) class_stats->queue_delay_max);
+    }
+
+    fprintf(out, "}");
+  }
+
+  fprintf(out, "\n  ]\n}\n");
+}
@@ -0,0 +1,206 @@
+/*
+ * CC200 Assignment
+ *
+ * Author: Mike Aldred
+ *
+ * Statistics
+ *
+ * Description:
+ *
+ *   Counters for the node, and for each of its links, so runs can be
+ *   compared without having to grep the printed output. The layers
+ *   bump the counters as they go, the debug button prints them, and
+ *   at shutdown they're written out as CSV or JSON (check config.h),
+ *   one file per node:
+ *
+ *     cnet ASSIGNMENT.MAP stats=csv statsprefix=run1-
+ *
+ *   gives run1-<nodename>.csv for each node. The CSV has a row per
+ *   counter, "node,link,counter,value", with link 0 for the counters
+ *   that are for the whole node.
+ */
+
+#ifndef STATS_H_
+#define STATS_H_
+
+#include <cnet.h>
+
+#include "network_layer.h"
+
+/*
+ * Counters for each traffic class on a link. Queue delay is from the
+ * packet being queued to it going into the window.
+ */
+struct ClassStats {
+  unsigned long long packets_sent;
+  unsigned long long bytes_sent;
+  CnetTime queue_delay_total;
+  CnetTime queue_delay_max;
+};
+
+/*
+ * Counters for a link. Sent and received are frames actually put on,
+ * or taken off, the wire, including retransmissions and ACK frames.
+ */
+struct LinkStats {
+  unsigned long long frames_sent;
+  unsigned long long bytes_sent;
+  unsigned long long frames_received;
+  unsigned long long bytes_received;
+  unsigned long long retransmissions;
+  unsigned long long checksum_failures;
+
+  // DATA frames that had already been received, or were outside the
+  // receive window.
+  unsigned long long duplicate_data;
+
+  // ACKs for frames that weren't in the send window.
+  unsigned long long out_of_order_acks;
+
+  unsigned long long data_frames_received;
+  unsigned long long ack_frames_sent;
+  unsigned long long acks_piggybacked;
+
+  // Packets sent in another packet's DATA frame, with aggregate=on.
+  unsigned long long packets_aggregated;
+
+  // Parity frames sent, and frames put back together from parity,
+  // with fec on.
+  unsigned long long fec_parity_sent;
+  unsigned long long fec_repaired;
+
+  // Packets dropped because the link's queue was at its limit.
+  unsigned long long packets_dropped;
+
+  // DATA frames refused, with transport=off, because the queue their
+  // packets were going out on was at its limit.
+  unsigned long long frames_refused;
+
+  // Packets dropped early by RED as they arrived, or by CoDel as they
+  // left, with an aqm mode on.
+  unsigned long long red_dropped;
+  unsigned long long codel_dropped;
+  unsigned long long queue_high_water;
+
+  /*
+   * Hop latency, from a DATA frame first being sent to it being ACKed,
+   * in usecs. Includes any retransmissions.
+   */
+  unsigned long long latency_samples;
+  CnetTime latency_total;
+  CnetTime latency_min;
+  CnetTime latency_max;
+
+  /*
+   * Packets from other nodes sent out on the link, and how long each
+   * was at this node, from its frame arriving to it going into the
+   * window, in usecs.
+   */
+  unsigned long long forward_samples;
+  CnetTime forward_delay_total;
+  CnetTime forward_delay_max;
+
+  // Packets arriving on the link ahead of a lost frame that were
+  // forwarded without waiting for it, with cutthrough=on.
+  unsigned long long packets_forwarded_early;
+
+  struct ClassStats classes[TRAFFIC_CLASSES];
+};
+
+struct NodeStats {
+  unsigned long long messages_sent;
+  unsigned long long messages_received;
+  unsigned long long bytes_received;
+  unsigned long long packets_forwarded;
+  unsigned long long packets_unroutable;
+  unsigned long long packets_expired;  // Forwarded MAX_ROUTE_HOPS times.
+
+  // With transport=on, messages sent again, how many of those were
+  // from the timer running out, and copies that had already arrived.
+  unsigned long long transport_retransmissions;
+  unsigned long long transport_timeouts;
+  unsigned long long transport_duplicates;
+
+  // Messages split into fragments, and the fragments sent, including
+  // fragments split again on the way, and messages not sent at all
+  // with no room in the queue for every fragment. Messages put back
+  // together, and those thrown away, timed out or for a reassembly
+  // slot.
+  unsigned long long messages_fragmented;
+  unsigned long long fragments_sent;
+  unsigned long long fragmented_dropped;
+  unsigned long long messages_reassembled;
+  unsigned long long reassembly_timeouts;
+  unsigned long long reassembly_dropped;
+};
+
+/*
+ * Counters for the whole node, zeroed by init_stats.
+ */
+extern struct NodeStats node_stats;
+
+/*
+ * Init stats
+ *
+ * Zeroes every counter, and sets up the counters for each link on the
+ * node. Has to be called before the layers are set up, since they
+ * hold onto their link's counters.
+ */
+void init_stats();
+
+/*
+ * Link stats
+ *
+ * The counters for a link, links start from 1.
+ */
+struct LinkStats *link_stats(const int link);
+
+/*
+ * Record hop latency
+ *
+ * Adds a latency sample to the link's counters.
+ *
+ * stats - Counters for the link.
+ * latency - How long the frame took to be ACKed, in usecs.
+ */
+void record_hop_latency(struct LinkStats *const stats,
+                        const CnetTime latency);
+
+/*
+ * Record queue delay
+ *
+ * Counts a packet sent on the link, for its traffic class.
+ *
+ * stats - Counters for the link.
+ * packet - Packet that's gone into the window.
+ * delay - How long it was queued, in usecs.
+ */
+void record_queue_delay(struct LinkStats *const stats,
+                        const struct Packet *const packet,
+                        const CnetTime delay);
+
+/*
+ * Record forward delay
+ *
+ * Adds a packet from another node to the link's counters.
+ *
+ * stats - Counters for the link it's going out on.
+ * delay - How long it was at this node, in usecs.
+ */
+void record_forward_delay(struct LinkStats *const stats,
+                          const CnetTime delay);
+
+/*
+ * Write stats
+ *
+ * Called at shutdown. Writes the counters out to the node's stats
+ * file, in the configured format.
+ */
+void write_stats();
+
+/*
+ * For printing out the counters.
+ */
+void debug_stats();
+
+#endif
@@ -0,0 +1,558 @@
+/*
+ * CC200 Assignment
+ *
+ * Author: Mike Aldred
+ *
+ * Transport Layer
+ *
+ * Description:
+ *   Look at the header file for details.
+ */
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "application_layer.h"
+#include "config.h"
+#include "forwarding_table.h"
+#include "latency.h"
+#include "network_layer.h"
+#include "packet_queue.h"
+#include "routing.h"
+#include "stats.h"
+#include "transport_layer.h"
+
+// Each timeout in a row doubles the timeout, up to this many times.
+#define MAX_TRANSPORT_BACKOFF 64
+
+/*
+ * Everything kept for another node, as a destination and as a source.
+ * Messages are numbered from 0 each way. Copies of sent messages and
+ * messages received early are kept in slots by sequence number modulo
+ * MAX_TRANSPORT_WINDOW, no window is ever bigger than that.
+ */
+struct TransportPeer {
+  CnetAddr address;
+
+  // Oldest message not ACKed yet, and the next to be numbered.
+  uint32_t send_base;
+  uint32_t next_sequence;
+
+  // Copies of the messages from send_base up to next_sequence.
+  struct FrameBuffer *sent[MAX_TRANSPORT_WINDOW];
+
+  // Messages from the application waiting for room in the window.
+  struct PacketQueue waiting;
+
+  /*
+   * Congestion window and slow start threshold, in messages. ACKs are
+   * counted towards the next increase while over the threshold.
+   */
+  int window;
+  int threshold;
+  int acks_counted;
+  int duplicate_acks;
+
+  // Whether the application was last told the window had room.
+  bool window_open;
+
+  // Timer for the oldest message, with its backoff.
+  CnetTimerID timer;
+  int backoff;
+
+  /*
+   * Round trip time estimate in usecs, from one message at a time,
+   * and never one that's been sent again. 0 means no estimate yet.
+   */
+  CnetTime smoothed_rtt;
+  CnetTime rtt_variance;
+  bool timing;
+  uint32_t timed_sequence;
+  CnetTime timed_at;
+
+  // Next message expected from the node, and those that came early.
+  uint32_t expected;
+  struct FrameBuffer *received[MAX_TRANSPORT_WINDOW];
+};
+
+/*
+ * One peer for every node messages have gone to or come from, grown as
+ * new ones turn up, found by address through peer_index.
+ */
+static struct TransportPeer *peers = NULL;
+static size_t peer_count = 0;
+static size_t peer_capacity = 0;
+static struct ForwardingTable peer_index;
+
+// Forward declarations
+static struct TransportPeer *find_peer(const CnetAddr address);
+static struct TransportPeer *add_peer(const CnetAddr address);
+static uint32_t in_flight(const struct TransportPeer *const peer);
+static void send_waiting(struct TransportPeer *const peer);
+static void send_message(struct TransportPeer *const peer,
+                         struct FrameBuffer *const buffer,
+                         const uint32_t sequence);
+static void resend_oldest(struct TransportPeer *const peer);
+static void process_ack(struct TransportPeer *const peer,
+                        const uint32_t ack, const bool duplicate);
+static void process_message(struct TransportPeer *const peer,
+                            struct FrameBuffer *const in_buffer);
+static void deliver(struct FrameBuffer *const buffer);
+static void send_ack(const struct TransportPeer *const peer,
+                     const bool duplicate);
+static CnetTime route_timeout(const CnetAddr destination, const int costs,
+                              const CnetTime least);
+static void start_timer(struct TransportPeer *const peer);
+static void update_rtt(struct TransportPeer *const peer,
+                       const CnetTime sample);
+static void update_window(struct TransportPeer *const peer);
+
+void init_transport_layer() {
+  for (size_t i = 0; i < peer_count; ++i) {
+    free(peers[i].waiting.buffers);
+  }
+
+  peer_count = 0;
+  setup_forwarding_table(&peer_index);
+}
+
+void application_down_to_transport(const CnetAddr destination_address,
+                                   struct FrameBuffer *const buffer,
+                                   const size_t length) {
+  struct Packet *packet = &buffer->frame.packet;
+
+  packet->type = PACKET_DATA;
+  packet->length = length;
+
+  if (!config.transport) {
+    packet->sequenced = false;
+    transport_down_to_network(destination_address, buffer, length);
+    return;
+  }
+
+  struct TransportPeer *peer = find_peer(destination_address);
+
+  if (peer == NULL) {
+    peer = add_peer(destination_address);
+  }
+
+  add_to_queue(&peer->waiting, buffer, false);
+  send_waiting(peer);
+  update_window(peer);
+}
+
+void network_up_to_transport(struct FrameBuffer *const in_buffer) {
+  const struct Packet *packet = &in_buffer->frame.packet;
+
+  if (!packet->sequenced) {
+    deliver(in_buffer);
+    return;
+  }
+
+  struct TransportPeer *peer = find_peer(packet->source_address);
+
+  if (peer == NULL) {
+    peer = add_peer(packet->source_address);
+  }
+
+  if (packet->type == PACKET_ACK) {
+    process_ack(peer, packet->sequence, packet->duplicate);
+    release_frame_buffer(in_buffer);
+  } else {
+    process_message(peer, in_buffer);
+  }
+}
+
+bool transport_window_open(const CnetAddr destination) {
+  const struct TransportPeer *peer = find_peer(destination);
+
+  if (!config.transport || peer == NULL) {
+    return true;
+  }
+
+  return in_flight(peer) + queue_length(&peer->waiting) <
+      (size_t) peer->window;
+}
+
+/*
+ * The oldest message hasn't been ACKed in time, so it's taken as lost.
+ * The threshold goes to half what was in flight, and the window back
+ * to one, so it slow starts again.
+ */
+EVENT_HANDLER(transport_timeouts) {
+  struct TransportPeer *peer = &peers[(size_t)data];
+  const uint32_t outstanding = in_flight(peer);
+
+  peer->timer = NULLTIMER;
+
+  if (outstanding == 0) {
+    return;
+  }
+
+  ++node_stats.transport_timeouts;
+
+  peer->threshold = (outstanding / 2 > 2) ? (int)(outstanding / 2) : 2;
+  peer->window = 1;
+  peer->acks_counted = 0;
+  peer->duplicate_acks = 0;
+
+  if (peer->backoff < MAX_TRANSPORT_BACKOFF) {
+    peer->backoff *= 2;
+  }
+
+  resend_oldest(peer);
+  start_timer(peer);
+  update_window(peer);
+}
+
+void debug_transport_layer() {
+  if (!config.transport) {
+    return;
+  }
+
+  printf("Transport for destinations.\n");
+  printf("+---------+--------+-----------+-----------+------------+----------+\n");
+  printf("| Address | Window | Threshold | In Flight | Smooth RTT | Expected |\n");
+  printf("+---------+--------+-----------+-----------+------------+----------+\n");
+  for (size_t i = 0; i < peer_count; ++i) {
+    const struct TransportPeer *peer = &peers[i];
+
+    printf("| %7u | %6d | %9d | %9u | %10lld | %8u |\n",
+           (unsigned) peer->address,
+           peer->window,
+           peer->threshold,
+           (unsigned) in_flight(peer),
+           (long long) peer->smoothed_rtt,
+           (unsigned) peer->expected);
+    printf("+---------+--------+-----------+-----------+------------+----------+\n");
+  }
+}
+
+static struct TransportPeer *find_peer(const CnetAddr address) {
+  uint32_t index;
+
+  if (!forwarding_table_lookup(&peer_index, address, &index)) {
+    return NULL;
+  }
+
+  return &peers[index];
+}
+
+/*
+ * Add peer
+ *
+ * Starts a new peer off with nothing sent or received, slow starting
+ * from the initial window.
+ *
+ * Globals:
+ *   peers - Grown if there's no room for the peer.
+ */
+static struct TransportPeer *add_peer(const CnetAddr address) {
+  if (peer_count == peer_capacity) {
+    peer_capacity = (peer_capacity == 0) ? 16 : peer_capacity * 2;
+    peers = (struct TransportPeer *)realloc(
+        peers, peer_capacity * sizeof(struct TransportPeer));
+
+    // If we can't allocate memory for this, it's a serious problem
+    // can't recover from.
+    assert(peers);
+  }
+
+  forwarding_table_insert(&peer_index, address, (uint32_t) peer_count);
+  struct TransportPeer *peer = &peers[peer_count++];
+
+  memset(peer, 0, sizeof(*peer));
+  peer->address = address;
+  setup_queue(&peer->waiting, 0);
+  peer->window = (config.transport_window < TRANSPORT_INITIAL_WINDOW) ?
+      config.transport_window : TRANSPORT_INITIAL_WINDOW;
+  peer->threshold = config.transport_window;
+  peer->window_open = true;
+  peer->timer = NULLTIMER;
+  peer->backoff = 1;
+
+  return peer;
+}
+
+static uint32_t in_flight(const struct TransportPeer *const peer) {
+  return peer->next_sequence - peer->send_base;
+}
+
+/*
+ * Send waiting
+ *
+ * Numbers and sends the waiting messages while there's room in the
+ * window, keeping a copy of each in case it has to be sent again.
+ */
+static void send_waiting(struct TransportPeer *const peer) {
+  while (in_flight(peer) < (uint32_t) peer->window &&
+         queue_length(&peer->waiting) > 0) {
+    struct FrameBuffer *buffer = next_packet(&peer->waiting);
+    struct FrameBuffer *copy = allocate_frame_buffer();
+    const uint32_t sequence = peer->next_sequence++;
+    const size_t length = buffer->frame.packet.length;
+
+    memcpy(&copy->frame.packet.message, &buffer->frame.packet.message,
+           length);
+    copy->frame.packet.length = length;
+    peer->sent[sequence % MAX_TRANSPORT_WINDOW] = copy;
+
+    if (!peer->timing) {
+      peer->timing = true;
+      peer->timed_sequence = sequence;
+      peer->timed_at = nodeinfo.time_in_usec;
+    }
+
+    send_message(peer, buffer, sequence);
+
+    if (peer->timer == NULLTIMER) {
+      start_timer(peer);
+    }
+  }
+}
+
+static void send_message(struct TransportPeer *const peer,
+                         struct FrameBuffer *const buffer,
+                         const uint32_t sequence) {
+  struct Packet *packet = &buffer->frame.packet;
+
+  packet->type = PACKET_DATA;
+  packet->sequenced = true;
+  packet->sequence = sequence;
+  transport_down_to_network(peer->address, buffer, packet->length);
+}
+
+/*
+ * Resend oldest
+ *
+ * Sends the oldest unACKed message again, from its copy. If it was
+ * being timed, the round trip would be meaningless, so it isn't.
+ */
+static void resend_oldest(struct TransportPeer *const peer) {
+  const struct FrameBuffer *copy =
+      peer->sent[peer->send_base % MAX_TRANSPORT_WINDOW];
+  struct FrameBuffer *buffer = allocate_frame_buffer();
+  const size_t length = copy->frame.packet.length;
+
+  memcpy(&buffer->frame.packet.message, &copy->frame.packet.message, length);
+  buffer->frame.packet.length = length;
+
+  if (peer->timing && peer->timed_sequence == peer->send_base) {
+    peer->timing = false;
+  }
+
+  ++node_stats.transport_retransmissions;
+  send_message(peer, buffer, peer->send_base);
+}
+
+/*
+ * Process ACK
+ *
+ * An ACK that moves the window on frees the copies it covers, and
+ * opens the window a little for each. One that doesn't is a duplicate,
+ * the destination is missing the oldest message but getting the ones
+ * after it, so after a few the oldest is sent again and the window is
+ * halved. An ACK for a duplicate message doesn't count, it was a copy
+ * that got the ACK, not a message after a missing one.
+ */
+static void process_ack(struct TransportPeer *const peer,
+                        const uint32_t ack, const bool duplicate) {
+  const uint32_t outstanding = in_flight(peer);
+  const uint32_t acked = ack - peer->send_base;
+
+  if (acked == 0) {
+    if (outstanding > 0 && !duplicate &&
+        ++peer->duplicate_acks == TRANSPORT_DUPLICATE_ACKS) {
+      peer->threshold = (outstanding / 2 > 2) ? (int)(outstanding / 2) : 2;
+      peer->window = peer->threshold;
+      peer->acks_counted = 0;
+      resend_oldest(peer);
+      update_window(peer);
+    }
+    return;
+  }
+
+  // From before the window, or nonsense.
+  if (acked > outstanding) {
+    return;
+  }
+
+  if (peer->timing && peer->timed_sequence - peer->send_base < acked) {
+    peer->timing = false;
+    update_rtt(peer, nodeinfo.time_in_usec - peer->timed_at);
+  }
+
+  for (uint32_t i = 0; i < acked; ++i) {
+    const uint32_t slot = (peer->send_base + i) % MAX_TRANSPORT_WINDOW;
+
+    release_frame_buffer(peer->sent[slot]);
+    peer->sent[slot] = NULL;
+
+    if (peer->window < peer->threshold) {
+      ++peer->window;
+    } else if (++peer->acks_counted >= peer->window) {
+      ++peer->window;
+      peer->acks_counted = 0;
+    }
+  }
+
+  if (peer->window > config.transport_window) {
+    peer->window = config.transport_window;
+  }
+
+  peer->send_base = ack;
+  peer->duplicate_acks = 0;
+  peer->backoff = 1;
+
+  if (peer->timer != NULLTIMER) {
+    CNET_stop_timer(peer->timer);
+    peer->timer = NULLTIMER;
+  }
+
+  send_waiting(peer);
+
+  if (in_flight(peer) > 0 && peer->timer == NULLTIMER) {
+    start_timer(peer);
+  }
+
+  update_window(peer);
+}
+
+/*
+ * Process message
+ *
+ * Holds onto the message until every one before it has arrived, then
+ * passes up as many as are in order. Every message gets an ACK, even a
+ * duplicate, in case the ACK for it was lost.
+ *
+ * Globals:
+ *   node_stats - Duplicates counted.
+ */
+static void process_message(struct TransportPeer *const peer,
+                            struct FrameBuffer *const in_buffer) {
+  const uint32_t sequence = in_buffer->frame.packet.sequence;
+  const uint32_t ahead = sequence - peer->expected;
+  struct FrameBuffer **slot =
+      &peer->received[sequence % MAX_TRANSPORT_WINDOW];
+
+  if (ahead >= MAX_TRANSPORT_WINDOW || *slot != NULL) {
+    ++node_stats.transport_duplicates;
+    release_frame_buffer(in_buffer);
+    send_ack(peer, true);
+    return;
+  }
+
+  *slot = in_buffer;
+
+  while (peer->received[peer->expected % MAX_TRANSPORT_WINDOW] != NULL) {
+    slot = &peer->received[peer->expected % MAX_TRANSPORT_WINDOW];
+    deliver(*slot);
+    *slot = NULL;
+    ++peer->expected;
+  }
+
+  send_ack(peer, false);
+}
+
+/*
+ * Deliver
+ *
+ * Passes the message up to the application, and releases its buffer.
+ */
+static void deliver(struct FrameBuffer *const buffer) {
+  const struct Packet *packet = &buffer->frame.packet;
+
+  record_delivery(packet);
+  transport_up_to_application(&packet->message, packet->length);
+  release_frame_buffer(buffer);
+}
+
+static void send_ack(const struct TransportPeer *const peer,
+                     const bool duplicate) {
+  struct FrameBuffer *buffer = allocate_frame_buffer();
+  struct Packet *packet = &buffer->frame.packet;
+
+  packet->type = PACKET_ACK;
+  packet->length = 0;
+  packet->sequenced = true;
+  packet->sequence = peer->expected;
+  packet->duplicate = duplicate;
+  transport_down_to_network(peer->address, buffer, 0);
+}
+
+/*
+ * Route timeout
+ *
+ * The route's cost to the destination that many times over, but never
+ * less than least, which is also what it is with no route.
+ */
+static CnetTime route_timeout(const CnetAddr destination, const int costs,
+                              const CnetTime least) {
+  const struct Route *route = route_to(destination);
+
+  if (route == NULL || route->cost >= ROUTE_INFINITY ||
+      costs * route->cost < least) {
+    return least;
+  }
+
+  return costs * route->cost;
+}
+
+/*
+ * Start timer
+ *
+ * Times the oldest message, the smoothed RTT plus four times the
+ * variance, times the backoff. Until there's an estimate, the initial
+ * timeout.
+ */
+static void start_timer(struct TransportPeer *const peer) {
+  CnetTime timeout = route_timeout(peer->address, TRANSPORT_INITIAL_COSTS,
+                                   TRANSPORT_INITIAL_TIMEOUT);
+
+  if (peer->smoothed_rtt != 0) {
+    const CnetTime least = route_timeout(peer->address, TRANSPORT_MIN_COSTS,
+                                         TRANSPORT_MIN_TIMEOUT);
+
+    timeout = peer->smoothed_rtt + 4 * peer->rtt_variance;
+
+    if (timeout < least) {
+      timeout = least;
+    }
+  }
+
+  peer->timer = CNET_start_timer(EV_TIMER4, timeout * peer->backoff,
+                                 (CnetData)(peer - peers));
+}
+
+static void update_rtt(struct TransportPeer *const peer,
+                       const CnetTime sample) {
+  if (peer->smoothed_rtt == 0) {
+    // First sample.
+    peer->smoothed_rtt = sample;
+    peer->rtt_variance = sample / 2;
+  } else {
+    const CnetTime error = sample - peer->smoothed_rtt;
+
+    peer->rtt_variance += ((error < 0 ? -error : error) -
+                           peer->rtt_variance) / 4;
+    peer->smoothed_rtt += error / 8;
+  }
+}
+
+/*
+ * Update window
+ *
+ * Lets the network layer know if the window has filled up, or has
+ * room again, so it can turn the application off or on.
+ */
+static void update_window(struct TransportPeer *const peer) {
+  const bool open = transport_window_open(peer->address);
+
+  if (open != peer->window_open) {
+    peer->window_open = open;
+    transport_window_changed(peer->address);
+  }
+}
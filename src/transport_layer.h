@@ -0,0 +1,122 @@
+/*
+ * CC200 Assignment
+ *
+ * Author: Mike Aldred
+ *
+ * Transport Layer
+ *
+ * Description:
+ *
+ *   The data link layer makes each hop reliable, but a packet can
+ *   still go missing between the ends, dropped from a full queue or by
+ *   AQM (see aqm.h), or lost when a node on the way reboots. Nothing
+ *   stops a source sending faster than the slowest link on the way can
+ *   take, either, all it sees is its own first link.
+ *
+ *   With transport=on, messages to each destination are numbered, and
+ *   the destination sends back an ACK packet for every one that
+ *   arrives, with the next number it's expecting. Messages that turn
+ *   up early are held until the ones before them arrive, and passed up
+ *   in order, duplicates are thrown away. The source keeps a copy of
+ *   every message until it's ACKed, and sends the oldest again if the
+ *   timer runs out, or if three ACKs in a row don't move on. An ACK
+ *   for a message that had already arrived says so, and doesn't count
+ *   towards those three, the copy was sent again because of a timeout
+ *   and says nothing about what's missing. The timeout comes from a
+ *   smoothed round trip time, the same way as the data link layer's
+ *   ACK timeouts, and before there is one, from the cost of the route,
+ *   so on slow links the first message isn't taken as lost before it
+ *   could possibly have been ACKed.
+ *
+ *   How many messages can be unACKed to a destination is its
+ *   congestion window, which goes the TCP Reno way. It starts at four,
+ *   goes up by one for each ACK until it reaches the slow start
+ *   threshold, then by one a window's worth of ACKs. A lost message
+ *   halves it, or drops it back to one after a timeout. It's never
+ *   more than transportwindow. When the window is full the application
+ *   stops generating messages for the destination, the same as for a
+ *   congested link, so the source sends only as fast as the ACKs come
+ *   back.
+ *
+ *   ACK packets go back through the network as control traffic. With
+ *   qos=size control is one of the classes sharing each link by
+ *   deficit round robin (see packet_queue.h), with a quantum of its
+ *   own, so ACKs get a steady share of a busy link rather than going
+ *   out ahead of everything. With transport=off messages go straight
+ *   through, unnumbered, as before.
+ */
+
+#ifndef TRANSPORT_LAYER_H_
+#define TRANSPORT_LAYER_H_
+
+#include <cnet.h>
+#include <stdbool.h>
+
+#include "frame_buffer.h"
+
+/*
+ * Timeout before there's a round trip time, and the least it can be,
+ * in times the route's cost, what a full sized frame takes to get to
+ * the destination. Neither is ever under the fixed time, for a
+ * destination with no route, or on very fast links.
+ */
+#define TRANSPORT_INITIAL_COSTS 4
+#define TRANSPORT_MIN_COSTS 2
+#define TRANSPORT_INITIAL_TIMEOUT 3000000
+#define TRANSPORT_MIN_TIMEOUT 200000
+
+// Window a destination starts with, as TCP's (RFC 3390).
+#define TRANSPORT_INITIAL_WINDOW 4
+
+// Duplicate ACKs that have the oldest message sent again.
+#define TRANSPORT_DUPLICATE_ACKS 3
+
+/*
+ * Init transport layer
+ *
+ * Forgets every destination and source, any frame buffers held from
+ * before a reboot are already back in the pool.
+ */
+void init_transport_layer();
+
+/*
+ * Application down to transport
+ *
+ * Takes the message from the application, already read into the
+ * frame buffer, numbers it and sends it on if there's room in the
+ * destination's window. Otherwise it waits for room. The transport
+ * layer takes the buffer.
+ */
+void application_down_to_transport(const CnetAddr destination_address,
+                                   struct FrameBuffer *const buffer,
+                                   const size_t length);
+
+/*
+ * Network up to transport
+ *
+ * Takes a data or ACK packet that's arrived at its destination. The
+ * transport layer takes the buffer.
+ */
+void network_up_to_transport(struct FrameBuffer *const in_buffer);
+
+/*
+ * Transport window open
+ *
+ * Whether there's room in the destination's congestion window for
+ * another message. Always true with transport=off.
+ */
+bool transport_window_open(const CnetAddr destination);
+
+/*
+ * The event handler for when the oldest message to a destination has
+ * gone unACKed too long. The destination's index is passed in via the
+ * CNET data variable.
+ */
+EVENT_HANDLER(transport_timeouts);
+
+/*
+ * For printing out the state of each destination.
+ */
+void debug_transport_layer();
+
+#endif
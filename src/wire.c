@@ -0,0 +1,566 @@
+/*
+ * CC200 Assignment
+ *
+ * Author: Mike Aldred
+ *
+ * Wire Format
+ *
+ * Description:
+ *   Look at the header file for details.
+ */
+
+#include <stdint.h>
+
+#include "config.h"
+#include "wire.h"
+
+// Frame flags, the first byte of the frame header.
+#define FLAG_ACK_FRAME 0x01   // Otherwise a DATA frame.
+#define FLAG_HAS_ACK 0x02     // A cumulative ACK follows the sequence.
+#define FLAG_AGGREGATE 0x04   // Packet count and sizes follow.
+#define FLAG_FEC 0x08         // The DATA frame's parity group follows.
+#define FLAG_PARITY 0x10      // A parity frame, nothing else is set.
+
+// Packet flags, the first byte of the packet header.
+#define FLAG_ROUTING 0x01     // Routing packet, otherwise data.
+#define FLAG_TRACE 0x02       // The packet has a trace.
+#define FLAG_ACK 0x04         // End to end ACK packet.
+#define FLAG_SEQUENCED 0x08   // The transport sequence number follows.
+#define FLAG_FRAGMENT 0x10    // Fragment id, offset and message length follow.
+#define FLAG_DUPLICATE 0x20   // End to end ACK for a duplicate message.
+
+// Longest a 64 bit varint can be.
+#define MAX_VARINT_SIZE 10
+
+// Smallest packet header, the flags and four one byte varints.
+#define MIN_PACKET_HEADER_SIZE 5
+
+// Forward declarations
+static unsigned char *encode_frame_header(const struct Frame *const frame,
+                                          unsigned char *out);
+static bool decode_parity(struct Frame *const frame, const unsigned char *in,
+                          const unsigned char *const end);
+static bool decode_fragment(struct Packet *const packet,
+                            const unsigned char **in,
+                            const unsigned char *const end);
+static size_t frame_header_size(const struct Frame *const frame);
+static size_t packet_header_size(const struct Packet *const packet);
+static size_t varint_size(uint64_t value);
+static unsigned char *put_varint(unsigned char *out, uint64_t value);
+static bool get_varint(const unsigned char **in, const unsigned char *end,
+                       uint64_t *const value);
+
+unsigned char *wire_bytes(struct Frame *const frame) {
+  return (unsigned char *) &frame->packet.message;
+}
+
+size_t wire_packet_size(const struct Packet *const packet) {
+  return packet->length + packet_header_size(packet) + 1;
+}
+
+size_t wire_frame_size(const struct Frame *const frame) {
+  const size_t packet_size = (frame->type != DL_ACK) ? frame->length : 0;
+
+  return packet_size + frame_header_size(frame) + 1 + WIRE_CHECKSUM_SIZE;
+}
+
+/*
+ * Encode packet
+ *
+ * Check header file for details.
+ */
+size_t encode_packet(struct Packet *const packet) {
+  unsigned char *start = (unsigned char *) &packet->message + packet->length;
+  unsigned char *out = start;
+  unsigned char flags = 0;
+
+  if (packet->type == PACKET_ROUTING) {
+    flags |= FLAG_ROUTING;
+  }
+
+  if (packet->type == PACKET_ACK) {
+    flags |= FLAG_ACK;
+
+    if (packet->duplicate) {
+      flags |= FLAG_DUPLICATE;
+    }
+  }
+
+  if (packet->trace_length > 0) {
+    flags |= FLAG_TRACE;
+  }
+
+  if (packet->sequenced) {
+    flags |= FLAG_SEQUENCED;
+  }
+
+  if (packet->fragment) {
+    flags |= FLAG_FRAGMENT;
+  }
+
+  *out++ = flags;
+  out = put_varint(out, packet->destination_address);
+  out = put_varint(out, packet->source_address);
+  out = put_varint(out, (uint64_t) packet->sent_time);
+  out = put_varint(out, (uint64_t) packet->hops);
+
+  if (flags & FLAG_SEQUENCED) {
+    out = put_varint(out, packet->sequence);
+  }
+
+  if (flags & FLAG_FRAGMENT) {
+    out = put_varint(out, packet->fragment_id);
+    out = put_varint(out, packet->fragment_offset);
+    out = put_varint(out, packet->message_length);
+  }
+
+  if (flags & FLAG_TRACE) {
+    *out++ = (unsigned char) packet->trace_length;
+
+    for (int i = 0; i < packet->trace_length; ++i) {
+      out = put_varint(out, packet->trace[i]);
+    }
+  }
+
+  *out = (unsigned char)(out - start);
+  ++out;
+
+  return packet->length + (out - start);
+}
+
+/*
+ * Encode frame
+ *
+ * Check header file for details.
+ */
+size_t encode_frame(struct Frame *const frame) {
+  unsigned char *start = wire_bytes(frame) +
+      ((frame->type != DL_ACK) ? frame->length : 0);
+  unsigned char *out = start;
+
+  if (frame->type == DL_PARITY) {
+    *out++ = FLAG_PARITY;
+    out = put_varint(out, (uint64_t) frame->fec_group);
+    out = put_varint(out, (uint64_t) frame->fec_count);
+    out = put_varint(out, frame->fec_length_xor);
+  } else {
+    out = encode_frame_header(frame, out);
+  }
+
+  *out = (unsigned char)(out - start);
+  ++out;
+
+  // Room for the checksum.
+  out += WIRE_CHECKSUM_SIZE;
+
+  return out - wire_bytes(frame);
+}
+
+/*
+ * Encode frame header
+ *
+ * The header of a DATA or ACK frame.
+ */
+static unsigned char *encode_frame_header(const struct Frame *const frame,
+                                          unsigned char *out) {
+  const bool data = (frame->type == DL_DATA);
+  unsigned char flags = 0;
+
+  if (!data) {
+    flags |= FLAG_ACK_FRAME;
+  }
+
+  if (frame->ack != NO_ACK) {
+    flags |= FLAG_HAS_ACK;
+  }
+
+  if (data && frame->packet_count > 1) {
+    flags |= FLAG_AGGREGATE;
+  }
+
+  if (data && frame->fec_group != NO_FEC_GROUP) {
+    flags |= FLAG_FEC;
+  }
+
+  *out++ = flags;
+  out = put_varint(out, (uint64_t) frame->sequence);
+
+  if (flags & FLAG_HAS_ACK) {
+    out = put_varint(out, (uint64_t) frame->ack);
+  }
+
+  if (flags & FLAG_AGGREGATE) {
+    out = put_varint(out, (uint64_t) frame->packet_count);
+
+    for (int i = 0; i < frame->packet_count - 1; ++i) {
+      out = put_varint(out, frame->packet_sizes[i]);
+    }
+  }
+
+  if (flags & FLAG_FEC) {
+    out = put_varint(out, (uint64_t) frame->fec_group);
+  }
+
+  return out;
+}
+
+/*
+ * Decode frame
+ *
+ * The header length, just before the checksum, says where the frame
+ * header starts, anything in front of that is packets. The packets
+ * are decoded last to first, so the frame's packet ends up as the
+ * first one.
+ *
+ * Check header file for details.
+ */
+bool decode_frame(struct Frame *const frame, const size_t wire_length) {
+  const unsigned char *bytes = wire_bytes(frame);
+
+  if (wire_length < 1 + WIRE_CHECKSUM_SIZE) {
+    return false;
+  }
+
+  const size_t header_end = wire_length - 1 - WIRE_CHECKSUM_SIZE;
+  const size_t header_length = bytes[header_end];
+
+  if (header_length < 2 || header_length > header_end) {
+    return false;
+  }
+
+  const size_t packets_length = header_end - header_length;
+  const unsigned char *in = bytes + packets_length;
+  const unsigned char *end = bytes + header_end;
+  const unsigned char flags = *in++;
+  uint64_t value;
+
+  frame->length = packets_length;
+  frame->fec_group = NO_FEC_GROUP;
+
+  if (flags & FLAG_PARITY) {
+    return decode_parity(frame, in, end);
+  }
+
+  frame->type = (flags & FLAG_ACK_FRAME) ? DL_ACK : DL_DATA;
+
+  if (!get_varint(&in, end, &value)) {
+    return false;
+  }
+  frame->sequence = (int) value;
+  frame->ack = NO_ACK;
+
+  if (flags & FLAG_HAS_ACK) {
+    if (!get_varint(&in, end, &value)) {
+      return false;
+    }
+    frame->ack = (int) value;
+  }
+
+  if (frame->type == DL_ACK) {
+    frame->packet_count = 0;
+    return packets_length == 0 && in == end;
+  }
+
+  frame->packet_count = 1;
+  frame->packet_sizes[0] = packets_length;
+
+  if (flags & FLAG_AGGREGATE) {
+    size_t remaining = packets_length;
+
+    if (!get_varint(&in, end, &value) || value < 2 ||
+        value > MAX_AGGREGATE_PACKETS) {
+      return false;
+    }
+    frame->packet_count = (int) value;
+
+    for (int i = 0; i < frame->packet_count - 1; ++i) {
+      if (!get_varint(&in, end, &value) || value == 0 || value >= remaining) {
+        return false;
+      }
+      frame->packet_sizes[i] = value;
+      remaining -= value;
+    }
+    frame->packet_sizes[frame->packet_count - 1] = remaining;
+  }
+
+  if (flags & FLAG_FEC) {
+    if (!get_varint(&in, end, &value)) {
+      return false;
+    }
+    frame->fec_group = (int) value;
+  }
+
+  if (in != end) {
+    return false;
+  }
+
+  size_t offset = packets_length;
+
+  for (int i = frame->packet_count - 1; i >= 0; --i) {
+    offset -= frame->packet_sizes[i];
+
+    if (!decode_packet(&frame->packet, bytes + offset,
+                       frame->packet_sizes[i])) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+/*
+ * Decode parity
+ *
+ * The rest of a parity frame's header, after the flags. Parity frames
+ * don't have a sequence number or ACK.
+ */
+static bool decode_parity(struct Frame *const frame, const unsigned char *in,
+                          const unsigned char *const end) {
+  uint64_t value;
+
+  frame->type = DL_PARITY;
+  frame->sequence = 0;
+  frame->ack = NO_ACK;
+  frame->packet_count = 0;
+
+  if (!get_varint(&in, end, &value)) {
+    return false;
+  }
+  frame->fec_group = (int) value;
+
+  if (!get_varint(&in, end, &value) || value == 0 || value > MAX_FEC_GROUP) {
+    return false;
+  }
+  frame->fec_count = (int) value;
+
+  if (!get_varint(&in, end, &value)) {
+    return false;
+  }
+  frame->fec_length_xor = value;
+
+  return frame->length > 0 && in == end;
+}
+
+/*
+ * Decode packet
+ *
+ * The same as a frame, the header length at the end says where the
+ * header starts, and the message is what's in front of it.
+ *
+ * Check header file for details.
+ */
+bool decode_packet(struct Packet *const packet,
+                   const unsigned char *const bytes,
+                   const size_t wire_size) {
+  if (wire_size < 1 + MIN_PACKET_HEADER_SIZE) {
+    return false;
+  }
+
+  const size_t header_end = wire_size - 1;
+  const size_t header_length = bytes[header_end];
+
+  if (header_length < MIN_PACKET_HEADER_SIZE || header_length > header_end) {
+    return false;
+  }
+
+  const unsigned char *in = bytes + header_end - header_length;
+  const unsigned char *end = bytes + header_end;
+  const unsigned char flags = *in++;
+  uint64_t value;
+
+  if (flags & FLAG_ROUTING) {
+    packet->type = PACKET_ROUTING;
+  } else {
+    packet->type = (flags & FLAG_ACK) ? PACKET_ACK : PACKET_DATA;
+  }
+
+  packet->length = header_end - header_length;
+  packet->trace_length = 0;
+  packet->sequenced = (flags & FLAG_SEQUENCED) != 0;
+  packet->duplicate = (flags & FLAG_DUPLICATE) != 0;
+  packet->fragment = (flags & FLAG_FRAGMENT) != 0;
+
+  if (!get_varint(&in, end, &value)) {
+    return false;
+  }
+  packet->destination_address = (CnetAddr) value;
+
+  if (!get_varint(&in, end, &value)) {
+    return false;
+  }
+  packet->source_address = (CnetAddr) value;
+
+  if (!get_varint(&in, end, &value)) {
+    return false;
+  }
+  packet->sent_time = (CnetTime) value;
+
+  if (!get_varint(&in, end, &value)) {
+    return false;
+  }
+  packet->hops = (int) value;
+
+  if (packet->sequenced) {
+    if (!get_varint(&in, end, &value) || value > UINT32_MAX) {
+      return false;
+    }
+    packet->sequence = (uint32_t) value;
+  }
+
+  if (packet->fragment && !decode_fragment(packet, &in, end)) {
+    return false;
+  }
+
+  if (flags & FLAG_TRACE) {
+    if (in == end || *in > MAX_TRACE_HOPS) {
+      return false;
+    }
+    packet->trace_length = *in++;
+
+    for (int i = 0; i < packet->trace_length; ++i) {
+      if (!get_varint(&in, end, &value)) {
+        return false;
+      }
+      packet->trace[i] = (CnetAddr) value;
+    }
+  }
+
+  return in == end;
+}
+
+/*
+ * Decode fragment
+ *
+ * The fragment's id, offset and message length, moving in past them.
+ * The fragment has to lie inside a message that fits in a frame
+ * buffer.
+ */
+static bool decode_fragment(struct Packet *const packet,
+                            const unsigned char **in,
+                            const unsigned char *const end) {
+  uint64_t value;
+
+  if (!get_varint(in, end, &value) || value > UINT32_MAX) {
+    return false;
+  }
+  packet->fragment_id = (uint32_t) value;
+
+  if (!get_varint(in, end, &value) || value >= MAX_MESSAGE_SIZE) {
+    return false;
+  }
+  packet->fragment_offset = value;
+
+  if (!get_varint(in, end, &value) || value > MAX_MESSAGE_SIZE) {
+    return false;
+  }
+  packet->message_length = value;
+
+  return packet->length > 0 &&
+         packet->fragment_offset + packet->length <= packet->message_length;
+}
+
+/*
+ * Frame header size
+ *
+ * The flags, sequence and ACK, and the packet count and sizes for an
+ * aggregated frame.
+ */
+static size_t frame_header_size(const struct Frame *const frame) {
+  if (frame->type == DL_PARITY) {
+    return 1 + varint_size((uint64_t) frame->fec_group) +
+        varint_size((uint64_t) frame->fec_count) +
+        varint_size(frame->fec_length_xor);
+  }
+
+  size_t size = 1 + varint_size((uint64_t) frame->sequence);
+
+  if (frame->ack != NO_ACK) {
+    size += varint_size((uint64_t) frame->ack);
+  }
+
+  if (frame->type == DL_DATA && frame->packet_count > 1) {
+    size += varint_size((uint64_t) frame->packet_count);
+
+    for (int i = 0; i < frame->packet_count - 1; ++i) {
+      size += varint_size(frame->packet_sizes[i]);
+    }
+  }
+
+  if (frame->type == DL_DATA && frame->fec_group != NO_FEC_GROUP) {
+    size += varint_size((uint64_t) frame->fec_group);
+  }
+
+  return size;
+}
+
+static size_t packet_header_size(const struct Packet *const packet) {
+  size_t size = 1 + varint_size(packet->destination_address) +
+      varint_size(packet->source_address) +
+      varint_size((uint64_t) packet->sent_time) +
+      varint_size((uint64_t) packet->hops);
+
+  if (packet->sequenced) {
+    size += varint_size(packet->sequence);
+  }
+
+  if (packet->fragment) {
+    size += varint_size(packet->fragment_id) +
+        varint_size(packet->fragment_offset) +
+        varint_size(packet->message_length);
+  }
+
+  if (packet->trace_length > 0) {
+    size += 1;
+
+    for (int i = 0; i < packet->trace_length; ++i) {
+      size += varint_size(packet->trace[i]);
+    }
+  }
+
+  return size;
+}
+
+static size_t varint_size(uint64_t value) {
+  size_t size = 1;
+
+  while (value >= 0x80) {
+    value >>= 7;
+    ++size;
+  }
+
+  return size;
+}
+
+static unsigned char *put_varint(unsigned char *out, uint64_t value) {
+  while (value >= 0x80) {
+    *out++ = (unsigned char)(value | 0x80);
+    value >>= 7;
+  }
+
+  *out++ = (unsigned char) value;
+  return out;
+}
+
+/*
+ * Get varint
+ *
+ * Reads a varint, moving in past it. False if it runs past end, or
+ * is too long to be one.
+ */
+static bool get_varint(const unsigned char **in, const unsigned char *end,
+                       uint64_t *const value) {
+  uint64_t result = 0;
+
+  for (int i = 0; i < MAX_VARINT_SIZE && *in < end; ++i) {
+    const unsigned char byte = *(*in)++;
+
+    result |= (uint64_t)(byte & 0x7f) << (7 * i);
+
+    if ((byte & 0x80) == 0) {
+      *value = result;
+      return true;
+    }
+  }
+
+  return false;
+}
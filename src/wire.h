@@ -0,0 +1,154 @@
+/*
+ * CC200 Assignment
+ *
+ * Author: Mike Aldred
+ *
+ * Wire Format
+ *
+ * Description:
+ *
+ *   Frames used to be sent as the struct Frame itself, so every frame
+ *   carried the frame and packet headers as they are in memory, enum,
+ *   size_t and padding included, nearly 100 bytes, and an ACK still
+ *   took 24. Now the headers are packed into a few bytes on the way
+ *   out, and unpacked into the struct on the way in.
+ *
+ *   The packed headers go after the message, not in front of it, so
+ *   the message can stay where it is in the frame buffer. A frame
+ *   arrives straight into the buffer's message, and goes out of it,
+ *   as before. On the wire a frame is:
+ *
+ *     packet(s) | frame header | header length (1 byte) | checksum (4)
+ *
+ *   and each packet is:
+ *
+ *     message | packet header | header length (1 byte)
+ *
+ *   The frame header is a flags byte, then the sequence number and
+ *   the piggybacked ACK if there is one. The packet header is a flags
+ *   byte, then the destination, source, sent time, hop count, and the
+ *   transport sequence number, fragment and trace, if it has them.
+ *   Numbers are varints, 7 bits a byte, low bits first, so small ones
+ *   take a single byte. Lengths aren't sent
+ *   for a single packet, the message is whatever comes before its
+ *   header, and the packet is whatever comes before the frame header.
+ *   An ACK frame has no packets and is 8 bytes.
+ *
+ *   An aggregated DATA frame (see data_link_layer.h) has its packets
+ *   one after the other, and the frame header also has the packet
+ *   count and the size of each packet but the last, which is what's
+ *   left over.
+ *
+ *   With FEC (see fec.h), a DATA frame in a parity group has the group
+ *   on the end of its frame header. A parity frame has the parity in
+ *   place of packets, and its header is a flags byte, the group, the
+ *   number of frames in it and their sizes XORed together.
+ *
+ *   The checksum covers everything before it (see checksum.h).
+ */
+
+#ifndef WIRE_H_
+#define WIRE_H_
+
+#include "data_link_layer.h"
+
+// Size of the checksum on the end of every frame.
+#define WIRE_CHECKSUM_SIZE 4
+
+/*
+ * Most bytes a frame has after its message, the headers with every
+ * field at their largest, plus the header lengths and checksum. Frame
+ * buffers have this much room after the message.
+ */
+#define MAX_WIRE_TRAILER_SIZE 112
+
+/*
+ * Most bytes a DATA frame with a single packet adds to the packet, the
+ * frame header with an ACK and parity group, its length and the
+ * checksum.
+ */
+#define MAX_DATA_FRAME_OVERHEAD 16
+
+/*
+ * Most bytes a frame can take on the wire, what fits in a frame buffer
+ * from wire_bytes. Aggregated frames are kept to this as well as the
+ * link's MTU.
+ */
+#define MAX_WIRE_FRAME_SIZE (sizeof(struct Message) + MAX_WIRE_TRAILER_SIZE)
+
+/*
+ * Wire bytes
+ *
+ * Where the frame starts on the wire, the start of the first packet's
+ * message.
+ */
+unsigned char *wire_bytes(struct Frame *const frame);
+
+/*
+ * Wire packet size
+ *
+ * How many bytes the packet takes on the wire, its message plus its
+ * header.
+ */
+size_t wire_packet_size(const struct Packet *const packet);
+
+/*
+ * Wire frame size
+ *
+ * How many bytes the frame takes on the wire. For DATA frames, the
+ * frame's length and packet sizes have to be filled in.
+ */
+size_t wire_frame_size(const struct Frame *const frame);
+
+/*
+ * Encode packet
+ *
+ * Writes the packet's header after its message.
+ *
+ * Returns the size of the packet on the wire, from its message.
+ */
+size_t encode_packet(struct Packet *const packet);
+
+/*
+ * Encode frame
+ *
+ * Writes the frame header after the frame's packets, which have to
+ * have been encoded already, leaving room for the checksum, which is
+ * up to the caller. A frame that's resent only needs this again.
+ *
+ * Returns the size of the frame on the wire, from wire_bytes.
+ */
+size_t encode_frame(struct Frame *const frame);
+
+/*
+ * Decode frame
+ *
+ * Fills in the frame header from a frame that's arrived, and the
+ * packet from the first packet in it. Any other packets are checked,
+ * but are left where they are, at their offset from wire_bytes. The
+ * checksum should be checked first.
+ *
+ * frame - Frame that arrived, at wire_bytes.
+ * wire_length - Size of what arrived.
+ *
+ * Returns false if the headers don't make sense.
+ */
+bool decode_frame(struct Frame *const frame, const size_t wire_length);
+
+/*
+ * Decode packet
+ *
+ * Fills in the packet header from a packet on the wire. The message
+ * isn't moved, so the packet should be at its own message.
+ *
+ * packet - Packet to fill in.
+ * bytes - The packet on the wire.
+ * wire_size - Size of the packet on the wire.
+ *
+ * Returns false if the header doesn't make sense.
+ */
+bool decode_packet(struct Packet *const packet,
+                   const unsigned char *const bytes,
+                   const size_t wire_size);
+
+#endif